@@ -23,11 +23,13 @@
 #include "sharedstate.h"
 #include "binding-util.h"
 #include "exception.h"
+#include "script-profiler.h"
 
 #define DEF_PLAY_STOP_POS(entity) \
 	RB_METHOD(audio_##entity##Play) \
 	{ \
 		RB_UNUSED_PARAM; \
+		PROFILER_ENTER("Audio." #entity "_play"); \
 		const char *filename; \
 		int volume = 100; \
 		int pitch = 100; \
@@ -37,6 +39,7 @@
 		else \
 			rb_get_args(argc, argv, "z|ii", &filename, &volume, &pitch RB_ARG_END); \
 		GUARD_EXC( shState->audio().entity##Play(filename, volume, pitch, pos); ) \
+		PROFILER_LEAVE(); \
 		return Qnil; \
 	} \
 	RB_METHOD(audio_##entity##Stop) \
@@ -55,11 +58,13 @@
 	RB_METHOD(audio_##entity##Play) \
 	{ \
 		RB_UNUSED_PARAM; \
+		PROFILER_ENTER("Audio." #entity "_play"); \
 		const char *filename; \
 		int volume = 100; \
 		int pitch = 100; \
 		rb_get_args(argc, argv, "z|ii", &filename, &volume, &pitch RB_ARG_END); \
 		GUARD_EXC( shState->audio().entity##Play(filename, volume, pitch); ) \
+		PROFILER_LEAVE(); \
 		return Qnil; \
 	} \
 	RB_METHOD(audio_##entity##Stop) \
@@ -97,6 +102,79 @@ DEF_FADE( me )
 
 DEF_PLAY_STOP( se )
 
+RB_METHOD(audioBgmPreload)
+{
+	RB_UNUSED_PARAM;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		VALUE filename = argv[i];
+		shState->audio().bgmPreload(StringValueCStr(filename));
+	}
+
+	return Qnil;
+}
+
+RB_METHOD(audioSePreload)
+{
+	RB_UNUSED_PARAM;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		VALUE filename = argv[i];
+		shState->audio().sePreload(StringValueCStr(filename));
+	}
+
+	return Qnil;
+}
+
+RB_METHOD(audioSePin)
+{
+	RB_UNUSED_PARAM;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		VALUE filename = argv[i];
+		shState->audio().sePin(StringValueCStr(filename));
+	}
+
+	return Qnil;
+}
+
+RB_METHOD(audioSeUnpin)
+{
+	RB_UNUSED_PARAM;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		VALUE filename = argv[i];
+		shState->audio().seUnpin(StringValueCStr(filename));
+	}
+
+	return Qnil;
+}
+
+RB_METHOD(audioSeCacheStats)
+{
+	RB_UNUSED_PARAM;
+
+	Audio::SECacheStats stats;
+	shState->audio().getSECacheStats(stats);
+
+	VALUE hash = rb_hash_new();
+
+	HASH_SET_STAT(hash, stats, bytes);
+	HASH_SET_STAT(hash, stats, budget);
+	HASH_SET_STAT(hash, stats, buffers);
+	HASH_SET_STAT(hash, stats, pinned);
+	HASH_SET_STAT(hash, stats, pending);
+	HASH_SET_STAT(hash, stats, hits);
+	HASH_SET_STAT(hash, stats, misses);
+	HASH_SET_STAT(hash, stats, evictions);
+
+	return hash;
+}
+
 RB_METHOD(audioSetupMidi)
 {
 	RB_UNUSED_PARAM;
@@ -150,5 +228,11 @@ audioBindingInit()
 
 	BIND_PLAY_STOP( se )
 
+	_rb_define_module_function(module, "bgm_preload", audioBgmPreload);
+	_rb_define_module_function(module, "se_preload", audioSePreload);
+	_rb_define_module_function(module, "se_pin", audioSePin);
+	_rb_define_module_function(module, "se_unpin", audioSeUnpin);
+	_rb_define_module_function(module, "se_cache_stats", audioSeCacheStats);
+
 	_rb_define_module_function(module, "__reset__", audioReset);
 }
@@ -30,15 +30,28 @@
 #include "graphics.h"
 #include "audio.h"
 #include "boost-hash.h"
+#include "script-profiler.h"
+#include "frame-gc.h"
 
 #include <ruby.h>
 #include <ruby/encoding.h>
+#include <ruby/version.h>
 
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <zlib.h>
 
 #include <SDL_filesystem.h>
+#include <SDL_cpuinfo.h>
+
+#if RUBY_API_VERSION_MAJOR > 2 || \
+    (RUBY_API_VERSION_MAJOR == 2 && RUBY_API_VERSION_MINOR >= 3)
+#define HAVE_ISEQ_BINARY
+#endif
 
 extern const char module_rpg1[];
 extern const char module_rpg2[];
@@ -47,12 +60,14 @@ extern const char module_rpg3[];
 static void mriBindingExecute();
 static void mriBindingTerminate();
 static void mriBindingReset();
+static void mriBindingFrameIdle(int64_t idleUs);
 
 ScriptBinding scriptBindingImpl =
 {
 	mriBindingExecute,
 	mriBindingTerminate,
-	mriBindingReset
+	mriBindingReset,
+	mriBindingFrameIdle
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
@@ -74,6 +89,7 @@ void audioBindingInit();
 void graphicsBindingInit();
 
 void fileIntBindingInit();
+void statsBindingInit();
 
 RB_METHOD(mriPrint);
 RB_METHOD(mriP);
@@ -81,6 +97,9 @@ RB_METHOD(mkxpDataDirectory);
 RB_METHOD(mkxpPuts);
 RB_METHOD(mkxpRawKeyStates);
 RB_METHOD(mkxpMouseInWindow);
+RB_METHOD(mkxpPrefetch);
+RB_METHOD(mkxpPrefetchStats);
+RB_METHOD(mkxpAudioStats);
 
 RB_METHOD(mriRgssMain);
 RB_METHOD(mriRgssStop);
@@ -146,6 +165,11 @@ static void mriBindingInit()
 	_rb_define_module_function(mod, "puts", mkxpPuts);
 	_rb_define_module_function(mod, "raw_key_states", mkxpRawKeyStates);
 	_rb_define_module_function(mod, "mouse_in_window", mkxpMouseInWindow);
+	_rb_define_module_function(mod, "prefetch", mkxpPrefetch);
+	_rb_define_module_function(mod, "prefetch_stats", mkxpPrefetchStats);
+	_rb_define_module_function(mod, "audio_stats", mkxpAudioStats);
+
+	statsBindingInit();
 
 	/* Load global constants */
 	rb_gv_set("MKXP", Qtrue);
@@ -240,6 +264,68 @@ RB_METHOD(mkxpMouseInWindow)
 	return rb_bool_new(EventThread::mouseState.inWindow);
 }
 
+RB_METHOD(mkxpPrefetch)
+{
+	RB_UNUSED_PARAM;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		VALUE path = argv[i];
+		shState->fileSystem().prefetch(StringValueCStr(path));
+	}
+
+	return Qnil;
+}
+
+RB_METHOD(mkxpPrefetchStats)
+{
+	RB_UNUSED_PARAM;
+
+	FileSystem::PrefetchStats stats;
+	shState->fileSystem().getPrefetchStats(stats);
+
+	VALUE hash = rb_hash_new();
+
+	HASH_SET_STAT(hash, stats, queued);
+	HASH_SET_STAT(hash, stats, dropped);
+	HASH_SET_STAT(hash, stats, completed);
+	HASH_SET_STAT(hash, stats, failed);
+	HASH_SET_STAT(hash, stats, hits);
+	HASH_SET_STAT(hash, stats, late);
+
+	return hash;
+}
+
+static VALUE
+streamStatsToHash(const Audio::StreamStats &stats)
+{
+	VALUE hash = rb_hash_new();
+
+	HASH_SET_STAT(hash, stats, underruns);
+	HASH_SET_STAT(hash, stats, queued);
+	hashSet(hash, "queue_target", UINT2NUM(stats.queueTarget));
+	HASH_SET_STAT(hash, stats, decoded);
+	hashSet(hash, "decode_target", UINT2NUM(stats.decodeTarget));
+
+	return hash;
+}
+
+RB_METHOD(mkxpAudioStats)
+{
+	RB_UNUSED_PARAM;
+
+	Audio::StreamStats bgm, bgs, me;
+	shState->audio().getStreamStats(bgm, bgs, me);
+
+	VALUE hash = rb_hash_new();
+
+	hashSet(hash, "bgm", streamStatsToHash(bgm));
+	hashSet(hash, "bgs", streamStatsToHash(bgs));
+	hashSet(hash, "me", streamStatsToHash(me));
+
+	return hash;
+}
+
 static VALUE rgssMainCb(VALUE block)
 {
 	rb_funcall2(block, rb_intern("call"), 0, 0);
@@ -378,6 +464,347 @@ struct BacktraceData
 
 #define SCRIPT_SECTION_FMT (rgssVer >= 3 ? "{%04ld}" : "Section%03ld")
 
+/* Inflates all script sections at once, spread
+ * over a couple of worker threads */
+struct ScriptInflater
+{
+	struct Job
+	{
+		const Bytef *source;
+		uLong sourceLen;
+
+		std::string result;
+		int status;
+	};
+
+	std::vector<Job> jobs;
+	SDL_atomic_t next;
+
+	static int inflateJob(Job &job)
+	{
+		z_stream strm;
+		memset(&strm, 0, sizeof(strm));
+
+		if (inflateInit(&strm) != Z_OK)
+			return Z_MEM_ERROR;
+
+		strm.next_in = const_cast<Bytef*>(job.source);
+		strm.avail_in = job.sourceLen;
+
+		/* Source code usually compresses to a quarter of its size.
+		 * When the guess is too small, inflating simply continues
+		 * into the grown buffer */
+		job.result.resize(job.sourceLen * 4 + 64);
+
+		int status;
+
+		while (true)
+		{
+			strm.next_out = reinterpret_cast<Bytef*>(&job.result[strm.total_out]);
+			strm.avail_out = job.result.size() - strm.total_out;
+
+			status = inflate(&strm, Z_FINISH);
+
+			if (status != Z_OK && status != Z_BUF_ERROR)
+				break;
+
+			/* Output space left over means the input was cut short */
+			if (strm.avail_out > 0)
+			{
+				status = Z_DATA_ERROR;
+				break;
+			}
+
+			job.result.resize(job.result.size() * 2);
+		}
+
+		job.result.resize(strm.total_out);
+		inflateEnd(&strm);
+
+		return status == Z_STREAM_END ? Z_OK : status;
+	}
+
+	void worker()
+	{
+		while (true)
+		{
+			size_t i = SDL_AtomicAdd(&next, 1);
+
+			if (i >= jobs.size())
+				return;
+
+			jobs[i].status = inflateJob(jobs[i]);
+		}
+	}
+
+	void run()
+	{
+		SDL_AtomicSet(&next, 0);
+
+		size_t threadCount = clamp(SDL_GetCPUCount(), 1, 8);
+		threadCount = std::min(threadCount, jobs.size());
+
+		std::vector<SDL_Thread*> threads;
+
+		/* The calling thread does its share too */
+		for (size_t i = 1; i < threadCount; ++i)
+		{
+			SDL_Thread *thread = createSDLThread
+				<ScriptInflater, &ScriptInflater::worker>(this, "script_inflate");
+
+			if (thread)
+				threads.push_back(thread);
+		}
+
+		worker();
+
+		for (size_t i = 0; i < threads.size(); ++i)
+			SDL_WaitThread(threads[i], 0);
+	}
+};
+
+static VALUE scriptFilename(long i, const char *scriptName, bool useNames)
+{
+	char buf[512];
+	int len;
+
+	if (useNames)
+		len = snprintf(buf, sizeof(buf), "%03ld:%s", i, scriptName);
+	else
+		len = snprintf(buf, sizeof(buf), SCRIPT_SECTION_FMT, i);
+
+	len = std::min<int>(len, sizeof(buf)-1);
+
+	return newStringUTF8(buf, len);
+}
+
+#ifdef HAVE_ISEQ_BINARY
+
+#define ISEQ_CACHE_MAGIC "MKIS"
+#define ISEQ_CACHE_VERSION 2
+
+/* Keeps the compiled instruction sequences of all script
+ * sections of a game in one file, so later launches only
+ * have to parse sections that were changed in between.
+ * Entries are keyed by a hash over the section source,
+ * its filename and the exact Ruby build.
+ * The header stores the length and a hash of everything
+ * after it; load_from_binary() doesn't validate its input,
+ * so a truncated or damaged file is ignored as a whole */
+struct ScriptISeqCache
+{
+	std::string path;
+
+	/* Source hash => binary, as read from the file */
+	BoostHash<uint64_t, std::string> stored;
+
+	/* Entries to be written back, in section order */
+	std::vector<std::pair<uint64_t, std::string> > current;
+	bool dirty;
+
+	struct Header
+	{
+		uint32_t version;
+		uint32_t count;
+		uint64_t length;
+		uint64_t checksum;
+	};
+
+	ScriptISeqCache(const Config &conf)
+	    : dirty(false)
+	{
+		if (conf.commonDataPath.empty())
+			return;
+
+		uint64_t gameHash = hashBytes(conf.game.title.c_str(), conf.game.title.size());
+		gameHash = hashBytes(conf.game.scripts.c_str(), conf.game.scripts.size(), gameHash);
+
+		char buf[32];
+		snprintf(buf, sizeof(buf), "iseq-%08x%08x.bin",
+		         (uint32_t) (gameHash >> 32), (uint32_t) gameHash);
+
+		path = conf.commonDataPath + buf;
+
+		read();
+	}
+
+	static uint64_t sourceHash(VALUE source, VALUE fname)
+	{
+		uint64_t hash = hashBytes(RSTRING_PTR(source), RSTRING_LEN(source));
+		hash = hashBytes(RSTRING_PTR(fname), RSTRING_LEN(fname), hash);
+		hash = hashBytes(ruby_description, strlen(ruby_description), hash);
+
+		return hash;
+	}
+
+	void read()
+	{
+		std::string data;
+
+		if (!readFileSDL(path.c_str(), data))
+			return;
+
+		const char *p = data.c_str();
+		const char *end = p + data.size();
+		Header header;
+
+		if (end - p < 4 + (long) sizeof(header)
+		||  memcmp(p, ISEQ_CACHE_MAGIC, 4))
+			return;
+
+		memcpy(&header, p+4, sizeof(header));
+		p += 4 + sizeof(header);
+
+		if (header.version != ISEQ_CACHE_VERSION
+		||  header.length != (uint64_t) (end - p)
+		||  header.checksum != hashBytes(p, end - p))
+		{
+			Debug() << "Ignoring invalid script cache" << path;
+			return;
+		}
+
+		for (uint32_t i = 0; i < header.count; ++i)
+		{
+			uint64_t hash;
+			uint32_t len;
+
+			if (end - p < (long) (sizeof(hash) + sizeof(len)))
+				return;
+
+			memcpy(&hash, p, sizeof(hash));
+			memcpy(&len, p + sizeof(hash), sizeof(len));
+			p += sizeof(hash) + sizeof(len);
+
+			if (end - p < (long) len)
+				return;
+
+			stored.insert(hash, std::string(p, len));
+			p += len;
+		}
+	}
+
+	void write()
+	{
+		if (!dirty || path.empty())
+			return;
+
+		std::string data;
+
+		for (size_t i = 0; i < current.size(); ++i)
+		{
+			uint64_t hash = current[i].first;
+			uint32_t len = current[i].second.size();
+
+			data.append(reinterpret_cast<const char*>(&hash), sizeof(hash));
+			data.append(reinterpret_cast<const char*>(&len), sizeof(len));
+			data.append(current[i].second);
+		}
+
+		Header header;
+		header.version = ISEQ_CACHE_VERSION;
+		header.count = current.size();
+		header.length = data.size();
+		header.checksum = hashBytes(data.c_str(), data.size());
+
+		data.insert(0, reinterpret_cast<const char*>(&header), sizeof(header));
+		data.insert(0, ISEQ_CACHE_MAGIC);
+
+		/* Write to a temporary file first, so a crash
+		 * never leaves a half written cache behind */
+		std::string tmpPath = path + ".tmp";
+		SDL_RWops *ops = RWFromFile(tmpPath.c_str(), "wb");
+
+		if (!ops)
+			return;
+
+		size_t written = SDL_RWwrite(ops, data.c_str(), 1, data.size());
+		SDL_RWclose(ops);
+
+		if (written != data.size() || !FileSystem::replaceFile(tmpPath, path))
+		{
+			FileSystem::removeFile(tmpPath);
+			Debug() << "Failed to write script cache" << path;
+		}
+	}
+};
+
+static VALUE iseqClass()
+{
+	VALUE vm = rb_const_get(rb_cObject, rb_intern("RubyVM"));
+
+	return rb_const_get(vm, rb_intern("InstructionSequence"));
+}
+
+static VALUE iseqCompileHelper(VALUE *args)
+{
+	/* source, file, path */
+	return rb_funcall2(iseqClass(), rb_intern("compile"), 3, args);
+}
+
+static VALUE iseqLoadHelper(VALUE binary)
+{
+	return rb_funcall2(iseqClass(), rb_intern("load_from_binary"), 1, &binary);
+}
+
+static VALUE iseqDumpHelper(VALUE iseq)
+{
+	return rb_funcall2(iseq, rb_intern("to_binary"), 0, 0);
+}
+
+/* Returns the instruction sequence for one section, or nil
+ * if it doesn't compile (its error is raised when the section
+ * is evaluated as source in order) */
+static VALUE compileScript(ScriptISeqCache &cache, VALUE source, VALUE fname)
+{
+	uint64_t hash = ScriptISeqCache::sourceHash(source, fname);
+	int state;
+
+	if (cache.stored.contains(hash))
+	{
+		const std::string binary = cache.stored.value(hash);
+		VALUE iseq = rb_protect(iseqLoadHelper,
+		                        rb_str_new(binary.c_str(), binary.size()), &state);
+
+		if (!state)
+		{
+			cache.current.push_back(std::make_pair(hash, binary));
+			return iseq;
+		}
+
+		rb_set_errinfo(Qnil);
+	}
+
+	VALUE args[] = { source, fname, fname };
+	VALUE iseq = rb_protect((VALUE (*)(VALUE)) iseqCompileHelper, (VALUE) args, &state);
+
+	if (state)
+	{
+		rb_set_errinfo(Qnil);
+		return Qnil;
+	}
+
+	VALUE binary = rb_protect(iseqDumpHelper, iseq, &state);
+
+	if (state)
+	{
+		rb_set_errinfo(Qnil);
+		return iseq;
+	}
+
+	cache.current.push_back(std::make_pair(hash,
+		std::string(RSTRING_PTR(binary), RSTRING_LEN(binary))));
+	cache.dirty = true;
+
+	return iseq;
+}
+
+static VALUE iseqEvalHelper(VALUE iseq)
+{
+	return rb_funcall2(iseq, rb_intern("eval"), 0, 0);
+}
+
+#endif
+
 static void runRMXPScripts(BacktraceData &btData)
 {
 	const Config &conf = shState->rtData().config;
@@ -419,44 +846,46 @@ static void runRMXPScripts(BacktraceData &btData)
 
 	long scriptCount = RARRAY_LEN(scriptArray);
 
-	std::string decodeBuffer;
-	decodeBuffer.resize(0x1000);
+	ScriptInflater inflater;
+	inflater.jobs.resize(scriptCount);
 
 	for (long i = 0; i < scriptCount; ++i)
 	{
 		VALUE script = rb_ary_entry(scriptArray, i);
+		ScriptInflater::Job &job = inflater.jobs[i];
+
+		job.source = 0;
+		job.sourceLen = 0;
+		job.status = Z_OK;
 
 		if (!RB_TYPE_P(script, RUBY_T_ARRAY))
 			continue;
 
-		VALUE scriptName   = rb_ary_entry(script, 1);
 		VALUE scriptString = rb_ary_entry(script, 2);
 
-		int result = Z_OK;
-		unsigned long bufferLen;
-
-		while (true)
-		{
-			unsigned char *bufferPtr =
-			        reinterpret_cast<unsigned char*>(const_cast<char*>(decodeBuffer.c_str()));
-			const unsigned char *sourcePtr =
-			        reinterpret_cast<const unsigned char*>(RSTRING_PTR(scriptString));
-
-			bufferLen = decodeBuffer.length();
+		if (!RB_TYPE_P(scriptString, RUBY_T_STRING))
+			continue;
 
-			result = uncompress(bufferPtr, &bufferLen,
-			                    sourcePtr, RSTRING_LEN(scriptString));
+		/* No Ruby code runs until all workers are done,
+		 * so these pointers stay valid */
+		job.source = reinterpret_cast<const Bytef*>(RSTRING_PTR(scriptString));
+		job.sourceLen = RSTRING_LEN(scriptString);
+	}
 
-			bufferPtr[bufferLen] = '\0';
+	inflater.run();
 
-			if (result != Z_BUF_ERROR)
-				break;
+	for (long i = 0; i < scriptCount; ++i)
+	{
+		VALUE script = rb_ary_entry(scriptArray, i);
+		ScriptInflater::Job &job = inflater.jobs[i];
 
-			decodeBuffer.resize(decodeBuffer.size()*2);
-		}
+		if (!job.source)
+			continue;
 
-		if (result != Z_OK)
+		if (job.status != Z_OK)
 		{
+			VALUE scriptName = rb_ary_entry(script, 1);
+
 			static char buffer[256];
 			snprintf(buffer, sizeof(buffer), "Error decoding script %ld: '%s'",
 			         i, RSTRING_PTR(scriptName));
@@ -466,8 +895,41 @@ static void runRMXPScripts(BacktraceData &btData)
 			break;
 		}
 
-		rb_ary_store(script, 3, rb_str_new_cstr(decodeBuffer.c_str()));
+		rb_ary_store(script, 3, rb_str_new(job.result.c_str(), job.result.size()));
+		std::string().swap(job.result);
+	}
+
+#ifdef HAVE_ISEQ_BINARY
+	/* Compiled sections, or nil for those that are to be
+	 * evaluated from source */
+	VALUE iseqs = rb_ary_new();
+
+	if (conf.scriptCache)
+	{
+		ScriptISeqCache cache(conf);
+
+		for (long i = 0; i < scriptCount; ++i)
+		{
+			VALUE script = rb_ary_entry(scriptArray, i);
+			VALUE scriptDecoded = rb_ary_entry(script, 3);
+
+			if (!RB_TYPE_P(scriptDecoded, RUBY_T_STRING))
+				break;
+
+			VALUE string = newStringUTF8(RSTRING_PTR(scriptDecoded),
+			                             RSTRING_LEN(scriptDecoded));
+			VALUE fname = scriptFilename(i, RSTRING_PTR(rb_ary_entry(script, 1)),
+			                             conf.useScriptNames);
+
+			rb_ary_push(iseqs, compileScript(cache, string, fname));
+		}
+
+		cache.write();
 	}
+#else
+	if (conf.scriptCache)
+		Debug() << "scriptCache requires Ruby 2.3 or newer, ignoring";
+#endif
 
 	/* Execute preloaded scripts */
 	for (std::set<std::string>::iterator i = conf.preloadScripts.begin();
@@ -487,21 +949,21 @@ static void runRMXPScripts(BacktraceData &btData)
 			VALUE string = newStringUTF8(RSTRING_PTR(scriptDecoded),
 			                             RSTRING_LEN(scriptDecoded));
 
-			VALUE fname;
 			const char *scriptName = RSTRING_PTR(rb_ary_entry(script, 1));
-			char buf[512];
-			int len;
+			VALUE fname = scriptFilename(i, scriptName, conf.useScriptNames);
+			btData.scriptNames.insert(RSTRING_PTR(fname), scriptName);
 
-			if (conf.useScriptNames)
-				len = snprintf(buf, sizeof(buf), "%03ld:%s", i, scriptName);
-			else
-				len = snprintf(buf, sizeof(buf), SCRIPT_SECTION_FMT, i);
+			int state;
 
-			fname = newStringUTF8(buf, len);
-			btData.scriptNames.insert(buf, scriptName);
+#ifdef HAVE_ISEQ_BINARY
+			VALUE iseq = rb_ary_entry(iseqs, i);
 
-			int state;
+			if (!NIL_P(iseq))
+				rb_protect(iseqEvalHelper, iseq, &state);
+			else
+#endif
 			evalString(string, fname, &state);
+
 			if (state)
 				break;
 		}
@@ -607,12 +1069,23 @@ static void mriBindingExecute()
 
 	mriBindingInit();
 
+	if (!conf.scriptProfile.empty())
+		scriptProfilerStart(conf.scriptProfileInterval);
+
+	if (conf.frameGC)
+		frameGCStart();
+
 	std::string &customScript = conf.customScript;
 	if (!customScript.empty())
 		runCustomScript(customScript);
 	else
 		runRMXPScripts(btData);
 
+	frameGCStop();
+
+	if (!conf.scriptProfile.empty())
+		scriptProfilerStop(conf.scriptProfile.c_str(), btData.scriptNames);
+
 	VALUE exc = rb_errinfo();
 	if (!NIL_P(exc) && !rb_obj_is_kind_of(exc, rb_eSystemExit))
 		showExc(exc, btData);
@@ -631,3 +1104,8 @@ static void mriBindingReset()
 {
 	rb_raise(getRbData()->exc[Reset], " ");
 }
+
+static void mriBindingFrameIdle(int64_t idleUs)
+{
+	frameGCIdle(idleUs);
+}
@@ -186,6 +186,23 @@ _rb_define_module_function(VALUE module, const char *name, RubyMethod func)
 	rb_define_module_function(module, name, RUBY_METHOD_FUNC(func), -1);
 }
 
+/* Fixed arity variants; Ruby calls these directly
+ * instead of packing the arguments into an array */
+typedef VALUE (*RubyMethod0)(VALUE self);
+typedef VALUE (*RubyMethod1)(VALUE self, VALUE arg);
+
+static inline void
+_rb_define_method(VALUE klass, const char *name, RubyMethod0 func)
+{
+	rb_define_method(klass, name, RUBY_METHOD_FUNC(func), 0);
+}
+
+static inline void
+_rb_define_method(VALUE klass, const char *name, RubyMethod1 func)
+{
+	rb_define_method(klass, name, RUBY_METHOD_FUNC(func), 1);
+}
+
 #define GUARD_EXC(exp) \
 { try { exp } catch (const Exception &exc) { raiseRbExc(exc); } }
 
@@ -208,6 +225,18 @@ objectLoad(int argc, VALUE *argv, VALUE self)
 	return obj;
 }
 
+/* Sets 'hash[:key] = value' */
+inline void
+hashSet(VALUE hash, const char *key, VALUE value)
+{
+	rb_hash_aset(hash, ID2SYM(rb_intern(key)), value);
+}
+
+/* Copies the unsigned counter 'field' of a stats struct
+ * into 'hash', keyed by its name */
+#define HASH_SET_STAT(hash, stats, field) \
+	hashSet(hash, #field, UINT2NUM((stats).field))
+
 static inline VALUE
 rb_bool_new(bool value)
 {
@@ -278,6 +307,107 @@ rb_check_argc(int actual, int expected)
 		         actual, expected);
 }
 
+/* Compile time selected conversions between Ruby values and
+ * C++ types, for use in templates (common cases are inlined,
+ * everything else goes through the 'rb_*_arg' functions) */
+template<typename T>
+struct RbValue;
+
+template<>
+struct RbValue<int>
+{
+	static int fromRb(VALUE arg, int argPos = 0)
+	{
+		if (FIXNUM_P(arg))
+			return FIX2INT(arg);
+
+		int value;
+		rb_int_arg(arg, &value, argPos);
+
+		return value;
+	}
+
+	static VALUE toRb(int value)
+	{
+		return rb_fix_new(value);
+	}
+};
+
+template<>
+struct RbValue<double>
+{
+	static double fromRb(VALUE arg, int argPos = 0)
+	{
+		double value;
+		rb_float_arg(arg, &value, argPos);
+
+		return value;
+	}
+
+	static VALUE toRb(double value)
+	{
+		return rb_float_new(value);
+	}
+};
+
+template<>
+struct RbValue<float>
+{
+	static float fromRb(VALUE arg, int argPos = 0)
+	{
+		return RbValue<double>::fromRb(arg, argPos);
+	}
+
+	static VALUE toRb(float value)
+	{
+		return rb_float_new(value);
+	}
+};
+
+template<>
+struct RbValue<bool>
+{
+	static bool fromRb(VALUE arg, int argPos = 0)
+	{
+		bool value;
+		rb_bool_arg(arg, &value, argPos);
+
+		return value;
+	}
+
+	static VALUE toRb(bool value)
+	{
+		return rb_bool_new(value);
+	}
+};
+
+/* Fixed arity property accessors, for the hottest ones */
+template<class C, typename T, T (C::*get)() const>
+static VALUE
+fastPropGet(VALUE self)
+{
+	C *c = getPrivateData<C>(self);
+	T value = T();
+
+	GUARD_EXC( value = (c->*get)(); )
+
+	return RbValue<T>::toRb(value);
+}
+
+template<class C, typename T, void (C::*set)(T)>
+static VALUE
+fastPropSet(VALUE self, VALUE arg)
+{
+	rb_check_frozen(self);
+
+	C *c = getPrivateData<C>(self);
+	T value = RbValue<T>::fromRb(arg);
+
+	GUARD_EXC( (c->*set)(value); )
+
+	return arg;
+}
+
 #define RB_METHOD(name) \
 	static VALUE name(int argc, VALUE *argv, VALUE self)
 
@@ -383,5 +513,13 @@ rb_check_argc(int actual, int expected)
 	_rb_define_method(klass, prop_name_s "=", Klass##Set##PropName); \
 }
 
+#define INIT_PROP_BIND_FAST(Klass, type, PropName, prop_name_s) \
+{ \
+	_rb_define_method(klass, prop_name_s, \
+		fastPropGet<Klass, type, &Klass::get##PropName>); \
+	_rb_define_method(klass, prop_name_s "=", \
+		fastPropSet<Klass, type, &Klass::set##PropName>); \
+}
+
 
 #endif // BINDING_UTIL_H
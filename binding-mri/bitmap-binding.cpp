@@ -26,6 +26,7 @@
 #include "disposable-binding.h"
 #include "binding-util.h"
 #include "binding-types.h"
+#include "script-profiler.h"
 
 DEF_TYPE(Bitmap);
 
@@ -50,6 +51,8 @@ void bitmapInitProps(Bitmap *b, VALUE self)
 
 RB_METHOD(bitmapInitialize)
 {
+	PROFILER_ENTER("Bitmap.new");
+
 	Bitmap *b = 0;
 
 	if (argc == 1)
@@ -70,6 +73,8 @@ RB_METHOD(bitmapInitialize)
 	setPrivateData(self, b);
 	bitmapInitProps(b, self);
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
@@ -111,30 +116,34 @@ RB_METHOD(bitmapRect)
 	return wrapObject(r, RectType);
 }
 
+/* Hot enough to convert its arguments directly */
 RB_METHOD(bitmapBlt)
 {
-	Bitmap *b = getPrivateData<Bitmap>(self);
+	PROFILER_ENTER("Bitmap#blt");
 
-	int x, y;
-	VALUE srcObj;
-	VALUE srcRectObj;
-	int opacity = 255;
+	Bitmap *b = getPrivateData<Bitmap>(self);
 
-	Bitmap *src;
-	Rect *srcRect;
+	if (argc != 4 && argc != 5)
+		rb_error_arity(argc, 4, 5);
 
-	rb_get_args(argc, argv, "iioo|i", &x, &y, &srcObj, &srcRectObj, &opacity RB_ARG_END);
+	int x = RbValue<int>::fromRb(argv[0], 0);
+	int y = RbValue<int>::fromRb(argv[1], 1);
+	int opacity = (argc == 5) ? RbValue<int>::fromRb(argv[4], 4) : 255;
 
-	src = getPrivateDataCheck<Bitmap>(srcObj, BitmapType);
-	srcRect = getPrivateDataCheck<Rect>(srcRectObj, RectType);
+	Bitmap *src = getPrivateDataCheck<Bitmap>(argv[2], BitmapType);
+	Rect *srcRect = getPrivateDataCheck<Rect>(argv[3], RectType);
 
 	GUARD_EXC( b->blt(x, y, *src, srcRect->toIntRect(), opacity); );
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
 RB_METHOD(bitmapStretchBlt)
 {
+	PROFILER_ENTER("Bitmap#stretch_blt");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	VALUE destRectObj;
@@ -153,38 +162,43 @@ RB_METHOD(bitmapStretchBlt)
 
 	GUARD_EXC( b->stretchBlt(destRect->toIntRect(), *src, srcRect->toIntRect(), opacity); );
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
 RB_METHOD(bitmapFillRect)
 {
+	PROFILER_ENTER("Bitmap#fill_rect");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
-	VALUE colorObj;
 	Color *color;
 
 	if (argc == 2)
 	{
-		VALUE rectObj;
-		Rect *rect;
-
-		rb_get_args(argc, argv, "oo", &rectObj, &colorObj RB_ARG_END);
-
-		rect = getPrivateDataCheck<Rect>(rectObj, RectType);
-		color = getPrivateDataCheck<Color>(colorObj, ColorType);
+		Rect *rect = getPrivateDataCheck<Rect>(argv[0], RectType);
+		color = getPrivateDataCheck<Color>(argv[1], ColorType);
 
 		GUARD_EXC( b->fillRect(rect->toIntRect(), color->norm); );
 	}
-	else
+	else if (argc == 5)
 	{
-		int x, y, width, height;
-
-		rb_get_args(argc, argv, "iiiio", &x, &y, &width, &height, &colorObj RB_ARG_END);
+		int x      = RbValue<int>::fromRb(argv[0], 0);
+		int y      = RbValue<int>::fromRb(argv[1], 1);
+		int width  = RbValue<int>::fromRb(argv[2], 2);
+		int height = RbValue<int>::fromRb(argv[3], 3);
 
-		color = getPrivateDataCheck<Color>(colorObj, ColorType);
+		color = getPrivateDataCheck<Color>(argv[4], ColorType);
 
 		GUARD_EXC( b->fillRect(x, y, width, height, color->norm); );
 	}
+	else
+	{
+		rb_raise(rb_eArgError, "wrong number of arguments (%d for 2 or 5)", argc);
+	}
+
+	PROFILER_LEAVE();
 
 	return self;
 }
@@ -193,10 +207,14 @@ RB_METHOD(bitmapClear)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Bitmap#clear");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	GUARD_EXC( b->clear(); )
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
@@ -236,6 +254,8 @@ RB_METHOD(bitmapSetPixel)
 
 RB_METHOD(bitmapHueChange)
 {
+	PROFILER_ENTER("Bitmap#hue_change");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	int hue;
@@ -244,11 +264,15 @@ RB_METHOD(bitmapHueChange)
 
 	GUARD_EXC( b->hueChange(hue); );
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
 RB_METHOD(bitmapDrawText)
 {
+	PROFILER_ENTER("Bitmap#draw_text");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	const char *str;
@@ -294,11 +318,15 @@ RB_METHOD(bitmapDrawText)
 		GUARD_EXC( b->drawText(x, y, width, height, str, align); );
 	}
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
 RB_METHOD(bitmapTextSize)
 {
+	PROFILER_ENTER("Bitmap#text_size");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	const char *str;
@@ -320,6 +348,8 @@ RB_METHOD(bitmapTextSize)
 
 	Rect *rect = new Rect(value);
 
+	PROFILER_LEAVE();
+
 	return wrapObject(rect, RectType);
 }
 
@@ -327,6 +357,8 @@ DEF_PROP_OBJ_VAL(Bitmap, Font, Font, "font")
 
 RB_METHOD(bitmapGradientFillRect)
 {
+	PROFILER_ENTER("Bitmap#gradient_fill_rect");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	VALUE color1Obj, color2Obj;
@@ -360,11 +392,15 @@ RB_METHOD(bitmapGradientFillRect)
 		GUARD_EXC( b->gradientFillRect(x, y, width, height, color1->norm, color2->norm, vertical); );
 	}
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
 RB_METHOD(bitmapClearRect)
 {
+	PROFILER_ENTER("Bitmap#clear_rect");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	if (argc == 1)
@@ -387,6 +423,8 @@ RB_METHOD(bitmapClearRect)
 		GUARD_EXC( b->clearRect(x, y, width, height); );
 	}
 
+	PROFILER_LEAVE();
+
 	return self;
 }
 
@@ -394,15 +432,21 @@ RB_METHOD(bitmapBlur)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Bitmap#blur");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	b->blur();
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
 RB_METHOD(bitmapRadialBlur)
 {
+	PROFILER_ENTER("Bitmap#radial_blur");
+
 	Bitmap *b = getPrivateData<Bitmap>(self);
 
 	int angle, divisions;
@@ -410,9 +454,39 @@ RB_METHOD(bitmapRadialBlur)
 
 	b->radialBlur(angle, divisions);
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
+static VALUE bitmapBatchYield(VALUE self)
+{
+	return rb_yield(self);
+}
+
+static VALUE bitmapBatchEnd(VALUE self)
+{
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	GUARD_EXC( b->endBatch(); );
+
+	return Qnil;
+}
+
+RB_METHOD(bitmapBatch)
+{
+	RB_UNUSED_PARAM;
+
+	rb_need_block();
+
+	Bitmap *b = getPrivateData<Bitmap>(self);
+
+	GUARD_EXC( b->beginBatch(); );
+
+	return rb_ensure(RUBY_METHOD_FUNC(bitmapBatchYield), self,
+	                 RUBY_METHOD_FUNC(bitmapBatchEnd), self);
+}
+
 RB_METHOD(bitmapInitializeCopy)
 {
 	rb_check_argc(argc, 1);
@@ -457,6 +531,7 @@ bitmapBindingInit()
 	_rb_define_method(klass, "hue_change",  bitmapHueChange);
 	_rb_define_method(klass, "draw_text",   bitmapDrawText);
 	_rb_define_method(klass, "text_size",   bitmapTextSize);
+	_rb_define_method(klass, "batch",       bitmapBatch);
 
 	if (rgssVer >= 2)
 	{
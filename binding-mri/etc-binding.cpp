@@ -37,6 +37,7 @@ DEF_TYPE(Rect);
 	} \
 	RB_METHOD(Klass##Set##Attr) \
 	{ \
+		rb_check_frozen(self); \
 		Klass *p = getPrivateData<Klass>(self); \
 		arg_type arg; \
 		rb_get_args(argc, argv, arg_t_s, &arg RB_ARG_END); \
@@ -45,7 +46,6 @@ DEF_TYPE(Rect);
 	}
 
 #define ATTR_DOUBLE_RW(Klass, Attr) ATTR_RW(Klass, Attr, double, "f", rb_float_new)
-#define ATTR_INT_RW(Klass, Attr)   ATTR_RW(Klass, Attr, int, "i", rb_fix_new)
 
 ATTR_DOUBLE_RW(Color, Red)
 ATTR_DOUBLE_RW(Color, Green)
@@ -57,11 +57,6 @@ ATTR_DOUBLE_RW(Tone, Green)
 ATTR_DOUBLE_RW(Tone, Blue)
 ATTR_DOUBLE_RW(Tone, Gray)
 
-ATTR_INT_RW(Rect, X)
-ATTR_INT_RW(Rect, Y)
-ATTR_INT_RW(Rect, Width)
-ATTR_INT_RW(Rect, Height)
-
 #define EQUAL_FUN(Klass) \
 	RB_METHOD(Klass##Equal) \
 	{ \
@@ -83,6 +78,7 @@ EQUAL_FUN(Rect)
 #define INIT_FUN(Klass, param_type, param_t_s, last_param_def) \
 	RB_METHOD(Klass##Initialize) \
 	{ \
+		rb_check_frozen(self); \
 		Klass *k; \
 		if (argc == 0) \
 		{ \
@@ -105,6 +101,7 @@ INIT_FUN(Rect, int, "iiii", 0)
 #define SET_FUN(Klass, param_type, param_t_s, last_param_def) \
 	RB_METHOD(Klass##Set) \
 	{ \
+		rb_check_frozen(self); \
 		Klass *k = getPrivateData<Klass>(self); \
 		if (argc == 1) \
 		{ \
@@ -128,6 +125,7 @@ SET_FUN(Rect, int, "iiii", 0)
 RB_METHOD(rectEmpty)
 {
 	RB_UNUSED_PARAM;
+	rb_check_frozen(self);
 	Rect *r = getPrivateData<Rect>(self);
 	r->empty();
 	return self;
@@ -217,9 +215,9 @@ etcBindingInit()
 
 	INIT_BIND(Rect);
 
-	RB_ATTR_RW(Rect, X, x);
-	RB_ATTR_RW(Rect, Y, y);
-	RB_ATTR_RW(Rect, Width, width);
-	RB_ATTR_RW(Rect, Height, height);
+	INIT_PROP_BIND_FAST(Rect, int, X, "x");
+	INIT_PROP_BIND_FAST(Rect, int, Y, "y");
+	INIT_PROP_BIND_FAST(Rect, int, Width, "width");
+	INIT_PROP_BIND_FAST(Rect, int, Height, "height");
 	_rb_define_method(klass, "empty", rectEmpty);
 }
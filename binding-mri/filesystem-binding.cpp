@@ -24,148 +24,306 @@
 #include "sharedstate.h"
 #include "filesystem.h"
 #include "util.h"
+#include "config.h"
+#include "marshal-loader.h"
+#include "script-profiler.h"
 
 #include "ruby/encoding.h"
 #include "ruby/intern.h"
 
-static void
-fileIntFreeInstance(void *inst)
-{
-	SDL_RWops *ops = static_cast<SDL_RWops*>(inst);
-
-	SDL_RWclose(ops);
-	SDL_FreeRW(ops);
-}
+#include <string.h>
+#include <ctype.h>
+#include <set>
+#include <string>
 
-DEF_TYPE_CUSTOMFREE(FileInt, fileIntFreeInstance);
+#include <SDL_timer.h>
 
+/* Reads the whole file into a binary string */
 static VALUE
-fileIntForPath(const char *path, bool rubyExc)
+dataForPath(const char *path, bool rubyExc)
 {
-	SDL_RWops *ops = SDL_AllocRW();
+	SDL_RWops ops;
 
 	try
 	{
-		shState->fileSystem().openReadRaw(*ops, path);
+		shState->fileSystem().openReadRaw(ops, path);
 	}
 	catch (const Exception &e)
 	{
-		SDL_FreeRW(ops);
-
 		if (rubyExc)
 			raiseRbExc(e);
 		else
 			throw e;
 	}
 
-	VALUE klass = rb_const_get(rb_cObject, rb_intern("FileInt"));
+	Sint64 size = SDL_RWsize(&ops);
 
-	VALUE obj = rb_obj_alloc(klass);
+	if (size < 0)
+		size = 0;
 
-	setPrivateData(obj, ops);
+	VALUE data = rb_str_new(0, size);
+	size_t read = SDL_RWread(&ops, RSTRING_PTR(data), 1, size);
+	SDL_RWclose(&ops);
 
-	return obj;
+	rb_str_set_len(data, read);
+
+	return data;
 }
 
-RB_METHOD(fileIntRead)
+/* Memoizes 'load_data()' results of the files allowed by the
+ * 'loadDataCache' config entries. Cached graphs are deep frozen
+ * and shared, or (with 'loadDataCacheCopy') kept as raw data
+ * that every hit unmarshals into a fresh copy */
+static struct
 {
+	bool init;
+
+	/* Normalized (lower case, forward slashes) paths */
+	std::set<std::string> allowed;
+	bool copy;
 
-	int length = -1;
-	rb_get_args(argc, argv, "i", &length RB_ARG_END);
+	/* Path => [entry identity, object or raw data] */
+	VALUE entries;
 
-	SDL_RWops *ops = getPrivateData<SDL_RWops>(self);
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t stale;
+} loadDataCache;
+
+static std::string
+normalizePath(const std::string &path)
+{
+	std::string result(path);
 
-	if (length == -1)
+	for (size_t i = 0; i < result.size(); ++i)
 	{
-		Sint64 cur = SDL_RWtell(ops);
-		Sint64 end = SDL_RWseek(ops, 0, SEEK_END);
-		length = end - cur;
-		SDL_RWseek(ops, cur, SEEK_SET);
+		if (result[i] == '\\')
+			result[i] = '/';
+		else
+			result[i] = tolower(result[i]);
 	}
 
-	if (length == 0)
-		return Qnil;
+	return result;
+}
 
-	VALUE data = rb_str_new(0, length);
+static void
+loadDataCacheInit()
+{
+	const Config &conf = shState->config();
 
-	SDL_RWread(ops, RSTRING_PTR(data), 1, length);
+	std::set<std::string>::const_iterator iter;
+	for (iter = conf.loadDataCache.begin(); iter != conf.loadDataCache.end(); ++iter)
+		loadDataCache.allowed.insert(normalizePath(*iter));
 
-	return data;
+	loadDataCache.copy = conf.loadDataCacheCopy;
+	loadDataCache.entries = rb_hash_new();
+	rb_gc_register_address(&loadDataCache.entries);
+
+	loadDataCache.init = true;
 }
 
-RB_METHOD(fileIntClose)
+static void
+deepFreeze(VALUE obj)
 {
-	RB_UNUSED_PARAM;
+	if (SPECIAL_CONST_P(obj) || OBJ_FROZEN(obj))
+		return;
 
-	SDL_RWops *ops = getPrivateData<SDL_RWops>(self);
-	SDL_RWclose(ops);
+	/* Classes may be referenced, but aren't part of the data */
+	if (RB_TYPE_P(obj, RUBY_T_CLASS) || RB_TYPE_P(obj, RUBY_T_MODULE)
+	||  RB_TYPE_P(obj, RUBY_T_SYMBOL))
+		return;
 
-	return Qnil;
+	/* Freezing first also stops cycles */
+	rb_obj_freeze(obj);
+
+	if (RB_TYPE_P(obj, RUBY_T_ARRAY))
+	{
+		for (long i = 0; i < RARRAY_LEN(obj); ++i)
+			deepFreeze(rb_ary_entry(obj, i));
+	}
+	else if (RB_TYPE_P(obj, RUBY_T_HASH))
+	{
+		deepFreeze(rb_funcall2(obj, rb_intern("keys"), 0, 0));
+		deepFreeze(rb_funcall2(obj, rb_intern("values"), 0, 0));
+	}
+
+	VALUE ivars = rb_obj_instance_variables(obj);
+
+	for (long i = 0; i < RARRAY_LEN(ivars); ++i)
+		deepFreeze(rb_ivar_get(obj, SYM2ID(rb_ary_entry(ivars, i))));
 }
 
-RB_METHOD(fileIntGetByte)
+static VALUE
+loadDataUncached(const char *filename, bool rubyExc)
 {
-	RB_UNUSED_PARAM;
+	/* Unmarshal straight from memory instead of going
+	 * through an IO port one 'getbyte' at a time */
+	VALUE data = dataForPath(filename, rubyExc);
+
+	return marshalLoadNative(data);
+}
+
+VALUE
+kernelLoadDataInt(const char *filename, bool rubyExc)
+{
+	if (!loadDataCache.init)
+		loadDataCacheInit();
+
+	std::string path = normalizePath(filename);
+
+	if (loadDataCache.allowed.count(path) == 0)
+		return loadDataUncached(filename, rubyExc);
+
+	std::string identity = shState->fileSystem().entryIdentity(filename);
+
+	/* Let the regular path deal with missing files */
+	if (identity.empty())
+		return loadDataUncached(filename, rubyExc);
 
-	SDL_RWops *ops = getPrivateData<SDL_RWops>(self);
+	VALUE key = rb_str_new(path.c_str(), path.size());
+	VALUE entry = rb_hash_lookup(loadDataCache.entries, key);
 
-	unsigned char byte;
-	size_t result = SDL_RWread(ops, &byte, 1, 1);
+	if (!NIL_P(entry))
+	{
+		VALUE cachedId = rb_ary_entry(entry, 0);
+
+		if (identity.size() == (size_t) RSTRING_LEN(cachedId)
+		&&  !memcmp(identity.c_str(), RSTRING_PTR(cachedId), identity.size()))
+		{
+			++loadDataCache.hits;
+			VALUE cached = rb_ary_entry(entry, 1);
 
-	return (result == 1) ? rb_fix_new(byte) : Qnil;
+			return loadDataCache.copy ? marshalLoadNative(cached) : cached;
+		}
+
+		/* File was changed or is shadowed by another one */
+		++loadDataCache.stale;
+	}
+	else
+	{
+		++loadDataCache.misses;
+	}
+
+	VALUE data = dataForPath(filename, rubyExc);
+	VALUE obj = marshalLoadNative(data);
+
+	if (!loadDataCache.copy)
+		deepFreeze(obj);
+
+	entry = rb_ary_new3(2, rb_str_new(identity.c_str(), identity.size()),
+	                    loadDataCache.copy ? data : obj);
+	rb_hash_aset(loadDataCache.entries, key, entry);
+
+	return obj;
 }
 
-RB_METHOD(fileIntBinmode)
+RB_METHOD(mkxpLoadDataStats)
 {
 	RB_UNUSED_PARAM;
 
-	return Qnil;
+	VALUE hash = rb_hash_new();
+
+	HASH_SET_STAT(hash, loadDataCache, hits);
+	HASH_SET_STAT(hash, loadDataCache, misses);
+	HASH_SET_STAT(hash, loadDataCache, stale);
+
+	long entries = loadDataCache.init ? RHASH_SIZE(loadDataCache.entries) : 0;
+	hashSet(hash, "entries", LONG2NUM(entries));
+
+	return hash;
 }
 
-VALUE
-kernelLoadDataInt(const char *filename, bool rubyExc)
+static double
+msSince(uint64_t start)
+{
+	return (SDL_GetPerformanceCounter() - start) * 1000.0
+	     / SDL_GetPerformanceFrequency();
+}
+
+/* Loads 'filename' (from memory, so disk access doesn't skew
+ * the results) 'count' times each with the native reader and
+ * with Marshal.load, returning the average times in ms */
+RB_METHOD(mkxpLoadDataBenchmark)
 {
-	rb_gc_start();
+	RB_UNUSED_PARAM;
+
+	const char *filename;
+	int count = 10;
 
-	VALUE port = fileIntForPath(filename, rubyExc);
+	rb_get_args(argc, argv, "z|i", &filename, &count RB_ARG_END);
 
+	if (count < 1)
+		count = 1;
+
+	VALUE data = dataForPath(filename, true);
 	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
 
-	// FIXME need to catch exceptions here with begin rescue
-	VALUE result = rb_funcall2(marsh, rb_intern("load"), 1, &port);
+	uint64_t start = SDL_GetPerformanceCounter();
 
-	rb_funcall2(port, rb_intern("close"), 0, NULL);
+	for (int i = 0; i < count; ++i)
+		marshalLoadNative(data);
 
-	return result;
+	double native = msSince(start) / count;
+
+	start = SDL_GetPerformanceCounter();
+
+	for (int i = 0; i < count; ++i)
+		rb_funcall2(marsh, rb_intern("load"), 1, &data);
+
+	double ruby = msSince(start) / count;
+
+	VALUE hash = rb_hash_new();
+	hashSet(hash, "bytes", LONG2NUM(RSTRING_LEN(data)));
+	hashSet(hash, "native", rb_float_new(native));
+	hashSet(hash, "ruby", rb_float_new(ruby));
+
+	return hash;
 }
 
 RB_METHOD(kernelLoadData)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("load_data");
+
 	const char *filename;
 	rb_get_args(argc, argv, "z", &filename RB_ARG_END);
 
-	return kernelLoadDataInt(filename, true);
+	VALUE obj = kernelLoadDataInt(filename, true);
+
+	PROFILER_LEAVE();
+
+	return obj;
 }
 
 RB_METHOD(kernelSaveData)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("save_data");
+
 	VALUE obj;
 	VALUE filename;
 
 	rb_get_args(argc, argv, "oS", &obj, &filename RB_ARG_END);
 
-	VALUE file = rb_file_open_str(filename, "wb");
-
+	/* Serialize on this thread, but leave the (possibly slow)
+	 * disk I/O to the file system's writer thread */
 	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
+	VALUE dump = rb_funcall2(marsh, rb_intern("dump"), 1, &obj);
 
-	VALUE v[] = { obj, file };
-	rb_funcall2(marsh, rb_intern("dump"), ARRAY_SIZE(v), v);
+	std::string data(RSTRING_PTR(dump), RSTRING_LEN(dump));
 
-	rb_io_close(file);
+	try
+	{
+		shState->fileSystem().writeAsync(StringValueCStr(filename), data);
+	}
+	catch (const Exception &e)
+	{
+		raiseRbExc(e);
+	}
+
+	PROFILER_LEAVE();
 
 	return Qnil;
 }
@@ -206,17 +364,74 @@ RB_METHOD(_marshalLoad)
 	return rb_funcall2(marsh, rb_intern("_mkxp_load_alias"), ARRAY_SIZE(v), v);
 }
 
-void
-fileIntBindingInit()
+/* 'save_data()' writes in the background. Scripts (like the stock
+ * save and load scenes) also look for and read save files through
+ * plain File / FileTest calls, which have to wait for queued writes
+ * so they never see the previous version of a file. The originals
+ * are aliased, like 'Marshal.load()' below */
+#define DEF_SYNCED_FILE_FUN(Func, name) \
+	RB_METHOD(Func) \
+	{ \
+		shState->fileSystem().syncWrites(); \
+		return rb_funcall2(self, rb_intern("_mkxp_sync_" name), argc, argv); \
+	}
+
+DEF_SYNCED_FILE_FUN(fileSyncedInitialize, "initialize")
+DEF_SYNCED_FILE_FUN(fileSyncedExist, "exist?")
+DEF_SYNCED_FILE_FUN(fileSyncedExists, "exists?")
+DEF_SYNCED_FILE_FUN(fileSyncedFile, "file?")
+DEF_SYNCED_FILE_FUN(fileSyncedSize, "size")
+DEF_SYNCED_FILE_FUN(fileSyncedSizeP, "size?")
+DEF_SYNCED_FILE_FUN(fileSyncedMtime, "mtime")
+DEF_SYNCED_FILE_FUN(fileSyncedDelete, "delete")
+DEF_SYNCED_FILE_FUN(fileSyncedUnlink, "unlink")
+DEF_SYNCED_FILE_FUN(fileSyncedRead, "read")
+DEF_SYNCED_FILE_FUN(fileSyncedBinread, "binread")
+
+static void
+syncFileMethod(VALUE klass, const char *name, RubyMethod func)
+{
+	/* Not all of them exist in every Ruby version */
+	if (!rb_method_boundp(klass, rb_intern(name), 0))
+		return;
+
+	std::string alias = std::string("_mkxp_sync_") + name;
+	rb_define_alias(klass, alias.c_str(), name);
+	_rb_define_method(klass, name, func);
+}
+
+static void
+syncFileMethods()
 {
-	VALUE klass = rb_define_class("FileInt", rb_cIO);
-	rb_define_alloc_func(klass, classAllocate<&FileIntType>);
+	/* Covers File.open and File.new */
+	VALUE file = rb_cFile;
+	rb_define_alias(file, "_mkxp_sync_initialize", "initialize");
+	rb_define_private_method(file, "initialize", RUBY_METHOD_FUNC(fileSyncedInitialize), -1);
 
-	_rb_define_method(klass, "read", fileIntRead);
-	_rb_define_method(klass, "getbyte", fileIntGetByte);
-	_rb_define_method(klass, "binmode", fileIntBinmode);
-	_rb_define_method(klass, "close", fileIntClose);
+	VALUE fileS = rb_singleton_class(rb_cFile);
+	VALUE testS = rb_singleton_class(rb_mFileTest);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		VALUE klass = i == 0 ? fileS : testS;
 
+		syncFileMethod(klass, "exist?", fileSyncedExist);
+		syncFileMethod(klass, "exists?", fileSyncedExists);
+		syncFileMethod(klass, "file?", fileSyncedFile);
+		syncFileMethod(klass, "size", fileSyncedSize);
+		syncFileMethod(klass, "size?", fileSyncedSizeP);
+	}
+
+	syncFileMethod(fileS, "mtime", fileSyncedMtime);
+	syncFileMethod(fileS, "delete", fileSyncedDelete);
+	syncFileMethod(fileS, "unlink", fileSyncedUnlink);
+	syncFileMethod(fileS, "read", fileSyncedRead);
+	syncFileMethod(fileS, "binread", fileSyncedBinread);
+}
+
+void
+fileIntBindingInit()
+{
 	_rb_define_module_function(rb_mKernel, "load_data", kernelLoadData);
 	_rb_define_module_function(rb_mKernel, "save_data", kernelSaveData);
 
@@ -226,4 +441,10 @@ fileIntBindingInit()
 	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
 	rb_define_alias(rb_singleton_class(marsh), "_mkxp_load_alias", "load");
 	_rb_define_module_function(marsh, "load", _marshalLoad);
+
+	syncFileMethods();
+
+	VALUE mod = rb_define_module("MKXP");
+	_rb_define_module_function(mod, "load_data_stats", mkxpLoadDataStats);
+	_rb_define_module_function(mod, "load_data_benchmark", mkxpLoadDataBenchmark);
 }
@@ -0,0 +1,270 @@
+/*
+** frame-gc.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frame-gc.h"
+
+#include "sdl-util.h"
+#include "debugwriter.h"
+
+#include <ruby.h>
+#include <ruby/version.h>
+#include <ruby/debug.h>
+
+#include <string.h>
+#include <algorithm>
+
+#include <SDL_timer.h>
+
+/* Needs the GC.stat keys introduced with Ruby 2.2, and
+ * 'rb_postponed_job_register_one()' working from outside
+ * of Ruby threads (which it doesn't from Ruby 3.0 on) */
+#if RUBY_API_VERSION_MAJOR == 2 && RUBY_API_VERSION_MINOR >= 2
+#define HAVE_FRAME_GC
+#endif
+
+/* Milliseconds without a frame after which
+ * automatic GC is enabled again */
+#define WATCHDOG_TIMEOUT 250
+
+/* Collect ahead of time (if there's enough idle time left)
+ * once less than this share of heap slots is free ... */
+#define FREE_SLOTS_SOON 0.3
+
+/* ... and regardless of idle time below this share */
+#define FREE_SLOTS_URGENT 0.1
+
+#ifdef HAVE_FRAME_GC
+
+struct FrameGC
+{
+	bool active;
+	FrameGCStats stats;
+
+	/* Estimated duration of the next collection (us) */
+	uint32_t minorEstimate;
+	uint32_t majorEstimate;
+
+	/* Set while automatic GC is disabled by us */
+	SDL_atomic_t gcDisabled;
+
+	/* SDL ticks at the last frame boundary */
+	SDL_atomic_t lastIdle;
+
+	size_t baseCount;
+	VALUE minorOpts;
+
+	struct
+	{
+		VALUE availableSlots;
+		VALUE freeSlots;
+		VALUE mallocIncrease;
+		VALUE mallocLimit;
+		VALUE oldObjects;
+		VALUE oldObjectsLimit;
+	} keys;
+
+	SDL_Thread *watchdog;
+	SDL_sem *watchdogSem;
+	AtomicFlag termReq;
+
+	void watchdogFun()
+	{
+		while (true)
+		{
+			SDL_SemWaitTimeout(watchdogSem, WATCHDOG_TIMEOUT / 2);
+
+			if (termReq)
+				return;
+
+			uint32_t since = SDL_GetTicks() - SDL_AtomicGet(&lastIdle);
+
+			if (SDL_AtomicGet(&gcDisabled) && since > WATCHDOG_TIMEOUT)
+				rb_postponed_job_register_one(0, enableJob, this);
+		}
+	}
+
+	/* Runs on the RGSS thread */
+	static void enableJob(void *data)
+	{
+		FrameGC *g = static_cast<FrameGC*>(data);
+
+		/* Might have arrived late, after a new frame */
+		uint32_t since = SDL_GetTicks() - SDL_AtomicGet(&g->lastIdle);
+
+		if (!g->active || since <= WATCHDOG_TIMEOUT)
+			return;
+
+		if (!SDL_AtomicGet(&g->gcDisabled))
+			return;
+
+		rb_gc_enable();
+		SDL_AtomicSet(&g->gcDisabled, 0);
+		++g->stats.fallbacks;
+	}
+
+	void collect(bool major)
+	{
+		uint64_t start = SDL_GetPerformanceCounter();
+
+		rb_gc_enable();
+
+		if (major)
+			rb_gc_start();
+		else
+			rb_funcall2(rb_mGC, rb_intern("start"), 1, &minorOpts);
+
+		rb_gc_disable();
+
+		uint64_t ticks = SDL_GetPerformanceCounter() - start;
+		uint32_t us = ticks * 1000000 / SDL_GetPerformanceFrequency();
+
+		uint32_t &estimate = major ? majorEstimate : minorEstimate;
+		estimate = (estimate * 3 + us) / 4;
+
+		++(major ? stats.major : stats.minor);
+		stats.totalUs += us;
+		stats.lastUs = us;
+		stats.maxUs = std::max(stats.maxUs, us);
+	}
+};
+
+static FrameGC frameGC;
+
+void frameGCStart()
+{
+	FrameGC &g = frameGC;
+
+	if (g.active)
+		return;
+
+	memset(&g.stats, 0, sizeof(g.stats));
+	g.minorEstimate = 1000;
+	g.majorEstimate = 10000;
+
+	g.keys.availableSlots  = ID2SYM(rb_intern("heap_available_slots"));
+	g.keys.freeSlots       = ID2SYM(rb_intern("heap_free_slots"));
+	g.keys.mallocIncrease  = ID2SYM(rb_intern("malloc_increase_bytes"));
+	g.keys.mallocLimit     = ID2SYM(rb_intern("malloc_increase_bytes_limit"));
+	g.keys.oldObjects      = ID2SYM(rb_intern("old_objects"));
+	g.keys.oldObjectsLimit = ID2SYM(rb_intern("old_objects_limit"));
+
+	g.minorOpts = rb_hash_new();
+	rb_hash_aset(g.minorOpts, ID2SYM(rb_intern("full_mark")), Qfalse);
+	rb_hash_aset(g.minorOpts, ID2SYM(rb_intern("immediate_sweep")), Qtrue);
+	rb_gc_register_address(&g.minorOpts);
+
+	g.baseCount = rb_gc_count();
+
+	SDL_AtomicSet(&g.lastIdle, SDL_GetTicks());
+	rb_gc_disable();
+	SDL_AtomicSet(&g.gcDisabled, 1);
+
+	g.termReq.clear();
+	g.watchdogSem = SDL_CreateSemaphore(0);
+	g.watchdog = createSDLThread
+		<FrameGC, &FrameGC::watchdogFun>(&g, "gc_watchdog");
+
+	g.active = true;
+}
+
+void frameGCStop()
+{
+	FrameGC &g = frameGC;
+
+	if (!g.active)
+		return;
+
+	g.active = false;
+
+	g.termReq.set();
+	SDL_SemPost(g.watchdogSem);
+	SDL_WaitThread(g.watchdog, 0);
+	SDL_DestroySemaphore(g.watchdogSem);
+
+	rb_gc_enable();
+	SDL_AtomicSet(&g.gcDisabled, 0);
+
+	rb_gc_unregister_address(&g.minorOpts);
+}
+
+void frameGCIdle(int64_t idleUs)
+{
+	FrameGC &g = frameGC;
+
+	if (!g.active)
+		return;
+
+	SDL_AtomicSet(&g.lastIdle, SDL_GetTicks());
+
+	/* Make sure the stats below are taken with GC disabled */
+	if (!SDL_AtomicGet(&g.gcDisabled))
+	{
+		rb_gc_disable();
+		SDL_AtomicSet(&g.gcDisabled, 1);
+	}
+
+	size_t available = rb_gc_stat(g.keys.availableSlots);
+	size_t freeSlots = rb_gc_stat(g.keys.freeSlots);
+
+	bool major = rb_gc_stat(g.keys.oldObjects) > rb_gc_stat(g.keys.oldObjectsLimit);
+	bool mallocDue = rb_gc_stat(g.keys.mallocIncrease) > rb_gc_stat(g.keys.mallocLimit);
+
+	bool urgent = major || mallocDue || freeSlots < available * FREE_SLOTS_URGENT;
+	bool soon = freeSlots < available * FREE_SLOTS_SOON;
+
+	uint32_t estimate = major ? g.majorEstimate : g.minorEstimate;
+
+	if (urgent || (soon && idleUs >= estimate))
+		g.collect(major);
+}
+
+void frameGCGetStats(FrameGCStats &out)
+{
+	FrameGC &g = frameGC;
+
+	out = g.stats;
+
+	if (g.active)
+	{
+		size_t scheduled = g.stats.minor + g.stats.major;
+		out.unscheduled = rb_gc_count() - g.baseCount - scheduled;
+	}
+}
+
+#else
+
+void frameGCStart()
+{
+	Debug() << "frameGC requires Ruby 2.2 - 2.7, ignoring";
+}
+
+void frameGCStop()
+{}
+
+void frameGCIdle(int64_t)
+{}
+
+void frameGCGetStats(FrameGCStats &out)
+{
+	memset(&out, 0, sizeof(out));
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+** frame-gc.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEGC_H
+#define FRAMEGC_H
+
+#include <stdint.h>
+
+/* Moves Ruby's garbage collection to frame boundaries:
+ * automatic GC is disabled while scripts run, and
+ * collections happen in the frame limiter's idle time
+ * instead (or right at the frame boundary, if the heap
+ * can't wait any longer). If scripts go without a frame
+ * for too long (eg. while loading), automatic GC is
+ * enabled again until the next frame */
+void frameGCStart();
+void frameGCStop();
+
+/* Called at the end of every frame, 'idleUs' being the
+ * time left until the next one is due */
+void frameGCIdle(int64_t idleUs);
+
+struct FrameGCStats
+{
+	/* Collections run at frame boundaries */
+	uint32_t minor;
+	uint32_t major;
+
+	/* Collections that happened anyway, because automatic
+	 * GC was enabled or Ruby code called 'GC.start' */
+	uint32_t unscheduled;
+
+	/* Times automatic GC had to be enabled again
+	 * due to a lack of frames */
+	uint32_t fallbacks;
+
+	/* Microseconds spent in frame boundary collections */
+	uint64_t totalUs;
+	uint32_t lastUs;
+	uint32_t maxUs;
+};
+
+void frameGCGetStats(FrameGCStats &out);
+
+#endif // FRAMEGC_H
@@ -24,13 +24,18 @@
 #include "binding-util.h"
 #include "binding-types.h"
 #include "exception.h"
+#include "script-profiler.h"
 
 RB_METHOD(graphicsUpdate)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.update");
+
 	shState->graphics().update();
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -38,8 +43,12 @@ RB_METHOD(graphicsFreeze)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.freeze");
+
 	shState->graphics().freeze();
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -47,6 +56,8 @@ RB_METHOD(graphicsTransition)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.transition");
+
 	int duration = 8;
 	const char *filename = "";
 	int vague = 40;
@@ -55,6 +66,8 @@ RB_METHOD(graphicsTransition)
 
 	GUARD_EXC( shState->graphics().transition(duration, filename, vague); )
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -115,11 +128,15 @@ RB_METHOD(graphicsWait)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.wait");
+
 	int duration;
 	rb_get_args(argc, argv, "i", &duration RB_ARG_END);
 
 	shState->graphics().wait(duration);
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -127,11 +144,15 @@ RB_METHOD(graphicsFadeout)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.fadeout");
+
 	int duration;
 	rb_get_args(argc, argv, "i", &duration RB_ARG_END);
 
 	shState->graphics().fadeout(duration);
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -139,11 +160,15 @@ RB_METHOD(graphicsFadein)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.fadein");
+
 	int duration;
 	rb_get_args(argc, argv, "i", &duration RB_ARG_END);
 
 	shState->graphics().fadein(duration);
 
+	PROFILER_LEAVE();
+
 	return Qnil;
 }
 
@@ -153,12 +178,16 @@ RB_METHOD(graphicsSnapToBitmap)
 {
 	RB_UNUSED_PARAM;
 
+	PROFILER_ENTER("Graphics.snap_to_bitmap");
+
 	Bitmap *result = 0;
 	GUARD_EXC( result = shState->graphics().snapToBitmap(); );
 
 	VALUE obj = wrapObject(result, BitmapType);
 	bitmapInitProps(result, obj);
 
+	PROFILER_LEAVE();
+
 	return obj;
 }
 
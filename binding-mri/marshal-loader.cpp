@@ -0,0 +1,569 @@
+/*
+** marshal-loader.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "marshal-loader.h"
+
+#include "binding-util.h"
+#include "binding-types.h"
+#include "table.h"
+#include "etc.h"
+
+#include "ruby/encoding.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MARSHAL_MAJOR 4
+#define MARSHAL_MINOR 8
+
+#define TYPE_NIL '0'
+#define TYPE_TRUE 'T'
+#define TYPE_FALSE 'F'
+#define TYPE_FIXNUM 'i'
+
+#define TYPE_OBJECT 'o'
+#define TYPE_USERDEF 'u'
+#define TYPE_USRMARSHAL 'U'
+#define TYPE_FLOAT 'f'
+#define TYPE_STRING '"'
+#define TYPE_ARRAY '['
+#define TYPE_HASH '{'
+#define TYPE_HASH_DEF '}'
+#define TYPE_CLASS 'c'
+#define TYPE_MODULE 'm'
+#define TYPE_IVAR 'I'
+#define TYPE_LINK '@'
+
+#define TYPE_SYMBOL ':'
+#define TYPE_SYMLINK ';'
+
+/* Returned up the call chain when hitting something
+ * that has to be left to Ruby's own implementation */
+#define UNSUPPORTED Qundef
+
+/* All state lives in Ruby objects (or on the stack), so nothing
+ * leaks when a Ruby exception unwinds through the reader */
+struct MarshalReader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+
+	/* Objects / symbols in order of appearance, for links */
+	VALUE objects;
+	VALUE symbols;
+
+	/* Classes whose instances are deserialized directly */
+	VALUE tableKlass;
+	VALUE colorKlass;
+	VALUE toneKlass;
+	VALUE rectKlass;
+};
+
+static VALUE readValue(MarshalReader &r);
+
+static void
+tooShort()
+{
+	rb_raise(rb_eArgError, "marshal data too short");
+}
+
+static uint8_t
+readByte(MarshalReader &r)
+{
+	if (r.p >= r.end)
+		tooShort();
+
+	return *r.p++;
+}
+
+static long
+readLong(MarshalReader &r)
+{
+	int8_t c = readByte(r);
+
+	if (c == 0)
+		return 0;
+
+	long x;
+
+	if (c > 0)
+	{
+		if (c > 4)
+			return c - 5;
+
+		x = 0;
+
+		for (int i = 0; i < c; ++i)
+			x |= (long) readByte(r) << (8*i);
+	}
+	else
+	{
+		if (c < -4)
+			return c + 5;
+
+		x = -1;
+
+		for (int i = 0; i < -c; ++i)
+		{
+			x &= ~((long) 0xFF << (8*i));
+			x |= (long) readByte(r) << (8*i);
+		}
+	}
+
+	return x;
+}
+
+/* Returns a pointer to 'len' bytes of raw data */
+static const char *
+readBytes(MarshalReader &r, long &len)
+{
+	len = readLong(r);
+
+	if (len < 0 || r.end - r.p < len)
+		tooShort();
+
+	const char *data = reinterpret_cast<const char*>(r.p);
+	r.p += len;
+
+	return data;
+}
+
+static VALUE
+addObject(MarshalReader &r, VALUE obj)
+{
+	rb_ary_push(r.objects, obj);
+
+	return obj;
+}
+
+static VALUE
+readSymbolData(MarshalReader &r)
+{
+	long len;
+	const char *name = readBytes(r, len);
+
+	VALUE sym = ID2SYM(rb_intern2(name, len));
+	rb_ary_push(r.symbols, sym);
+
+	return sym;
+}
+
+/* Symbols in key/class name position. Like all readers,
+ * returns UNSUPPORTED if the rest has to be left to Ruby */
+static VALUE
+readSymbol(MarshalReader &r)
+{
+	uint8_t type = readByte(r);
+
+	switch (type)
+	{
+	case TYPE_SYMBOL :
+		return readSymbolData(r);
+
+	case TYPE_SYMLINK :
+	{
+		long idx = readLong(r);
+
+		if (idx < 0 || idx >= RARRAY_LEN(r.symbols))
+			rb_raise(rb_eArgError, "bad symbol");
+
+		return rb_ary_entry(r.symbols, idx);
+	}
+
+	case TYPE_IVAR :
+	{
+		/* Symbol with encoding; we only ever intern ASCII names */
+		VALUE sym = readSymbol(r);
+
+		if (sym == UNSUPPORTED)
+			return UNSUPPORTED;
+
+		for (long n = readLong(r); n > 0; --n)
+		{
+			if (readSymbol(r) == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			if (readValue(r) == UNSUPPORTED)
+				return UNSUPPORTED;
+		}
+
+		return sym;
+	}
+
+	default :
+		rb_raise(rb_eArgError, "dump format error for symbol(0x%x)", type);
+	}
+
+	return Qnil;
+}
+
+static VALUE
+readClass(MarshalReader &r)
+{
+	VALUE sym = readSymbol(r);
+
+	if (sym == UNSUPPORTED)
+		return UNSUPPORTED;
+
+	return rb_path2class(rb_id2name(SYM2ID(sym)));
+}
+
+/* Applies the instance variables following an object of
+ * type 'I'; string encodings are handled specially */
+static bool
+readIvars(MarshalReader &r, VALUE obj)
+{
+	static ID encodingID = rb_intern("encoding");
+	static ID shortEncodingID = rb_intern("E");
+
+	bool isString = RB_TYPE_P(obj, RUBY_T_STRING);
+
+	for (long n = readLong(r); n > 0; --n)
+	{
+		VALUE sym = readSymbol(r);
+
+		if (sym == UNSUPPORTED)
+			return false;
+
+		VALUE value = readValue(r);
+
+		if (value == UNSUPPORTED)
+			return false;
+
+		ID id = SYM2ID(sym);
+
+		if (isString && id == shortEncodingID)
+		{
+			if (!RTEST(value))
+				rb_enc_associate_index(obj, rb_usascii_encindex());
+		}
+		else if (isString && id == encodingID)
+		{
+			int idx = rb_enc_find_index(StringValueCStr(value));
+
+			if (idx >= 0)
+				rb_enc_associate_index(obj, idx);
+		}
+		else if (!SYMBOL_P(obj) && !SPECIAL_CONST_P(obj))
+		{
+			rb_ivar_set(obj, id, value);
+		}
+	}
+
+	return true;
+}
+
+template<class C>
+static VALUE
+deserializeNative(VALUE klass, const char *data, long len)
+{
+	VALUE obj = rb_obj_alloc(klass);
+
+	C *c = 0;
+
+	GUARD_EXC( c = C::deserialize(data, len); );
+
+	setPrivateData(obj, c);
+
+	return obj;
+}
+
+static VALUE
+readUserDef(MarshalReader &r, bool hasIvars)
+{
+	VALUE klass = readClass(r);
+
+	if (klass == UNSUPPORTED)
+		return UNSUPPORTED;
+
+	long len;
+	const char *data = readBytes(r, len);
+
+	if (!hasIvars)
+	{
+		/* Skip '_load' dispatch for our own types */
+		if (klass == r.tableKlass)
+			return addObject(r, deserializeNative<Table>(klass, data, len));
+		if (klass == r.colorKlass)
+			return addObject(r, deserializeNative<Color>(klass, data, len));
+		if (klass == r.toneKlass)
+			return addObject(r, deserializeNative<Tone>(klass, data, len));
+		if (klass == r.rectKlass)
+			return addObject(r, deserializeNative<Rect>(klass, data, len));
+	}
+
+	VALUE str = rb_str_new(data, len);
+
+	/* The ivars (if any) belong to the data string */
+	if (hasIvars && !readIvars(r, str))
+		return UNSUPPORTED;
+
+	return addObject(r, rb_funcall(klass, rb_intern("_load"), 1, str));
+}
+
+static VALUE
+readString(MarshalReader &r, bool hasIvars)
+{
+	long len;
+	const char *data = readBytes(r, len);
+
+	/* Binary strings are turned into UTF-8 ones, like
+	 * our 'Marshal.load' override does; explicitly encoded
+	 * ones get their encoding from the ivars below */
+	VALUE str = addObject(r, rb_enc_str_new(data, len, rb_utf8_encoding()));
+
+	if (hasIvars && !readIvars(r, str))
+		return UNSUPPORTED;
+
+	return str;
+}
+
+static VALUE
+readFloat(MarshalReader &r)
+{
+	long len;
+	const char *data = readBytes(r, len);
+
+	char buf[64];
+	long n = len < (long) sizeof(buf)-1 ? len : (long) sizeof(buf)-1;
+	memcpy(buf, data, n);
+	buf[n] = '\0';
+
+	double value;
+
+	if (!strcmp(buf, "nan"))
+		value = NAN;
+	else if (!strcmp(buf, "inf"))
+		value = HUGE_VAL;
+	else if (!strcmp(buf, "-inf"))
+		value = -HUGE_VAL;
+	else
+		value = strtod(buf, 0);
+
+	return addObject(r, rb_float_new(value));
+}
+
+static VALUE
+readValue(MarshalReader &r)
+{
+	uint8_t type = readByte(r);
+
+	switch (type)
+	{
+	case TYPE_NIL :
+		return Qnil;
+
+	case TYPE_TRUE :
+		return Qtrue;
+
+	case TYPE_FALSE :
+		return Qfalse;
+
+	case TYPE_FIXNUM :
+		return LONG2NUM(readLong(r));
+
+	case TYPE_SYMBOL :
+		return readSymbolData(r);
+
+	case TYPE_SYMLINK :
+		--r.p;
+		return readSymbol(r);
+
+	case TYPE_LINK :
+	{
+		long idx = readLong(r);
+
+		if (idx < 0 || idx >= RARRAY_LEN(r.objects))
+			rb_raise(rb_eArgError, "dump format error (unlinked)");
+
+		return rb_ary_entry(r.objects, idx);
+	}
+
+	case TYPE_IVAR :
+	{
+		uint8_t inner = readByte(r);
+
+		if (inner == TYPE_STRING)
+			return readString(r, true);
+
+		if (inner == TYPE_USERDEF)
+			return readUserDef(r, true);
+
+		--r.p;
+		VALUE obj = readValue(r);
+
+		if (obj == UNSUPPORTED || !readIvars(r, obj))
+			return UNSUPPORTED;
+
+		return obj;
+	}
+
+	case TYPE_STRING :
+		return readString(r, false);
+
+	case TYPE_FLOAT :
+		return readFloat(r);
+
+	case TYPE_ARRAY :
+	{
+		long len = readLong(r);
+		VALUE ary = addObject(r, rb_ary_new2(len));
+
+		for (long i = 0; i < len; ++i)
+		{
+			VALUE value = readValue(r);
+
+			if (value == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			rb_ary_push(ary, value);
+		}
+
+		return ary;
+	}
+
+	case TYPE_HASH :
+	case TYPE_HASH_DEF :
+	{
+		long len = readLong(r);
+		VALUE hash = addObject(r, rb_hash_new());
+
+		for (long i = 0; i < len; ++i)
+		{
+			VALUE key = readValue(r);
+
+			if (key == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			VALUE value = readValue(r);
+
+			if (value == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			rb_hash_aset(hash, key, value);
+		}
+
+		if (type == TYPE_HASH_DEF)
+		{
+			VALUE def = readValue(r);
+
+			if (def == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			rb_funcall(hash, rb_intern("default="), 1, def);
+		}
+
+		return hash;
+	}
+
+	case TYPE_OBJECT :
+	{
+		VALUE klass = readClass(r);
+
+		if (klass == UNSUPPORTED)
+			return UNSUPPORTED;
+
+		VALUE obj = addObject(r, rb_obj_alloc(klass));
+
+		for (long n = readLong(r); n > 0; --n)
+		{
+			VALUE sym = readSymbol(r);
+
+			if (sym == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			VALUE value = readValue(r);
+
+			if (value == UNSUPPORTED)
+				return UNSUPPORTED;
+
+			rb_ivar_set(obj, SYM2ID(sym), value);
+		}
+
+		return obj;
+	}
+
+	case TYPE_USERDEF :
+		return readUserDef(r, false);
+
+	case TYPE_USRMARSHAL :
+	{
+		VALUE klass = readClass(r);
+
+		if (klass == UNSUPPORTED)
+			return UNSUPPORTED;
+
+		VALUE obj = addObject(r, rb_obj_alloc(klass));
+
+		VALUE data = readValue(r);
+
+		if (data == UNSUPPORTED)
+			return UNSUPPORTED;
+
+		rb_funcall(obj, rb_intern("marshal_load"), 1, data);
+
+		return obj;
+	}
+
+	case TYPE_CLASS :
+	case TYPE_MODULE :
+	{
+		long len;
+		const char *name = readBytes(r, len);
+
+		return addObject(r, rb_path_to_class(rb_str_new(name, len)));
+	}
+
+	default :
+		/* Bignums, regexps, structs, extended objects etc. */
+		return UNSUPPORTED;
+	}
+}
+
+VALUE marshalLoadNative(VALUE data)
+{
+	MarshalReader r;
+	r.p = reinterpret_cast<const uint8_t*>(RSTRING_PTR(data));
+	r.end = r.p + RSTRING_LEN(data);
+
+	VALUE result = UNSUPPORTED;
+
+	if (r.end - r.p >= 2 && r.p[0] == MARSHAL_MAJOR && r.p[1] == MARSHAL_MINOR)
+	{
+		r.p += 2;
+		r.objects = rb_ary_new();
+		r.symbols = rb_ary_new();
+		r.tableKlass = rb_const_get(rb_cObject, rb_intern("Table"));
+		r.colorKlass = rb_const_get(rb_cObject, rb_intern("Color"));
+		r.toneKlass = rb_const_get(rb_cObject, rb_intern("Tone"));
+		r.rectKlass = rb_const_get(rb_cObject, rb_intern("Rect"));
+
+		result = readValue(r);
+	}
+
+	if (result != UNSUPPORTED)
+		return result;
+
+	VALUE marsh = rb_const_get(rb_cObject, rb_intern("Marshal"));
+
+	return rb_funcall2(marsh, rb_intern("load"), 1, &data);
+}
@@ -0,0 +1,33 @@
+/*
+** marshal-loader.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MARSHALLOADER_H
+#define MARSHALLOADER_H
+
+#include <ruby.h>
+
+/* Unmarshals the contents of the binary string 'data' natively,
+ * the same way the (UTF-8 enforcing) 'Marshal.load' would.
+ * Types the native loader doesn't handle (regexps, structs, bignums
+ * etc.) make it fall back to 'Marshal.load' for the whole string */
+VALUE marshalLoadNative(VALUE data);
+
+#endif // MARSHALLOADER_H
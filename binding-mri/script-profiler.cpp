@@ -0,0 +1,301 @@
+/*
+** script-profiler.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "script-profiler.h"
+
+#include "sdl-util.h"
+#include "debugwriter.h"
+
+#include <ruby.h>
+#include <ruby/version.h>
+#include <ruby/debug.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <SDL_timer.h>
+
+/* The sampler thread requests stacks through
+ * 'rb_postponed_job_register_one()', which only works
+ * from outside of Ruby threads up until Ruby 2.7 */
+#if RUBY_API_VERSION_MAJOR == 2 && RUBY_API_VERSION_MINOR >= 1
+#define HAVE_SCRIPT_PROFILER
+#endif
+
+/* Deeper stacks are cut off at the root */
+#define MAX_STACK_DEPTH 64
+
+bool scriptProfilerRunning;
+const char *volatile scriptProfilerEntry;
+
+#ifdef HAVE_SCRIPT_PROFILER
+
+struct ScriptProfiler
+{
+	SDL_Thread *thread;
+	AtomicFlag termReq;
+	int intervalMs;
+
+	/* Samples not yet attributed to a stack, taken while
+	 * in Ruby code / inside of 'tickEntry' */
+	SDL_atomic_t scriptTicks;
+	SDL_atomic_t entryTicks;
+	void *tickEntry;
+
+	struct Frame
+	{
+		std::string label;
+		std::string path;
+	};
+
+	/* Frames are kept alive (in 'keepAlive') once seen,
+	 * so their addresses can't be reused by other code */
+	BoostHash<VALUE, Frame> frames;
+	VALUE keepAlive;
+
+	/* Key: (frame, line) pairs, leaf first, followed
+	 * by the entry point if inside of one */
+	std::map<std::vector<uintptr_t>, uint32_t> stacks;
+
+	void samplerFun()
+	{
+		while (!termReq)
+		{
+			SDL_Delay(intervalMs);
+
+			const char *entry = scriptProfilerEntry;
+
+			if (entry)
+			{
+				SDL_AtomicSetPtr(&tickEntry, (void*) entry);
+				SDL_AtomicIncRef(&entryTicks);
+			}
+			else
+			{
+				SDL_AtomicIncRef(&scriptTicks);
+			}
+
+			rb_postponed_job_register_one(0, sampleJob, this);
+		}
+	}
+
+	void addFrame(VALUE frame)
+	{
+		if (frames.contains(frame))
+			return;
+
+		Frame f;
+		VALUE label = rb_profile_frame_full_label(frame);
+		VALUE path = rb_profile_frame_path(frame);
+
+		if (!NIL_P(label))
+			f.label = std::string(RSTRING_PTR(label), RSTRING_LEN(label));
+		if (!NIL_P(path))
+			f.path = std::string(RSTRING_PTR(path), RSTRING_LEN(path));
+
+		frames.insert(frame, f);
+		rb_ary_push(keepAlive, frame);
+	}
+
+	/* Runs on the RGSS thread */
+	static void sampleJob(void *data)
+	{
+		ScriptProfiler *p = static_cast<ScriptProfiler*>(data);
+
+		if (!p->thread)
+			return;
+
+		int script = SDL_AtomicSet(&p->scriptTicks, 0);
+		int entry = SDL_AtomicSet(&p->entryTicks, 0);
+		void *entryName = SDL_AtomicGetPtr(&p->tickEntry);
+
+		if (script == 0 && entry == 0)
+			return;
+
+		VALUE buf[MAX_STACK_DEPTH];
+		int lines[MAX_STACK_DEPTH];
+		int depth = rb_profile_frames(0, MAX_STACK_DEPTH, buf, lines);
+
+		std::vector<uintptr_t> key;
+		key.reserve(depth*2 + 1);
+
+		for (int i = 0; i < depth; ++i)
+		{
+			p->addFrame(buf[i]);
+			key.push_back(buf[i]);
+			key.push_back(lines[i]);
+		}
+
+		if (script > 0)
+			p->stacks[key] += script;
+
+		if (entry > 0)
+		{
+			key.push_back((uintptr_t) entryName);
+			p->stacks[key] += entry;
+		}
+	}
+};
+
+static ScriptProfiler profiler;
+
+/* An exception raised inside of an entry point leaves it without
+ * reaching PROFILER_LEAVE(); whatever runs next is Ruby code */
+static void raiseHook(rb_event_flag_t, VALUE, VALUE, ID, VALUE)
+{
+	scriptProfilerEntry = 0;
+}
+
+/* ';' separates frames, and the sample count
+ * follows the last space of a line */
+static void appendSanitized(std::string &out, const std::string &str)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		char c = str[i];
+
+		if (c == ';' || c == '\n')
+			c = ':';
+
+		out += c;
+	}
+}
+
+static void writeStacks(FILE *f,
+                        const BoostHash<std::string, std::string> &scriptNames)
+{
+	std::map<std::vector<uintptr_t>, uint32_t>::const_iterator iter;
+
+	for (iter = profiler.stacks.begin(); iter != profiler.stacks.end(); ++iter)
+	{
+		const std::vector<uintptr_t> &key = iter->first;
+		size_t frameCount = key.size() / 2;
+		std::string line;
+
+		/* Folded stacks go from the root to the leaf */
+		for (size_t i = frameCount; i-- > 0;)
+		{
+			const ScriptProfiler::Frame &frame =
+				profiler.frames[(VALUE) key[i*2]];
+
+			char lineNo[16];
+			snprintf(lineNo, sizeof(lineNo), ":%d)", (int) key[i*2+1]);
+
+			if (!line.empty())
+				line += ';';
+
+			appendSanitized(line, frame.label);
+			line += " (";
+			appendSanitized(line, scriptNames.value(frame.path, frame.path));
+			line += lineNo;
+		}
+
+		if (key.size() % 2)
+		{
+			if (!line.empty())
+				line += ';';
+
+			line += (const char*) key.back();
+		}
+
+		if (line.empty())
+			line = "(none)";
+
+		fprintf(f, "%s %u\n", line.c_str(), iter->second);
+	}
+}
+
+void scriptProfilerStart(int intervalMs)
+{
+	ScriptProfiler &p = profiler;
+
+	if (p.thread)
+		return;
+
+	p.intervalMs = std::max(intervalMs, 1);
+	p.termReq.clear();
+	SDL_AtomicSet(&p.scriptTicks, 0);
+	SDL_AtomicSet(&p.entryTicks, 0);
+
+	p.keepAlive = rb_ary_new();
+	rb_gc_register_address(&p.keepAlive);
+
+	scriptProfilerEntry = 0;
+	scriptProfilerRunning = true;
+	rb_add_event_hook(raiseHook, RUBY_EVENT_RAISE, Qnil);
+
+	p.thread = createSDLThread
+		<ScriptProfiler, &ScriptProfiler::samplerFun>(&p, "script_profiler");
+}
+
+void scriptProfilerStop(const char *path,
+                        const BoostHash<std::string, std::string> &scriptNames)
+{
+	ScriptProfiler &p = profiler;
+
+	if (!p.thread)
+		return;
+
+	p.termReq.set();
+	SDL_WaitThread(p.thread, 0);
+	p.thread = 0;
+
+	rb_remove_event_hook(raiseHook);
+	scriptProfilerRunning = false;
+	scriptProfilerEntry = 0;
+
+	FILE *f = fopen(path, "w");
+
+	if (f)
+	{
+		writeStacks(f, scriptNames);
+		fclose(f);
+	}
+	else
+	{
+		Debug() << "Failed to write script profile" << path;
+	}
+
+	p.stacks.clear();
+	p.frames = BoostHash<VALUE, ScriptProfiler::Frame>();
+
+	rb_gc_unregister_address(&p.keepAlive);
+	p.keepAlive = Qnil;
+}
+
+#else
+
+bool scriptProfilerRunning;
+const char *volatile scriptProfilerEntry;
+
+void scriptProfilerStart(int)
+{
+	Debug() << "scriptProfile requires Ruby 2.1 - 2.7, ignoring";
+}
+
+void scriptProfilerStop(const char*,
+                        const BoostHash<std::string, std::string>&)
+{}
+
+#endif
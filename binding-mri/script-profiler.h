@@ -0,0 +1,58 @@
+/*
+** script-profiler.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCRIPTPROFILER_H
+#define SCRIPTPROFILER_H
+
+#include "boost-hash.h"
+
+#include <string>
+
+/* Samples the RGSS thread every 'intervalMs' milliseconds.
+ * The Ruby stack is taken on the RGSS thread itself (as a
+ * postponed job), and samples taken while inside a marked
+ * engine entry point get that entry appended as leaf frame */
+void scriptProfilerStart(int intervalMs);
+
+/* Stops sampling and writes the collected stacks to 'path',
+ * one "frame;frame;... count" line per distinct stack (the
+ * folded format read by flamegraph.pl). Script filenames are
+ * replaced by their section names through 'scriptNames' */
+void scriptProfilerStop(const char *path,
+                        const BoostHash<std::string, std::string> &scriptNames);
+
+/* Only written by the RGSS thread. 'scriptProfilerEntry' is
+ * read by the sampler thread, which tolerates a stale value */
+extern bool scriptProfilerRunning;
+extern const char *volatile scriptProfilerEntry;
+
+/* Mark the RGSS thread as being inside of the engine entry point
+ * 'name' (a string literal) while profiling. These are set and
+ * cleared explicitly, as Ruby exceptions longjmp past destructors;
+ * instead, the profiler clears the entry whenever an exception is
+ * raised, so the Ruby code rescuing it isn't charged to the entry */
+#define PROFILER_ENTER(name) \
+	do { if (scriptProfilerRunning) scriptProfilerEntry = (name); } while (0)
+
+#define PROFILER_LEAVE() \
+	do { if (scriptProfilerRunning) scriptProfilerEntry = 0; } while (0)
+
+#endif // SCRIPTPROFILER_H
@@ -51,13 +51,8 @@ DEF_PROP_OBJ_VAL(Sprite, Rect,   SrcRect, "src_rect")
 DEF_PROP_OBJ_VAL(Sprite, Color,  Color,   "color")
 DEF_PROP_OBJ_VAL(Sprite, Tone,   Tone,    "tone")
 
-DEF_PROP_I(Sprite, X)
-DEF_PROP_I(Sprite, Y)
-DEF_PROP_I(Sprite, OX)
-DEF_PROP_I(Sprite, OY)
 DEF_PROP_I(Sprite, BushDepth)
 DEF_PROP_I(Sprite, BushOpacity)
-DEF_PROP_I(Sprite, Opacity)
 DEF_PROP_I(Sprite, BlendType)
 DEF_PROP_I(Sprite, WaveAmp)
 DEF_PROP_I(Sprite, WaveLength)
@@ -108,16 +103,16 @@ spriteBindingInit()
 
 	INIT_PROP_BIND( Sprite, Bitmap,    "bitmap"     );
 	INIT_PROP_BIND( Sprite, SrcRect,   "src_rect"   );
-	INIT_PROP_BIND( Sprite, X,         "x"          );
-	INIT_PROP_BIND( Sprite, Y,         "y"          );
-	INIT_PROP_BIND( Sprite, OX,        "ox"         );
-	INIT_PROP_BIND( Sprite, OY,        "oy"         );
+	INIT_PROP_BIND_FAST( Sprite, int, X,         "x"          );
+	INIT_PROP_BIND_FAST( Sprite, int, Y,         "y"          );
+	INIT_PROP_BIND_FAST( Sprite, int, OX,        "ox"         );
+	INIT_PROP_BIND_FAST( Sprite, int, OY,        "oy"         );
 	INIT_PROP_BIND( Sprite, ZoomX,     "zoom_x"     );
 	INIT_PROP_BIND( Sprite, ZoomY,     "zoom_y"     );
 	INIT_PROP_BIND( Sprite, Angle,     "angle"      );
 	INIT_PROP_BIND( Sprite, Mirror,    "mirror"     );
 	INIT_PROP_BIND( Sprite, BushDepth, "bush_depth" );
-	INIT_PROP_BIND( Sprite, Opacity,   "opacity"    );
+	INIT_PROP_BIND_FAST( Sprite, int, Opacity,   "opacity"    );
 	INIT_PROP_BIND( Sprite, BlendType, "blend_type" );
 	INIT_PROP_BIND( Sprite, Color,     "color"      );
 	INIT_PROP_BIND( Sprite, Tone,      "tone"       );
@@ -0,0 +1,233 @@
+/*
+** stats-binding.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "perfstats.h"
+#include "sharedstate.h"
+#include "graphics.h"
+#include "texpool.h"
+#include "binding-util.h"
+#include "frame-gc.h"
+#include "etc.h"
+
+#include <map>
+#include <string>
+#include <algorithm>
+
+static VALUE
+countersToHash(const PerfCounters &c)
+{
+	VALUE hash = rb_hash_new();
+
+	hashSet(hash, "draw_calls", UINT2NUM(c.drawCalls));
+	hashSet(hash, "texture_binds", UINT2NUM(c.texBinds));
+	hashSet(hash, "shader_switches", UINT2NUM(c.shaderSwitches));
+	hashSet(hash, "bytes_uploaded", ULL2NUM(c.bytesUploaded));
+	hashSet(hash, "etc_allocs", UINT2NUM(c.etcAllocs));
+
+	return hash;
+}
+
+RB_METHOD(statsFrame)
+{
+	RB_UNUSED_PARAM;
+
+	return countersToHash(perfStats.lastFrame);
+}
+
+RB_METHOD(statsTotal)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE hash = countersToHash(perfStats.total);
+
+	hashSet(hash, "frames", UINT2NUM(perfStats.frames));
+	hashSet(hash, "skipped_frames", UINT2NUM(perfStats.skippedFrames));
+	hashSet(hash, "long_frames", UINT2NUM(perfStats.longFrames));
+
+	return hash;
+}
+
+RB_METHOD(statsTimings)
+{
+	RB_UNUSED_PARAM;
+
+	const PerfStats &s = perfStats;
+
+	double frameSum = 0, busySum = 0;
+	uint32_t frameMax = 0, busyMax = 0;
+
+	for (int i = 0; i < s.histCount; ++i)
+	{
+		frameSum += s.frameTime[i];
+		busySum += s.busyTime[i];
+
+		frameMax = std::max(frameMax, s.frameTime[i]);
+		busyMax = std::max(busyMax, s.busyTime[i]);
+	}
+
+	/* Most recent entry */
+	int last = (s.histPos + PERF_FRAME_HISTORY - 1) % PERF_FRAME_HISTORY;
+	int count = std::max(s.histCount, 1);
+
+	VALUE hash = rb_hash_new();
+
+	/* All in milliseconds */
+#define SET_TIME(key, us) \
+	hashSet(hash, key, rb_float_new((us) / 1000.0))
+
+	SET_TIME("frame", s.histCount ? s.frameTime[last] : 0);
+	SET_TIME("frame_avg", frameSum / count);
+	SET_TIME("frame_max", frameMax);
+	SET_TIME("busy", s.histCount ? s.busyTime[last] : 0);
+	SET_TIME("busy_avg", busySum / count);
+	SET_TIME("busy_max", busyMax);
+
+#undef SET_TIME
+
+	return hash;
+}
+
+RB_METHOD(statsTexPool)
+{
+	RB_UNUSED_PARAM;
+
+	TexPool::Stats stats;
+	shState->texPool().getStats(stats);
+
+	VALUE hash = rb_hash_new();
+
+	HASH_SET_STAT(hash, stats, bytes);
+	HASH_SET_STAT(hash, stats, budget);
+	HASH_SET_STAT(hash, stats, textures);
+	HASH_SET_STAT(hash, stats, hits);
+	HASH_SET_STAT(hash, stats, misses);
+
+	return hash;
+}
+
+/* Same as Audio.se_cache_stats */
+RB_METHOD(statsSeCache)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE audio = rb_const_get(rb_cObject, rb_intern("Audio"));
+
+	return rb_funcall2(audio, rb_intern("se_cache_stats"), 0, 0);
+}
+
+RB_METHOD(statsDisposables)
+{
+	RB_UNUSED_PARAM;
+
+	std::map<std::string, int> counts;
+	shState->graphics().getDisposableCounts(counts);
+
+	VALUE hash = rb_hash_new();
+
+	std::map<std::string, int>::const_iterator iter;
+	for (iter = counts.begin(); iter != counts.end(); ++iter)
+		hashSet(hash, iter->first.c_str(), INT2NUM(iter->second));
+
+	return hash;
+}
+
+RB_METHOD(statsGC)
+{
+	RB_UNUSED_PARAM;
+
+	FrameGCStats stats;
+	frameGCGetStats(stats);
+
+	VALUE hash = rb_hash_new();
+
+	hashSet(hash, "minor", UINT2NUM(stats.minor));
+	hashSet(hash, "major", UINT2NUM(stats.major));
+	hashSet(hash, "unscheduled", UINT2NUM(stats.unscheduled));
+	hashSet(hash, "fallbacks", UINT2NUM(stats.fallbacks));
+
+	/* In milliseconds */
+	hashSet(hash, "time", rb_float_new(stats.totalUs / 1000.0));
+	hashSet(hash, "last", rb_float_new(stats.lastUs / 1000.0));
+	hashSet(hash, "max", rb_float_new(stats.maxUs / 1000.0));
+
+	return hash;
+}
+
+RB_METHOD(statsEtcPool)
+{
+	RB_UNUSED_PARAM;
+
+	EtcPoolStats stats;
+	etcPoolGetStats(stats);
+
+	VALUE hash = rb_hash_new();
+
+	hashSet(hash, "live", UINT2NUM(stats.live));
+	hashSet(hash, "capacity", UINT2NUM(stats.capacity));
+	hashSet(hash, "bytes", ULL2NUM(stats.bytes));
+
+	return hash;
+}
+
+RB_METHOD(statsAll)
+{
+	RB_UNUSED_PARAM;
+
+	VALUE hash = rb_hash_new();
+
+	hashSet(hash, "frame", statsFrame(0, 0, self));
+	hashSet(hash, "total", statsTotal(0, 0, self));
+	hashSet(hash, "timings", statsTimings(0, 0, self));
+	hashSet(hash, "tex_pool", statsTexPool(0, 0, self));
+	hashSet(hash, "se_cache", statsSeCache(0, 0, self));
+	hashSet(hash, "disposables", statsDisposables(0, 0, self));
+	hashSet(hash, "gc", statsGC(0, 0, self));
+	hashSet(hash, "etc_pool", statsEtcPool(0, 0, self));
+
+	return hash;
+}
+
+RB_METHOD(statsReset)
+{
+	RB_UNUSED_PARAM;
+
+	perfStats.reset();
+
+	return Qnil;
+}
+
+void
+statsBindingInit()
+{
+	VALUE mkxp = rb_define_module("MKXP");
+	VALUE module = rb_define_module_under(mkxp, "Stats");
+
+	_rb_define_module_function(module, "frame", statsFrame);
+	_rb_define_module_function(module, "total", statsTotal);
+	_rb_define_module_function(module, "timings", statsTimings);
+	_rb_define_module_function(module, "tex_pool", statsTexPool);
+	_rb_define_module_function(module, "se_cache", statsSeCache);
+	_rb_define_module_function(module, "disposables", statsDisposables);
+	_rb_define_module_function(module, "gc", statsGC);
+	_rb_define_module_function(module, "etc_pool", statsEtcPool);
+	_rb_define_module_function(module, "all", statsAll);
+	_rb_define_module_function(module, "reset", statsReset);
+}
@@ -20,6 +20,8 @@
 */
 
 #include <algorithm>
+#include <vector>
+#include <string.h>
 #include "table.h"
 #include "binding-util.h"
 #include "serializable-binding.h"
@@ -54,6 +56,8 @@ DEF_TYPE(Table);
 
 RB_METHOD(tableInitialize)
 {
+	rb_check_frozen(self);
+
 	int x, y, z;
 
 	parseArgsTableSizes(argc, argv, &x, &y, &z);
@@ -67,6 +71,8 @@ RB_METHOD(tableInitialize)
 
 RB_METHOD(tableResize)
 {
+	rb_check_frozen(self);
+
 	Table *t = getPrivateData<Table>(self);
 
 	int x, y, z;
@@ -119,6 +125,8 @@ RB_METHOD(tableGetAt)
 
 RB_METHOD(tableSetAt)
 {
+	rb_check_frozen(self);
+
 	Table *t = getPrivateData<Table>(self);
 
 	int x, y, z, value;
@@ -155,6 +163,142 @@ RB_METHOD(tableSetAt)
 	return argv[argc - 1];
 }
 
+RB_METHOD(tableFill)
+{
+	rb_check_frozen(self);
+
+	Table *t = getPrivateData<Table>(self);
+
+	int value;
+	int x = 0, y = 0, z = 0;
+	int width = t->xSize(), height = t->ySize(), depth = t->zSize();
+
+	switch (argc)
+	{
+	case 1 :
+		rb_get_args(argc, argv, "i", &value RB_ARG_END);
+		break;
+	case 5 :
+		rb_get_args(argc, argv, "iiiii", &value, &x, &y, &width, &height RB_ARG_END);
+		break;
+	case 7 :
+		rb_get_args(argc, argv, "iiiiiii", &value, &x, &y, &z,
+		            &width, &height, &depth RB_ARG_END);
+		break;
+	default :
+		rb_raise(rb_eArgError, "wrong number of arguments (%d for 1, 5 or 7)", argc);
+	}
+
+	t->fill(value, x, y, z, width, height, depth);
+
+	return self;
+}
+
+RB_METHOD(tableCopy)
+{
+	rb_check_frozen(self);
+
+	Table *t = getPrivateData<Table>(self);
+
+	VALUE srcObj;
+	int srcX, srcY, srcZ = 0;
+	int width, height, depth = -1;
+	int dstX, dstY, dstZ = 0;
+
+	switch (argc)
+	{
+	case 7 :
+		rb_get_args(argc, argv, "oiiiiii", &srcObj, &srcX, &srcY,
+		            &width, &height, &dstX, &dstY RB_ARG_END);
+		break;
+	case 10 :
+		rb_get_args(argc, argv, "oiiiiiiiii", &srcObj, &srcX, &srcY, &srcZ,
+		            &width, &height, &depth, &dstX, &dstY, &dstZ RB_ARG_END);
+		break;
+	default :
+		rb_raise(rb_eArgError, "wrong number of arguments (%d for 7 or 10)", argc);
+	}
+
+	Table *src = getPrivateDataCheck<Table>(srcObj, TableType);
+
+	/* Without z coordinates, all layers are copied */
+	if (depth < 0)
+		depth = src->zSize();
+
+	t->copy(*src, srcX, srcY, srcZ, width, height, depth, dstX, dstY, dstZ);
+
+	return self;
+}
+
+/* Rows are packed like Array#pack("s*") does it */
+RB_METHOD(tableGetRow)
+{
+	Table *t = getPrivateData<Table>(self);
+
+	int y, z = 0;
+	rb_get_args(argc, argv, "i|i", &y, &z RB_ARG_END);
+
+	if (y < 0 || y >= t->ySize() || z < 0 || z >= t->zSize())
+		return Qnil;
+
+	VALUE str = rb_str_new(0, t->xSize() * sizeof(int16_t));
+	t->getRow(reinterpret_cast<int16_t*>(RSTRING_PTR(str)), y, z);
+
+	return str;
+}
+
+RB_METHOD(tableSetRow)
+{
+	rb_check_frozen(self);
+
+	Table *t = getPrivateData<Table>(self);
+
+	int y, z = 0;
+	VALUE str;
+
+	if (argc == 2)
+		rb_get_args(argc, argv, "iS", &y, &str RB_ARG_END);
+	else
+		rb_get_args(argc, argv, "iiS", &y, &z, &str RB_ARG_END);
+
+	/* The string buffer may not be suitably aligned */
+	std::vector<int16_t> values(RSTRING_LEN(str) / sizeof(int16_t));
+
+	if (!values.empty())
+		memcpy(&values[0], RSTRING_PTR(str), values.size() * sizeof(int16_t));
+
+	int count = values.empty() ? 0 : t->setRow(&values[0], values.size(), y, z);
+
+	return INT2FIX(count);
+}
+
+static VALUE tableUpdateYield(VALUE self)
+{
+	return rb_yield(self);
+}
+
+static VALUE tableUpdateEnd(VALUE self)
+{
+	Table *t = getPrivateData<Table>(self);
+	t->endUpdate();
+
+	return Qnil;
+}
+
+/* Changes made inside the block notify tilemaps only once */
+RB_METHOD(tableUpdate)
+{
+	RB_UNUSED_PARAM;
+
+	rb_need_block();
+
+	Table *t = getPrivateData<Table>(self);
+	t->beginUpdate();
+
+	return rb_ensure(RUBY_METHOD_FUNC(tableUpdateYield), self,
+	                 RUBY_METHOD_FUNC(tableUpdateEnd), self);
+}
+
 MARSH_LOAD_FUN(Table)
 INITCOPY_FUN(Table)
 
@@ -176,5 +320,10 @@ tableBindingInit()
 	_rb_define_method(klass, "zsize", tableZSize);
 	_rb_define_method(klass, "[]", tableGetAt);
 	_rb_define_method(klass, "[]=", tableSetAt);
+	_rb_define_method(klass, "fill", tableFill);
+	_rb_define_method(klass, "copy", tableCopy);
+	_rb_define_method(klass, "row", tableGetRow);
+	_rb_define_method(klass, "set_row", tableSetRow);
+	_rb_define_method(klass, "update", tableUpdate);
 
 }
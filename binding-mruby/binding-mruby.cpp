@@ -52,12 +52,14 @@
 static void mrbBindingExecute();
 static void mrbBindingTerminate();
 static void mrbBindingReset();
+static void mrbBindingFrameIdle(int64_t);
 
 ScriptBinding scriptBindingImpl =
 {
     mrbBindingExecute,
     mrbBindingTerminate,
-    mrbBindingReset
+    mrbBindingReset,
+    mrbBindingFrameIdle
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
@@ -414,3 +416,6 @@ static void mrbBindingReset()
 {
 	// No idea how to do this with mruby yet
 }
+
+static void mrbBindingFrameIdle(int64_t)
+{}
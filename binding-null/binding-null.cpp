@@ -40,11 +40,17 @@ static void nullBindingReset()
 
 }
 
+static void nullBindingFrameIdle(int64_t)
+{
+
+}
+
 ScriptBinding scriptBindingImpl =
 {
     nullBindingExecute,
     nullBindingTerminate,
-    nullBindingReset
+    nullBindingReset,
+    nullBindingFrameIdle
 };
 
 ScriptBinding *scriptBinding = &scriptBindingImpl;
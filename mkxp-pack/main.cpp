@@ -0,0 +1,442 @@
+/*
+** main.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Converts a game folder or RGSS archive into an mkxp pack,
+ * and benchmarks read throughput of any mountable source */
+
+#include "mkxppack.h"
+#include "rgssad.h"
+
+#include <physfs.h>
+#include <zlib.h>
+#include <SDL_timer.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define DEFAULT_BLOCK_SIZE (64 * 1024)
+#define BENCH_PASSES 3
+
+static const char usage[] =
+	"usage: mkxp-pack [options] <game folder|archive> <output." MKXPPACK_EXTENSION ">\n"
+	"       mkxp-pack --bench <game folder|archive>...\n"
+	"\n"
+	"options:\n"
+	"  --block-size=KB  Uncompressed block size (default: 64)\n"
+	"  --level=N        zlib compression level, 0-9 (default: 9)\n"
+	"  --no-dedup       Store identical files separately\n";
+
+struct PackEntry
+{
+	std::string path;
+	uint64_t size;
+	uint32_t firstBlock;
+};
+
+struct PackBlock
+{
+	uint64_t offset;
+	uint32_t packedSize;
+};
+
+static void
+packUint16(std::vector<uint8_t> &out, uint16_t value)
+{
+	out.push_back(value & 0xFF);
+	out.push_back(value >> 8);
+}
+
+static void
+packUint32(std::vector<uint8_t> &out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		out.push_back((value >> (i*8)) & 0xFF);
+}
+
+static void
+packUint64(std::vector<uint8_t> &out, uint64_t value)
+{
+	packUint32(out, value & 0xFFFFFFFF);
+	packUint32(out, value >> 32);
+}
+
+static PHYSFS_EnumerateCallbackResult
+collectFilesCB(void *d, const char *origdir, const char *fname)
+{
+	std::vector<std::string> &files = *static_cast<std::vector<std::string>*>(d);
+
+	std::string path(origdir);
+
+	if (!path.empty())
+		path += '/';
+
+	path += fname;
+
+	PHYSFS_Stat stat;
+
+	if (!PHYSFS_stat(path.c_str(), &stat))
+		return PHYSFS_ENUM_OK;
+
+	if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY)
+		PHYSFS_enumerate(path.c_str(), collectFilesCB, d);
+	else if (stat.filetype == PHYSFS_FILETYPE_REGULAR)
+		files.push_back(path);
+
+	return PHYSFS_ENUM_OK;
+}
+
+static std::vector<std::string>
+collectFiles()
+{
+	std::vector<std::string> files;
+	PHYSFS_enumerate("", collectFilesCB, &files);
+
+	/* Same order the pack's lookup table is sorted by */
+	std::sort(files.begin(), files.end());
+
+	return files;
+}
+
+static bool
+readFile(const std::string &path, std::vector<uint8_t> &data)
+{
+	PHYSFS_File *f = PHYSFS_openRead(path.c_str());
+
+	if (!f)
+		return false;
+
+	PHYSFS_sint64 length = PHYSFS_fileLength(f);
+	bool ok = length >= 0;
+
+	if (ok)
+	{
+		data.resize(length);
+
+		if (length > 0)
+			ok = PHYSFS_readBytes(f, &data[0], length) == length;
+	}
+
+	PHYSFS_close(f);
+
+	return ok;
+}
+
+static bool
+mountSource(const char *path)
+{
+	if (PHYSFS_mount(path, 0, 1))
+		return true;
+
+	fprintf(stderr, "Failed to mount '%s': %s\n", path,
+	        PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+
+	return false;
+}
+
+static int
+createPack(const char *srcPath, const char *dstPath,
+           uint32_t blockSize, int level, bool dedup)
+{
+	if (!mountSource(srcPath))
+		return 1;
+
+	FILE *out = fopen(dstPath, "wb");
+
+	if (!out)
+	{
+		fprintf(stderr, "Failed to open '%s' for writing\n", dstPath);
+		return 1;
+	}
+
+	std::vector<std::string> files = collectFiles();
+	std::vector<PackEntry> entries;
+	std::vector<PackBlock> blocks;
+
+	/* Maps: size and checksums of already stored contents
+	 * to:   index of the entry they were stored for */
+	typedef std::pair<uint64_t, std::pair<uint32_t, uint32_t> > ContentKey;
+	std::map<ContentKey, size_t> storedContents;
+
+	/* Header is filled in at the end */
+	std::vector<uint8_t> header(MKXPPACK_HEADER_SIZE, 0);
+	fwrite(&header[0], 1, header.size(), out);
+	uint64_t offset = header.size();
+
+	std::vector<uint8_t> data, dupData, packed;
+	uint64_t totalSize = 0, dedupSize = 0;
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const std::string &path = files[i];
+
+		if (path.size() > 0xFFFF)
+		{
+			fprintf(stderr, "Skipping '%s': path too long\n", path.c_str());
+			continue;
+		}
+
+		if (!readFile(path, data))
+		{
+			fprintf(stderr, "Failed to read '%s'\n", path.c_str());
+			fclose(out);
+			return 1;
+		}
+
+		PackEntry entry;
+		entry.path = path;
+		entry.size = data.size();
+		entry.firstBlock = blocks.size();
+
+		totalSize += data.size();
+
+		const uint8_t *bytes = data.empty() ? 0 : &data[0];
+		ContentKey key(data.size(), std::make_pair(
+			(uint32_t) crc32(0, bytes, data.size()),
+			(uint32_t) adler32(1, bytes, data.size())));
+
+		if (dedup && !data.empty() && storedContents.count(key))
+		{
+			/* Rule out checksum collisions before sharing blocks */
+			const PackEntry &stored = entries[storedContents[key]];
+
+			if (readFile(stored.path, dupData) && dupData == data)
+			{
+				entry.firstBlock = stored.firstBlock;
+				entries.push_back(entry);
+				dedupSize += data.size();
+
+				continue;
+			}
+		}
+
+		for (uint64_t pos = 0; pos < data.size(); pos += blockSize)
+		{
+			uint32_t rawLen = std::min<uint64_t>(blockSize, data.size() - pos);
+
+			uLongf packedLen = compressBound(rawLen);
+			packed.resize(packedLen);
+
+			PackBlock block;
+			block.offset = offset;
+
+			/* Blocks that don't shrink are stored as is */
+			if (level > 0
+			&&  compress2(&packed[0], &packedLen, &data[pos], rawLen, level) == Z_OK
+			&&  packedLen < rawLen)
+			{
+				fwrite(&packed[0], 1, packedLen, out);
+				block.packedSize = packedLen;
+			}
+			else
+			{
+				fwrite(&data[pos], 1, rawLen, out);
+				block.packedSize = rawLen;
+			}
+
+			offset += block.packedSize;
+			blocks.push_back(block);
+		}
+
+		if (dedup && !data.empty())
+			storedContents[key] = entries.size();
+
+		entries.push_back(entry);
+	}
+
+	/* Index */
+	std::vector<uint8_t> index;
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		packUint64(index, entries[i].size);
+		packUint32(index, entries[i].firstBlock);
+		packUint16(index, entries[i].path.size());
+		index.insert(index.end(), entries[i].path.begin(), entries[i].path.end());
+	}
+
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		packUint64(index, blocks[i].offset);
+		packUint32(index, blocks[i].packedSize);
+	}
+
+	if (!index.empty())
+		fwrite(&index[0], 1, index.size(), out);
+
+	header.clear();
+	header.insert(header.end(), MKXPPACK_MAGIC, MKXPPACK_MAGIC + 8);
+	packUint32(header, MKXPPACK_VERSION);
+	packUint32(header, blockSize);
+	packUint32(header, entries.size());
+	packUint32(header, blocks.size());
+	packUint64(header, offset);
+
+	fseek(out, 0, SEEK_SET);
+	fwrite(&header[0], 1, header.size(), out);
+
+	bool ok = !ferror(out);
+
+	if (fclose(out) != 0 || !ok)
+	{
+		fprintf(stderr, "Failed to write '%s'\n", dstPath);
+		return 1;
+	}
+
+	uint64_t packSize = offset + index.size();
+
+	printf("%u files, %.2f MB -> %.2f MB (%.1f%%), %.2f MB deduplicated\n",
+	       (unsigned) entries.size(), totalSize / 1048576.0, packSize / 1048576.0,
+	       totalSize ? packSize * 100.0 / totalSize : 100.0,
+	       dedupSize / 1048576.0);
+
+	return 0;
+}
+
+static double
+readAll(const std::vector<std::string> &files, uint64_t &bytes)
+{
+	static uint8_t buffer[64 * 1024];
+
+	bytes = 0;
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		PHYSFS_File *f = PHYSFS_openRead(files[i].c_str());
+
+		if (!f)
+			continue;
+
+		PHYSFS_sint64 n;
+
+		while ((n = PHYSFS_readBytes(f, buffer, sizeof(buffer))) > 0)
+			bytes += n;
+
+		PHYSFS_close(f);
+	}
+
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	return (double) (end - start) / SDL_GetPerformanceFrequency();
+}
+
+static int
+bench(int count, char **paths)
+{
+	printf("%-32s %8s %10s %10s %12s %12s\n",
+	       "source", "files", "MB", "mount ms", "first MB/s", "best MB/s");
+
+	for (int i = 0; i < count; ++i)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		if (!mountSource(paths[i]))
+			return 1;
+
+		double mountTime = (double) (SDL_GetPerformanceCounter() - start)
+		                 / SDL_GetPerformanceFrequency();
+
+		std::vector<std::string> files = collectFiles();
+		uint64_t bytes = 0;
+
+		/* The first pass may or may not hit the OS page cache,
+		 * depending on what ran before us */
+		double first = readAll(files, bytes);
+		double best = first;
+
+		for (int j = 1; j < BENCH_PASSES; ++j)
+			best = std::min(best, readAll(files, bytes));
+
+		double mb = bytes / 1048576.0;
+
+		printf("%-32s %8u %10.2f %10.2f %12.1f %12.1f\n",
+		       paths[i], (unsigned) files.size(), mb, mountTime * 1000,
+		       first > 0 ? mb / first : 0, best > 0 ? mb / best : 0);
+
+		PHYSFS_unmount(paths[i]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t blockSize = DEFAULT_BLOCK_SIZE;
+	int level = Z_BEST_COMPRESSION;
+	bool dedup = true;
+	bool benchMode = false;
+	bool badArg = false;
+
+	std::vector<char*> args;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+
+		if (!strncmp(arg, "--block-size=", 13))
+			blockSize = atoi(arg + 13) * 1024;
+		else if (!strncmp(arg, "--level=", 8))
+			level = atoi(arg + 8);
+		else if (!strcmp(arg, "--no-dedup"))
+			dedup = false;
+		else if (!strcmp(arg, "--bench"))
+			benchMode = true;
+		else if (!strncmp(arg, "--", 2))
+			badArg = true;
+		else
+			args.push_back(argv[i]);
+	}
+
+	if (badArg || blockSize == 0 || level < 0 || level > 9
+	||  (benchMode ? args.empty() : args.size() != 2))
+	{
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	if (!PHYSFS_init(argv[0]))
+	{
+		fprintf(stderr, "Failed to initialize PhysFS\n");
+		return 1;
+	}
+
+	PHYSFS_registerArchiver(&RGSS1_Archiver);
+	PHYSFS_registerArchiver(&RGSS2_Archiver);
+	PHYSFS_registerArchiver(&RGSS3_Archiver);
+	PHYSFS_registerArchiver(&MKXPPACK_Archiver);
+
+	int result;
+
+	if (benchMode)
+		result = bench(args.size(), &args[0]);
+	else
+		result = createPack(args[0], args[1], blockSize, level, dedup);
+
+	PHYSFS_deinit();
+
+	return result;
+}
@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = mkxp-pack
+QT =
+CONFIG += console link_pkgconfig
+CONFIG -= app_bundle
+PKGCONFIG += physfs sdl2 zlib
+
+INCLUDEPATH += ../src
+
+# Input
+SOURCES += \
+	main.cpp \
+	../src/rgssad.cpp \
+	../src/mkxppack.cpp
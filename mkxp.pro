@@ -128,14 +128,20 @@ HEADERS += \
 	src/soundemitter.h \
 	src/aldatasource.h \
 	src/alstream.h \
+	src/streamheadcache.h \
 	src/audiostream.h \
 	src/rgssad.h \
+	src/mkxppack.h \
 	src/windowvx.h \
 	src/tilemapvx.h \
 	src/tileatlasvx.h \
 	src/sharedmidistate.h \
+	src/sharedsoundfont.h \
+	src/headlessaudio.h \
 	src/fluid-fun.h \
-	src/sdl-util.h
+	src/sdl-util.h \
+	src/perfstats.h \
+	src/slab-pool.h
 
 SOURCES += \
 	src/main.cpp \
@@ -171,8 +177,10 @@ SOURCES += \
 	src/soundemitter.cpp \
 	src/sdlsoundsource.cpp \
 	src/alstream.cpp \
+	src/streamheadcache.cpp \
 	src/audiostream.cpp \
 	src/rgssad.cpp \
+	src/mkxppack.cpp \
 	src/bundledfont.cpp \
 	src/vorbissource.cpp \
 	src/windowvx.cpp \
@@ -180,7 +188,10 @@ SOURCES += \
 	src/tileatlasvx.cpp \
 	src/autotilesvx.cpp \
 	src/midisource.cpp \
-	src/fluid-fun.cpp
+	src/fluid-fun.cpp \
+	src/sharedsoundfont.cpp \
+	src/headlessaudio.cpp \
+	src/perfstats.cpp
 
 EMBED = \
 	shader/common.h \
@@ -218,6 +229,10 @@ INI_ENCODING {
 	DEFINES += INI_ENCODING
 }
 
+NO_PERF_STATS {
+	DEFINES += NO_PERF_STATS
+}
+
 defineReplace(xxdOutput) {
 	return($$basename(1).xxd)
 }
@@ -300,7 +315,10 @@ BINDING_MRI {
 	binding-mri/disposable-binding.h \
 	binding-mri/sceneelement-binding.h \
 	binding-mri/viewportelement-binding.h \
-	binding-mri/flashable-binding.h
+	binding-mri/flashable-binding.h \
+	binding-mri/marshal-loader.h \
+	binding-mri/script-profiler.h \
+	binding-mri/frame-gc.h
 
 	SOURCES += \
 	binding-mri/binding-mri.cpp \
@@ -320,7 +338,11 @@ BINDING_MRI {
 	binding-mri/module_rpg.cpp \
 	binding-mri/filesystem-binding.cpp \
 	binding-mri/windowvx-binding.cpp \
-	binding-mri/tilemapvx-binding.cpp
+	binding-mri/tilemapvx-binding.cpp \
+	binding-mri/marshal-loader.cpp \
+	binding-mri/stats-binding.cpp \
+	binding-mri/script-profiler.cpp \
+	binding-mri/frame-gc.cpp
 }
 
 OTHER_FILES += $$EMBED
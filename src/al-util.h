@@ -91,6 +91,11 @@ namespace Buffer
 	{
 		return getInteger(id, AL_CHANNELS);
 	}
+
+	inline ALint getFrequency(Buffer::ID id)
+	{
+		return getInteger(id, AL_FREQUENCY);
+	}
 }
 
 namespace Source
@@ -24,6 +24,8 @@
 
 #include "al-util.h"
 
+#include <vector>
+
 struct ALDataSource
 {
 	enum Status
@@ -34,6 +36,14 @@ struct ALDataSource
 		Error
 	};
 
+	/* If set, sources that support it append a copy of
+	 * all data uploaded in 'fillBuffer()' to this */
+	std::vector<uint8_t> *capture;
+
+	ALDataSource()
+	    : capture(0)
+	{}
+
 	virtual ~ALDataSource() {}
 
 	/* Read/process next chunk of data, and attach it
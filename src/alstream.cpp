@@ -23,26 +23,38 @@
 
 #include "sharedstate.h"
 #include "sharedmidistate.h"
-#include "eventthread.h"
 #include "filesystem.h"
 #include "exception.h"
 #include "aldatasource.h"
 #include "fluid-fun.h"
 #include "sdl-util.h"
 #include "debugwriter.h"
+#include "streamheadcache.h"
+
+#include <algorithm>
 
-#include <SDL_mutex.h>
-#include <SDL_thread.h>
 #include <SDL_timer.h>
 
 ALStream::ALStream(LoopMode loopMode,
-		           const std::string &threadId)
+                   StreamHeadCache *headCache)
 	: looped(loopMode == Looped),
 	  state(Closed),
 	  source(0),
-	  thread(0),
+	  sourceRate(0),
+	  headCache(headCache),
+	  head(0),
+	  headCacheable(false),
+	  streaming(false),
+	  startPending(false),
 	  preemptPause(false),
-      pitch(1.0f)
+	  pitch(1.0f),
+	  seekPending(false),
+	  playingHead(false),
+	  headPos(0),
+	  recordedHead(0),
+	  queueTarget(STREAM_QUEUE_MIN),
+	  queuedBufs(0),
+	  underruns(0)
 {
 	alSrc = AL::Source::gen();
 
@@ -53,9 +65,9 @@ ALStream::ALStream(LoopMode loopMode,
 	for (int i = 0; i < STREAM_BUFS; ++i)
 		alBuf[i] = AL::Buffer::gen();
 
-	pauseMut = SDL_CreateMutex();
+	SDL_AtomicSet(&decodeTarget, STREAM_AHEAD_MIN);
 
-	threadName = std::string("al_stream (") + threadId + ")";
+	decodeMut = SDL_CreateMutex();
 }
 
 ALStream::~ALStream()
@@ -68,7 +80,7 @@ ALStream::~ALStream()
 	for (int i = 0; i < STREAM_BUFS; ++i)
 		AL::Buffer::del(alBuf[i]);
 
-	SDL_DestroyMutex(pauseMut);
+	SDL_DestroyMutex(decodeMut);
 }
 
 void ALStream::close()
@@ -100,7 +112,13 @@ void ALStream::open(const std::string &filename)
 	case Stopped:
 		closeSource();
 	case Closed:
+		/* The source is always opened here, on the calling
+		 * thread; a cached head only saves decoding (and
+		 * seeking) at the start of playback */
 		openSource(filename);
+
+		if (source && headCacheable)
+			head = headCache->acquire(filename);
 	}
 
 	state = Stopped;
@@ -169,12 +187,17 @@ void ALStream::setVolume(float value)
 
 void ALStream::setPitch(float value)
 {
+	/* The decode worker might be reading from the source */
+	SDL_LockMutex(decodeMut);
+
 	/* If the source supports setting pitch natively,
 	 * we don't have to do it via OpenAL */
 	if (source && source->setPitch(value))
 		AL::Source::setPitch(alSrc, 1.0f);
 	else
 		AL::Source::setPitch(alSrc, value);
+
+	SDL_UnlockMutex(decodeMut);
 }
 
 ALStream::State ALStream::queryState()
@@ -186,17 +209,33 @@ ALStream::State ALStream::queryState()
 
 float ALStream::queryOffset()
 {
-	if (state == Closed)
+	if (state == Closed || sourceRate == 0)
 		return 0;
 
-	float procOffset = static_cast<float>(procFrames) / source->sampleRate();
+	float procOffset = static_cast<float>(procFrames) / sourceRate;
 
 	return procOffset + AL::Source::getSecOffset(alSrc);
 }
 
 void ALStream::closeSource()
 {
+	/* The decode worker might still be
+	 * finishing a buffer from the source */
+	SDL_LockMutex(decodeMut);
+
+	if (recordedHead)
+		finishRecording(false);
+
 	delete source;
+	source = 0;
+
+	SDL_UnlockMutex(decodeMut);
+
+	if (head)
+	{
+		headCache->release(head);
+		head = 0;
+	}
 }
 
 struct ALStreamOpenHandler : FileSystem::OpenHandler
@@ -204,10 +243,11 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 	SDL_RWops *srcOps;
 	bool looped;
 	ALDataSource *source;
+	bool isVorbis;
 	std::string errorMsg;
 
 	ALStreamOpenHandler(SDL_RWops &srcOps, bool looped)
-	    : srcOps(&srcOps), looped(looped), source(0)
+	    : srcOps(&srcOps), looped(looped), source(0), isVorbis(false)
 	{}
 
 	bool tryRead(SDL_RWops &ops, const char *ext)
@@ -226,6 +266,7 @@ struct ALStreamOpenHandler : FileSystem::OpenHandler
 			if (!strcmp(sig, "OggS"))
 			{
 				source = createVorbisSource(*srcOps, looped);
+				isVorbis = true;
 				return true;
 			}
 
@@ -261,6 +302,10 @@ void ALStream::openSource(const std::string &filename)
 	source = handler.source;
 	needsRewind.clear();
 
+	this->filename = filename;
+	sourceRate = source ? source->sampleRate() : 0;
+	headCacheable = handler.isVorbis;
+
 	if (!source)
 	{
 		char buf[512];
@@ -273,21 +318,24 @@ void ALStream::openSource(const std::string &filename)
 
 void ALStream::stopStream()
 {
-	threadTermReq.set();
+	streaming = false;
+	startPending = false;
 
-	if (thread)
-	{
-		SDL_WaitThread(thread, 0);
-		thread = 0;
-		needsRewind.set();
-	}
+	/* This is called from the audio scheduler too, so it
+	 * doesn't wait for the decode worker to finish the buffer
+	 * it might be working on. That (and discarding a partly
+	 * recorded head) happens when the stream is started
+	 * again or closed, under 'decodeMut' */
+	decoding.clear();
+
+	/* The data source has been read from
+	 * by now, so it needs to be rewound */
+	needsRewind.set();
 
-	/* Need to stop the source _after_ the thread has terminated,
-	 * because it might have accidentally started it again before
-	 * seeing the term request */
 	AL::Source::stop(alSrc);
 
 	procFrames = 0;
+	queuedBufs = 0;
 }
 
 void ALStream::startStream(float offset)
@@ -297,37 +345,64 @@ void ALStream::startStream(float offset)
 	preemptPause = false;
 	streamInited.clear();
 	sourceExhausted.clear();
-	threadTermReq.clear();
 
 	startOffset = offset;
-	procFrames = offset * source->sampleRate();
+	queuedBufs = 0;
+	lastBuf = AL::Buffer::ID(0);
+
+	/* Once the worker has finished its last buffer,
+	 * it is safe to reset both queues */
+	SDL_LockMutex(decodeMut);
+
+	if (recordedHead)
+		finishRecording(false);
+
+	freeBufs.clear();
+	decodedBufs.clear();
+
+	for (int i = 0; i < STREAM_BUFS; ++i)
+		freeBufs.push(alBuf[i]);
+
+	/* Start from the cached head if possible */
+	playingHead = (head && offset == 0);
+	headPos = 0;
 
-	thread = createSDLThread
-		<ALStream, &ALStream::streamData>(this, threadName);
+	/* Seeking is done by the worker too, so a
+	 * long seek doesn't hold up the caller */
+	seekPending = needsRewind && !playingHead;
+
+	/* Record the head of this track while decoding it */
+	if (offset == 0 && !head && source && headCacheable
+	&&  !headCache->contains(filename))
+	{
+		recordedHead = new StreamHead;
+		source->capture = &recordedHead->pcm;
+	}
+
+	decoding.set();
+
+	SDL_UnlockMutex(decodeMut);
+
+	procFrames = offset * sourceRate;
+
+	streaming = true;
+	startPending = true;
 }
 
 void ALStream::pauseStream()
 {
-	SDL_LockMutex(pauseMut);
-
 	if (AL::Source::getState(alSrc) != AL_PLAYING)
 		preemptPause = true;
 	else
 		AL::Source::pause(alSrc);
-
-	SDL_UnlockMutex(pauseMut);
 }
 
 void ALStream::resumeStream()
 {
-	SDL_LockMutex(pauseMut);
-
 	if (preemptPause)
 		preemptPause = false;
 	else
 		AL::Source::play(alSrc);
-
-	SDL_UnlockMutex(pauseMut);
 }
 
 void ALStream::checkStopped()
@@ -357,123 +432,340 @@ void ALStream::checkStopped()
 	state = Stopped;
 }
 
-/* thread func */
-void ALStream::streamData()
+bool ALStream::update()
 {
-	/* Fill up queue */
-	bool firstBuffer = true;
-	ALDataSource::Status status;
+	if (!streaming)
+		return false;
 
-	if (threadTermReq)
-		return;
+	if (startPending)
+		fillQueue();
+	else
+		refillBuffers();
+
+	/* Once the source has played out, there is
+	 * nothing left to service for this stream */
+	checkStopped();
+
+	return streaming;
+}
 
-	if (needsRewind)
+bool ALStream::wantsDecode()
+{
+	return decoding
+	    && decodedBufs.size() < SDL_AtomicGet(&decodeTarget)
+	    && freeBufs.size() > 0;
+}
+
+/* Raise 'value' by 'step', up to 'max' */
+static void
+raiseTarget(SDL_atomic_t &value, int step, int max)
+{
+	int current = SDL_AtomicGet(&value);
+
+	if (current < max)
+		SDL_AtomicCAS(&value, current, std::min(current + step, max));
+}
+
+bool ALStream::decodeNext()
+{
+	if (!wantsDecode())
+		return false;
+
+	SDL_LockMutex(decodeMut);
+
+	/* Might have been stopped while waiting for the lock */
+	if (!wantsDecode())
+	{
+		SDL_UnlockMutex(decodeMut);
+		return false;
+	}
+
+	AL::Buffer::ID buf = freeBufs.front().buf;
+	freeBufs.pop();
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	ALDataSource::Status status = decodeBuffer(buf);
+	uint64_t spent = SDL_GetPerformanceCounter() - start;
+
+	/* If decoding a buffer took more than half as long as
+	 * it takes to play it back, keep more of them ready */
+	ALint bits = AL::Buffer::getBits(buf);
+	ALint size = AL::Buffer::getSize(buf);
+	ALint chan = AL::Buffer::getChannels(buf);
+	ALint freq = AL::Buffer::getFrequency(buf);
+
+	if (bits != 0 && chan != 0 && freq != 0)
+	{
+		double playTime = (double) (size / (bits / 8) / chan) / freq;
+		double decodeTime = (double) spent / SDL_GetPerformanceFrequency();
+
+		if (decodeTime > playTime / 2)
+			raiseTarget(decodeTarget, 1, STREAM_AHEAD_MAX);
+	}
+
+	decodedBufs.push(buf, status);
+
+	if (status == ALDataSource::Error || status == ALDataSource::EndOfStream)
+		decoding.clear();
+
+	SDL_UnlockMutex(decodeMut);
+
+	return true;
+}
+
+/* Takes the format of the data in 'buf' over into 'head' */
+static void
+initHeadFormat(StreamHead &head, AL::Buffer::ID buf)
+{
+	ALint bits = AL::Buffer::getBits(buf);
+	ALint chan = AL::Buffer::getChannels(buf);
+
+	head.format = chooseALFormat(bits / 8, chan);
+	head.freq = AL::Buffer::getFrequency(buf);
+	head.frameSize = (bits / 8) * chan;
+}
+
+static bool
+headComplete(const StreamHead &head)
+{
+	return head.freq != 0 && head.frames() >= STREAM_HEAD_SECONDS * (uint32_t) head.freq;
+}
+
+/* Decode worker side, under 'decodeMut'. Fills 'buf'
+ * from the cached head first, then from the source */
+ALDataSource::Status ALStream::decodeBuffer(AL::Buffer::ID buf)
+{
+	if (playingHead)
+	{
+		if (headPos < head->pcm.size())
+		{
+			size_t size = std::min<size_t>(STREAM_BUF_SIZE, head->pcm.size() - headPos);
+
+			AL::Buffer::uploadData(buf, head->format, &head->pcm[headPos],
+			                       size, head->freq);
+			headPos += size;
+
+			return ALDataSource::NoError;
+		}
+
+		/* Continue with the actual source right
+		 * where the head ends */
+		playingHead = false;
+		source->seekToOffset(head->duration());
+	}
+
+	if (!source)
+		return ALDataSource::Error;
+
+	if (seekPending)
 	{
 		source->seekToOffset(startOffset);
+		seekPending = false;
 	}
 
-	for (int i = 0; i < STREAM_BUFS; ++i)
+	ALDataSource::Status status = source->fillBuffer(buf);
+
+	if (recordedHead)
 	{
-		if (threadTermReq)
-			return;
+		if (recordedHead->frameSize == 0)
+			initHeadFormat(*recordedHead, buf);
+
+		/* Heads only contain uninterrupted data */
+		if (status != ALDataSource::NoError)
+			finishRecording(false);
+		else if (headComplete(*recordedHead))
+			finishRecording(true);
+	}
+
+	return status;
+}
+
+/* Under 'decodeMut' */
+void ALStream::finishRecording(bool keep)
+{
+	source->capture = 0;
+
+	if (keep)
+		headCache->insert(filename, recordedHead);
+	else
+		delete recordedHead;
+
+	recordedHead = 0;
+}
+
+void ALStream::preloadHead(StreamHeadCache &cache,
+                           const std::string &filename)
+{
+	if (cache.contains(filename))
+		return;
 
-		AL::Buffer::ID buf = alBuf[i];
+	SDL_RWops ops;
+	ALStreamOpenHandler handler(ops, true);
 
+	try
+	{
+		shState->fileSystem().openRead(handler, filename.c_str());
+	}
+	catch (const Exception &e)
+	{
+		Debug() << "Unable to preload audio stream:" << e.msg;
+		return;
+	}
+
+	ALDataSource *source = handler.source;
+
+	if (!source)
+		return;
+
+	if (!handler.isVorbis)
+	{
+		delete source;
+		return;
+	}
+
+	StreamHead *head = new StreamHead;
+	source->capture = &head->pcm;
+
+	AL::Buffer::ID buf = AL::Buffer::gen();
+	ALDataSource::Status status;
+
+	do
+	{
 		status = source->fillBuffer(buf);
 
-		if (status == ALDataSource::Error)
-			return;
+		if (head->frameSize == 0)
+			initHeadFormat(*head, buf);
+	}
+	while (status == ALDataSource::NoError && !headComplete(*head));
+
+	AL::Buffer::del(buf);
+	delete source;
+
+	if (status == ALDataSource::NoError)
+		cache.insert(filename, head);
+	else
+		delete head;
+}
+
+/* Queue decoded buffers on the AL source, up to the
+ * queue target. Returns the number of buffers queued */
+int ALStream::queueDecoded()
+{
+	int queued = 0;
 
-		AL::Source::queueBuffer(alSrc, buf);
+	while (queuedBufs < queueTarget && decodedBufs.size() > 0)
+	{
+		ALBufferQueue::Entry entry = decodedBufs.front();
+		decodedBufs.pop();
 
-		if (firstBuffer)
+		if (entry.status == ALDataSource::Error)
 		{
-			resumeStream();
+			/* Play out what we have, then stop */
+			freeBufs.push(entry.buf);
+			sourceExhausted.set();
 
-			firstBuffer = false;
-			streamInited.set();
+			break;
 		}
 
-		if (threadTermReq)
-			return;
+		AL::Source::queueBuffer(alSrc, entry.buf);
+		++queuedBufs;
+		++queued;
+
+		/* If this was the last buffer before the data
+		 * source loop wrapped around again, mark it as
+		 * such so we can catch it and reset the processed
+		 * sample count once it gets unqueued */
+		if (entry.status == ALDataSource::WrapAround)
+			lastBuf = entry.buf;
 
-		if (status == ALDataSource::EndOfStream)
+		if (entry.status == ALDataSource::EndOfStream)
 		{
 			sourceExhausted.set();
+
 			break;
 		}
 	}
 
-	/* Wait for buffers to be consumed, then
-	 * refill and queue them up again */
-	while (true)
-	{
-		shState->rtData().syncPoint.passSecondarySync();
-
-		ALint procBufs = AL::Source::getProcBufferCount(alSrc);
+	return queued;
+}
 
-		while (procBufs--)
-		{
-			if (threadTermReq)
-				break;
+void ALStream::fillQueue()
+{
+	/* Wait until the decode worker has buffers ready up to
+	 * its target, or has reached the end of the data. The
+	 * rest of the queue is filled up on later updates */
+	int ready = std::min(queueTarget, (int) SDL_AtomicGet(&decodeTarget));
 
-			AL::Buffer::ID buf = AL::Source::unqueueBuffer(alSrc);
+	if (decodedBufs.size() < ready && decoding)
+		return;
 
-			/* If something went wrong, try again later */
-			if (buf == AL::Buffer::ID(0))
-				break;
+	startPending = false;
 
-			if (buf == lastBuf)
-			{
-				/* Reset the processed sample count so
-				 * querying the playback offset returns 0.0 again */
-				procFrames = source->loopStartFrames();
-				lastBuf = AL::Buffer::ID(0);
-			}
-			else
-			{
-				/* Add the frame count contained in this
-				 * buffer to the total count */
-				ALint bits = AL::Buffer::getBits(buf);
-				ALint size = AL::Buffer::getSize(buf);
-				ALint chan = AL::Buffer::getChannels(buf);
-
-				if (bits != 0 && chan != 0)
-					procFrames += ((size / (bits / 8)) / chan);
-			}
+	queueDecoded();
 
-			if (sourceExhausted)
-				continue;
+	/* Even if nothing could be queued (decoding error),
+	 * mark the stream as started so it gets stopped */
+	streamInited.set();
 
-			status = source->fillBuffer(buf);
+	if (queuedBufs > 0)
+		resumeStream();
+}
 
-			if (status == ALDataSource::Error)
-			{
-				sourceExhausted.set();
-				return;
-			}
+/* Return buffers the AL source is done with to
+ * the decode worker, and queue up decoded ones */
+void ALStream::refillBuffers()
+{
+	ALint procBufs = AL::Source::getProcBufferCount(alSrc);
 
-			AL::Source::queueBuffer(alSrc, buf);
+	while (procBufs--)
+	{
+		AL::Buffer::ID buf = AL::Source::unqueueBuffer(alSrc);
 
-			/* In case of buffer underrun,
-			 * start playing again */
-			if (AL::Source::getState(alSrc) == AL_STOPPED)
-				AL::Source::play(alSrc);
+		/* If something went wrong, try again later */
+		if (buf == AL::Buffer::ID(0))
+			break;
 
-			/* If this was the last buffer before the data
-			 * source loop wrapped around again, mark it as
-			 * such so we can catch it and reset the processed
-			 * sample count once it gets unqueued */
-			if (status == ALDataSource::WrapAround)
-				lastBuf = buf;
+		--queuedBufs;
 
-			if (status == ALDataSource::EndOfStream)
-				sourceExhausted.set();
+		if (buf == lastBuf)
+		{
+			/* Reset the processed sample count so
+			 * querying the playback offset returns 0.0 again */
+			procFrames = source->loopStartFrames();
+			lastBuf = AL::Buffer::ID(0);
+		}
+		else
+		{
+			/* Add the frame count contained in this
+			 * buffer to the total count */
+			ALint bits = AL::Buffer::getBits(buf);
+			ALint size = AL::Buffer::getSize(buf);
+			ALint chan = AL::Buffer::getChannels(buf);
+
+			if (bits != 0 && chan != 0)
+				procFrames += ((size / (bits / 8)) / chan);
 		}
 
-		if (threadTermReq)
-			break;
+		freeBufs.push(buf);
+	}
+
+	if (sourceExhausted)
+		return;
+
+	if (queueDecoded() == 0)
+		return;
+
+	/* In case of buffer underrun, start playing again,
+	 * and keep more data queued and decoded from now on */
+	if (state == Playing && AL::Source::getState(alSrc) == AL_STOPPED)
+	{
+		AL::Source::play(alSrc);
+
+		++underruns;
+
+		if (queueTarget < STREAM_QUEUE_MAX)
+			++queueTarget;
 
-		SDL_Delay(AUDIO_SLEEP);
+		raiseTarget(decodeTarget, 2, STREAM_AHEAD_MAX);
 	}
 }
@@ -24,16 +24,89 @@
 
 #include "al-util.h"
 #include "sdl-util.h"
+#include "aldatasource.h"
 
 #include <string>
 #include <SDL_rwops.h>
+#include <SDL_mutex.h>
 
-struct ALDataSource;
+class StreamHeadCache;
+struct StreamHead;
 
-#define STREAM_BUFS 3
+/* Total AL buffers per stream. They cycle between being
+ * free, decoded ahead by the decode worker, and queued
+ * on the AL source */
+#define STREAM_BUFS 16
+
+/* Bounds of the AL source queue depth */
+#define STREAM_QUEUE_MIN 3
+#define STREAM_QUEUE_MAX 8
+
+/* Bounds of how many buffers are kept decoded ahead */
+#define STREAM_AHEAD_MIN 3
+#define STREAM_AHEAD_MAX 8
+
+/* Lock-free queue of AL buffers handed from exactly
+ * one producer thread to exactly one consumer thread */
+struct ALBufferQueue
+{
+	struct Entry
+	{
+		AL::Buffer::ID buf;
+		ALDataSource::Status status;
+	};
+
+	ALBufferQueue()
+	{
+		clear();
+	}
+
+	/* Only safe while neither side is active */
+	void clear()
+	{
+		SDL_AtomicSet(&pushed, 0);
+		SDL_AtomicSet(&popped, 0);
+	}
+
+	int size() const
+	{
+		return SDL_AtomicGet(&pushed) - SDL_AtomicGet(&popped);
+	}
+
+	/* Producer side */
+	void push(AL::Buffer::ID buf,
+	          ALDataSource::Status status = ALDataSource::NoError)
+	{
+		int i = SDL_AtomicGet(&pushed);
+
+		entries[i % STREAM_BUFS].buf = buf;
+		entries[i % STREAM_BUFS].status = status;
+
+		SDL_AtomicSet(&pushed, i+1);
+	}
+
+	/* Consumer side */
+	const Entry &front() const
+	{
+		return entries[SDL_AtomicGet(&popped) % STREAM_BUFS];
+	}
+
+	void pop()
+	{
+		SDL_AtomicAdd(&popped, 1);
+	}
+
+private:
+	Entry entries[STREAM_BUFS];
+	mutable SDL_atomic_t pushed;
+	mutable SDL_atomic_t popped;
+};
 
 /* State-machine like audio playback stream.
- * This class is NOT thread safe */
+ * This class is NOT thread safe; the audio scheduler
+ * calls 'update()' under the same lock that guards
+ * all other calls. Only 'decodeNext()' is called
+ * from the decode worker without that lock */
 struct ALStream
 {
 	enum State
@@ -48,11 +121,28 @@ struct ALStream
 	State state;
 
 	ALDataSource *source;
-	SDL_Thread *thread;
+	int sourceRate;
+
+	std::string filename;
+
+	/* Playback of tracks with a cached head starts from
+	 * that, and the source is only read from (by the decode
+	 * worker) after it was queued up */
+	StreamHeadCache *headCache;
+	StreamHead *head;
 
-	std::string threadName;
+	/* Only Ogg Vorbis sources can seek exactly to where
+	 * a head ends, so only their heads are cached */
+	bool headCacheable;
+
+	/* Set between starting and stopping the stream,
+	 * while 'update()' has work to do */
+	bool streaming;
+
+	/* The initial buffer fill is deferred to
+	 * the next 'update()' */
+	bool startPending;
 
-	SDL_mutex *pauseMut;
 	bool preemptPause;
 
 	/* When this flag isn't set and alSrc is
@@ -61,8 +151,6 @@ struct ALStream
 	AtomicFlag streamInited;
 	AtomicFlag sourceExhausted;
 
-	AtomicFlag threadTermReq;
-
 	AtomicFlag needsRewind;
 	float startOffset;
 
@@ -71,6 +159,35 @@ struct ALStream
 	AL::Source::ID alSrc;
 	AL::Buffer::ID alBuf[STREAM_BUFS];
 
+	/* Buffers flow from 'freeBufs' through the decode worker
+	 * into 'decodedBufs', and are queued on the AL source from
+	 * there by 'update()', which returns them to 'freeBufs'
+	 * once processed */
+	ALBufferQueue freeBufs;
+	ALBufferQueue decodedBufs;
+
+	/* Held by the decode worker while it reads from 'source' */
+	SDL_mutex *decodeMut;
+
+	/* Written under 'decodeMut' */
+	AtomicFlag decoding;
+	bool seekPending;
+
+	/* Decode worker state, under 'decodeMut'. 'headPos' is
+	 * the byte offset of the head data to upload next */
+	bool playingHead;
+	size_t headPos;
+	StreamHead *recordedHead;
+
+	/* How many buffers to keep decoded ahead / queued on
+	 * the AL source. Both grow when underruns happen or
+	 * decoding is slow, and persist across tracks */
+	SDL_atomic_t decodeTarget;
+	int queueTarget;
+
+	int queuedBufs;
+	uint32_t underruns;
+
 	uint64_t procFrames;
 	AL::Buffer::ID lastBuf;
 
@@ -89,7 +206,7 @@ struct ALStream
 	};
 
 	ALStream(LoopMode loopMode,
-	         const std::string &threadId);
+	         StreamHeadCache *headCache);
 	~ALStream();
 
 	void close();
@@ -104,10 +221,30 @@ struct ALStream
 	float queryOffset();
 	bool queryNativePitch();
 
+	/* Queues up more data as the AL source consumes it.
+	 * Returns true while the stream needs to be updated
+	 * (about every AUDIO_SLEEP ms) */
+	bool update();
+
+	/* True if the decode worker should be woken */
+	bool wantsDecode();
+
+	/* Decode worker side; decodes one buffer if the decode
+	 * target isn't reached yet. Returns true if it did */
+	bool decodeNext();
+
+	/* Decodes and caches the head of 'filename', if
+	 * it isn't cached yet. Called from the decode worker */
+	static void preloadHead(StreamHeadCache &cache,
+	                        const std::string &filename);
+
 private:
 	void closeSource();
 	void openSource(const std::string &filename);
 
+	ALDataSource::Status decodeBuffer(AL::Buffer::ID buf);
+	void finishRecording(bool keep);
+
 	void stopStream();
 	void startStream(float offset);
 	void pauseStream();
@@ -115,8 +252,9 @@ private:
 
 	void checkStopped();
 
-	/* thread func */
-	void streamData();
+	void fillQueue();
+	void refillBuffers();
+	int queueDecoded();
 };
 
 #endif // ALSTREAM_H
@@ -27,14 +27,27 @@
 #include "sharedmidistate.h"
 #include "eventthread.h"
 #include "sdl-util.h"
+#include "streamheadcache.h"
+#include "headlessaudio.h"
 
 #include <string>
+#include <deque>
 
+#include <SDL_mutex.h>
 #include <SDL_thread.h>
 #include <SDL_timer.h>
 
 struct AudioPrivate
 {
+	/* Posted whenever a stream gets new work (playback or
+	 * fade started), so the scheduler can sleep while idle */
+	SDL_sem *wakeSem;
+
+	/* Posted when a stream wants more data decoded ahead */
+	SDL_sem *decodeSem;
+
+	StreamHeadCache headCache;
+
 	AudioStream bgm;
 	AudioStream bgs;
 	AudioStream me;
@@ -58,181 +71,363 @@ struct AudioPrivate
 
 	struct
 	{
-		SDL_Thread *thread;
-		AtomicFlag termReq;
 		MeWatchState state;
 	} meWatch;
 
+	/* A single thread services all streams, their fades,
+	 * the MeWatch and SE source tracking, ticking every
+	 * AUDIO_SLEEP ms while anything is playing. Not started
+	 * with a rendering headless device, which calls
+	 * 'schedulerStep()' every frame instead */
+	struct
+	{
+		SDL_Thread *thread;
+		AtomicFlag termReq;
+		uint32_t lastTicks;
+	} scheduler;
+
+	/* Decodes stream data ahead of time, so that the
+	 * scheduler only has to queue up ready buffers */
+	struct
+	{
+		SDL_Thread *thread;
+		AtomicFlag termReq;
+
+		/* Tracks to decode the heads of */
+		std::deque<std::string> preloads;
+		SDL_mutex *preloadMut;
+	} decoder;
+
 	AudioPrivate(RGSSThreadData &rtData)
-	    : bgm(ALStream::Looped, "bgm"),
-	      bgs(ALStream::Looped, "bgs"),
-	      me(ALStream::NotLooped, "me"),
-	      se(rtData.config),
+	    : wakeSem(SDL_CreateSemaphore(0)),
+	      decodeSem(SDL_CreateSemaphore(0)),
+	      bgm(ALStream::Looped, wakeSem, &headCache),
+	      bgs(ALStream::Looped, wakeSem, &headCache),
+	      me(ALStream::NotLooped, wakeSem, &headCache),
+	      se(rtData.config, wakeSem, !steppedByFrame(rtData)),
 	      syncPoint(rtData.syncPoint)
 	{
 		meWatch.state = MeNotPlaying;
-		meWatch.thread = createSDLThread
-			<AudioPrivate, &AudioPrivate::meWatchFun>(this, "audio_mewatch");
+		decoder.preloadMut = SDL_CreateMutex();
+		scheduler.lastTicks = audioTicks();
+		scheduler.thread = 0;
+
+		if (!steppedByFrame(rtData))
+			scheduler.thread = createSDLThread
+				<AudioPrivate, &AudioPrivate::schedulerFun>(this, "audio_scheduler");
+
+		decoder.thread = createSDLThread
+			<AudioPrivate, &AudioPrivate::decoderFun>(this, "audio_decoder");
 	}
 
 	~AudioPrivate()
 	{
-		meWatch.termReq.set();
-		SDL_WaitThread(meWatch.thread, 0);
+		if (scheduler.thread)
+		{
+			scheduler.termReq.set();
+			SDL_SemPost(wakeSem);
+			SDL_WaitThread(scheduler.thread, 0);
+		}
+
+		decoder.termReq.set();
+		SDL_SemPost(decodeSem);
+		SDL_WaitThread(decoder.thread, 0);
+
+		SDL_DestroyMutex(decoder.preloadMut);
+		SDL_DestroySemaphore(decodeSem);
+		SDL_DestroySemaphore(wakeSem);
+	}
+
+	static bool steppedByFrame(RGSSThreadData &rtData)
+	{
+		return rtData.headlessAudio && rtData.headlessAudio->rendersFrames();
 	}
 
-	void meWatchFun()
+	static bool updateStream(AudioStream &stream)
 	{
-		const float fadeOutStep = 1.f / (200  / AUDIO_SLEEP);
-		const float fadeInStep  = 1.f / (1000 / AUDIO_SLEEP);
+		stream.lockStream();
+		bool busy = stream.update();
+		stream.unlockStream();
 
+		return busy;
+	}
+
+	void schedulerFun()
+	{
 		while (true)
 		{
 			syncPoint.passSecondarySync();
 
-			if (meWatch.termReq)
+			if (scheduler.termReq)
 				return;
 
-			switch (meWatch.state)
-			{
-			case MeNotPlaying:
-			{
-				me.lockStream();
+			/* Evaluate all of them, no short circuiting */
+			bool busy = updateStream(bgm);
+			busy = updateStream(bgs) || busy;
+			busy = updateStream(me) || busy;
+			busy = se.update() || busy;
 
-				if (me.stream.queryState() == ALStream::Playing)
-				{
-					/* ME playing detected. -> FadeOutBGM */
-					bgm.extPaused = true;
-					meWatch.state = BgmFadingOut;
-				}
+			uint32_t ticks = audioTicks();
+			updateMeWatch(ticks - scheduler.lastTicks);
+			scheduler.lastTicks = ticks;
 
-				me.unlockStream();
+			busy = busy || meWatch.state != MeNotPlaying;
+
+			if (bgm.stream.wantsDecode()
+			||  bgs.stream.wantsDecode()
+			||  me.stream.wantsDecode())
+				SDL_SemPost(decodeSem);
+
+			if (busy)
+				SDL_SemWaitTimeout(wakeSem, AUDIO_SLEEP);
+			else
+				SDL_SemWait(wakeSem);
+
+			/* Collapse multiple wakeups into one tick */
+			while (SDL_SemTryWait(wakeSem) == 0) {}
+		}
+	}
+
+	/* One scheduler tick on the calling thread. Everything it
+	 * needs is decoded synchronously beforehand, so the result
+	 * doesn't depend on how fast the worker threads are */
+	void schedulerStep()
+	{
+		while (true)
+		{
+			bool decoded = bgm.stream.decodeNext();
+			decoded = bgs.stream.decodeNext() || decoded;
+			decoded = me.stream.decodeNext() || decoded;
 
+			if (!decoded)
 				break;
-			}
+		}
 
-			case BgmFadingOut :
-			{
-				me.lockStream();
+		se.decodeQueued();
 
-				if (me.stream.queryState() != ALStream::Playing)
-				{
-					/* ME has ended while fading OUT BGM. -> FadeInBGM */
-					me.unlockStream();
-					meWatch.state = BgmFadingIn;
+		updateStream(bgm);
+		updateStream(bgs);
+		updateStream(me);
+		se.update();
 
-					break;
-				}
+		uint32_t ticks = audioTicks();
+		updateMeWatch(ticks - scheduler.lastTicks);
+		scheduler.lastTicks = ticks;
+	}
 
-				bgm.lockStream();
+	void decoderFun()
+	{
+		while (true)
+		{
+			SDL_SemWait(decodeSem);
 
-				float vol = bgm.getVolume(AudioStream::External);
-				vol -= fadeOutStep;
+			if (decoder.termReq)
+				return;
 
-				if (vol < 0 || bgm.stream.queryState() != ALStream::Playing)
-				{
-					/* Either BGM has fully faded out, or stopped midway. -> MePlaying */
-					bgm.setVolume(AudioStream::External, 0);
-					bgm.stream.pause();
-					meWatch.state = MePlaying;
-					bgm.unlockStream();
-					me.unlockStream();
+			/* One buffer per stream and round, so a slow
+			 * BGM can't starve the BGS or ME */
+			while (true)
+			{
+				/* Evaluate all of them, no short circuiting */
+				bool decoded = bgm.stream.decodeNext();
+				decoded = bgs.stream.decodeNext() || decoded;
+				decoded = me.stream.decodeNext() || decoded;
 
+				if (!decoded)
 					break;
-				}
 
-				bgm.setVolume(AudioStream::External, vol);
-				bgm.unlockStream();
-				me.unlockStream();
+				/* Let the scheduler queue up (or start
+				 * playing) the new data right away */
+				SDL_SemPost(wakeSem);
+			}
 
-				break;
+			/* Streams go first; one preload at a time */
+			std::string filename;
+
+			SDL_LockMutex(decoder.preloadMut);
+
+			if (!decoder.preloads.empty())
+			{
+				filename = decoder.preloads.front();
+				decoder.preloads.pop_front();
+
+				if (!decoder.preloads.empty())
+					SDL_SemPost(decodeSem);
 			}
 
-			case MePlaying :
+			SDL_UnlockMutex(decoder.preloadMut);
+
+			if (!filename.empty())
+				ALStream::preloadHead(headCache, filename);
+		}
+	}
+
+	void preloadStream(const char *filename)
+	{
+		SDL_LockMutex(decoder.preloadMut);
+		decoder.preloads.push_back(filename);
+		SDL_UnlockMutex(decoder.preloadMut);
+
+		SDL_SemPost(decodeSem);
+	}
+
+	static void getStats(AudioStream &stream, Audio::StreamStats &out)
+	{
+		stream.lockStream();
+
+		ALStream &s = stream.stream;
+
+		out.underruns = s.underruns;
+		out.queued = s.queuedBufs;
+		out.queueTarget = s.queueTarget;
+		out.decoded = s.decodedBufs.size();
+		out.decodeTarget = SDL_AtomicGet(&s.decodeTarget);
+
+		stream.unlockStream();
+	}
+
+	void updateMeWatch(uint32_t elapsedMs)
+	{
+		const float fadeOutStep = elapsedMs / 200.f;
+		const float fadeInStep  = elapsedMs / 1000.f;
+
+		switch (meWatch.state)
+		{
+		case MeNotPlaying:
+		{
+			me.lockStream();
+
+			if (me.stream.queryState() == ALStream::Playing)
 			{
-				me.lockStream();
+				/* ME playing detected. -> FadeOutBGM */
+				bgm.extPaused = true;
+				meWatch.state = BgmFadingOut;
+			}
 
-				if (me.stream.queryState() != ALStream::Playing)
-				{
-					/* ME has ended */
-					bgm.lockStream();
+			me.unlockStream();
 
-					bgm.extPaused = false;
+			break;
+		}
 
-					ALStream::State sState = bgm.stream.queryState();
+		case BgmFadingOut :
+		{
+			me.lockStream();
 
-					if (sState == ALStream::Paused)
-					{
-						/* BGM is paused. -> FadeInBGM */
-						bgm.stream.play();
-						meWatch.state = BgmFadingIn;
-					}
-					else
-					{
-						/* BGM is stopped. -> MeNotPlaying */
-						bgm.setVolume(AudioStream::External, 1.0f);
+			if (me.stream.queryState() != ALStream::Playing)
+			{
+				/* ME has ended while fading OUT BGM. -> FadeInBGM */
+				me.unlockStream();
+				meWatch.state = BgmFadingIn;
 
-						if (!bgm.noResumeStop)
-							bgm.stream.play();
+				break;
+			}
 
-						meWatch.state = MeNotPlaying;
-					}
+			bgm.lockStream();
 
-					bgm.unlockStream();
-				}
+			float vol = bgm.getVolume(AudioStream::External);
+			vol -= fadeOutStep;
 
+			if (vol < 0 || bgm.stream.queryState() != ALStream::Playing)
+			{
+				/* Either BGM has fully faded out, or stopped midway. -> MePlaying */
+				bgm.setVolume(AudioStream::External, 0);
+				bgm.stream.pause();
+				meWatch.state = MePlaying;
+				bgm.unlockStream();
 				me.unlockStream();
 
 				break;
 			}
 
-			case BgmFadingIn :
+			bgm.setVolume(AudioStream::External, vol);
+			bgm.unlockStream();
+			me.unlockStream();
+
+			break;
+		}
+
+		case MePlaying :
+		{
+			me.lockStream();
+
+			if (me.stream.queryState() != ALStream::Playing)
 			{
+				/* ME has ended */
 				bgm.lockStream();
 
-				if (bgm.stream.queryState() == ALStream::Stopped)
+				bgm.extPaused = false;
+
+				ALStream::State sState = bgm.stream.queryState();
+
+				if (sState == ALStream::Paused)
 				{
-					/* BGM stopped midway fade in. -> MeNotPlaying */
+					/* BGM is paused. -> FadeInBGM */
+					bgm.stream.play();
+					meWatch.state = BgmFadingIn;
+				}
+				else
+				{
+					/* BGM is stopped. -> MeNotPlaying */
 					bgm.setVolume(AudioStream::External, 1.0f);
-					meWatch.state = MeNotPlaying;
-					bgm.unlockStream();
 
-					break;
+					if (!bgm.noResumeStop)
+						bgm.stream.play();
+
+					meWatch.state = MeNotPlaying;
 				}
 
-				me.lockStream();
+				bgm.unlockStream();
+			}
 
-				if (me.stream.queryState() == ALStream::Playing)
-				{
-					/* ME started playing midway BGM fade in. -> FadeOutBGM */
-					bgm.extPaused = true;
-					meWatch.state = BgmFadingOut;
-					me.unlockStream();
-					bgm.unlockStream();
+			me.unlockStream();
 
-					break;
-				}
+			break;
+		}
 
-				float vol = bgm.getVolume(AudioStream::External);
-				vol += fadeInStep;
+		case BgmFadingIn :
+		{
+			bgm.lockStream();
 
-				if (vol >= 1)
-				{
-					/* BGM fully faded in. -> MeNotPlaying */
-					vol = 1.0f;
-					meWatch.state = MeNotPlaying;
-				}
+			if (bgm.stream.queryState() == ALStream::Stopped)
+			{
+				/* BGM stopped midway fade in. -> MeNotPlaying */
+				bgm.setVolume(AudioStream::External, 1.0f);
+				meWatch.state = MeNotPlaying;
+				bgm.unlockStream();
+
+				break;
+			}
 
-				bgm.setVolume(AudioStream::External, vol);
+			me.lockStream();
 
+			if (me.stream.queryState() == ALStream::Playing)
+			{
+				/* ME started playing midway BGM fade in. -> FadeOutBGM */
+				bgm.extPaused = true;
+				meWatch.state = BgmFadingOut;
 				me.unlockStream();
 				bgm.unlockStream();
 
 				break;
 			}
+
+			float vol = bgm.getVolume(AudioStream::External);
+			vol += fadeInStep;
+
+			if (vol >= 1)
+			{
+				/* BGM fully faded in. -> MeNotPlaying */
+				vol = 1.0f;
+				meWatch.state = MeNotPlaying;
 			}
 
-			SDL_Delay(AUDIO_SLEEP);
+			bgm.setVolume(AudioStream::External, vol);
+
+			me.unlockStream();
+			bgm.unlockStream();
+
+			break;
+		}
 		}
 	}
 };
@@ -260,6 +455,11 @@ void Audio::bgmFade(int time)
 	p->bgm.fadeOut(time);
 }
 
+void Audio::bgmPreload(const char *filename)
+{
+	p->preloadStream(filename);
+}
+
 
 void Audio::bgsPlay(const char *filename,
                     int volume,
@@ -310,6 +510,26 @@ void Audio::seStop()
 	p->se.stop();
 }
 
+void Audio::sePreload(const char *filename)
+{
+	p->se.preload(filename);
+}
+
+void Audio::sePin(const char *filename)
+{
+	p->se.pin(filename);
+}
+
+void Audio::seUnpin(const char *filename)
+{
+	p->se.unpin(filename);
+}
+
+void Audio::getSECacheStats(SECacheStats &out)
+{
+	p->se.getCacheStats(out);
+}
+
 void Audio::setupMidi()
 {
 	shState->midiState().initIfNeeded(shState->config());
@@ -325,6 +545,20 @@ float Audio::bgsPos()
 	return p->bgs.playingOffset();
 }
 
+void Audio::getStreamStats(StreamStats &bgm,
+                           StreamStats &bgs,
+                           StreamStats &me)
+{
+	p->getStats(p->bgm, bgm);
+	p->getStats(p->bgs, bgs);
+	p->getStats(p->me, me);
+}
+
+void Audio::schedulerStep()
+{
+	p->schedulerStep();
+}
+
 void Audio::reset()
 {
 	p->bgm.stop();
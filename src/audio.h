@@ -32,6 +32,8 @@
  *   integers that _look_ like sample offsets but I can't
  *   quite make out their meaning yet) */
 
+#include <stdint.h>
+
 struct AudioPrivate;
 struct RGSSThreadData;
 
@@ -45,6 +47,10 @@ public:
 	void bgmStop();
 	void bgmFade(int time);
 
+	/* Decodes the beginning of a track (to be played as
+	 * BGM, BGS or ME) ahead of time, so it starts instantly */
+	void bgmPreload(const char *filename);
+
 	void bgsPlay(const char *filename,
 	             int volume = 100,
 	             int pitch = 100,
@@ -62,13 +68,62 @@ public:
 	            int volume = 100,
 	            int pitch = 100);
 	void seStop();
+	void sePreload(const char *filename);
+
+	/* Pinned sound effects are kept cached until unpinned */
+	void sePin(const char *filename);
+	void seUnpin(const char *filename);
+
+	struct SECacheStats
+	{
+		/* Bytes of decoded data cached, and the limit */
+		uint32_t bytes;
+		uint32_t budget;
+
+		/* Cached sounds, and how many of those are pinned */
+		uint32_t buffers;
+		uint32_t pinned;
+
+		/* Sounds still being decoded (not counted above) */
+		uint32_t pending;
+
+		/* Requests served from the cache / that needed
+		 * decoding, and sounds evicted to make room */
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t evictions;
+	};
+
+	void getSECacheStats(SECacheStats &out);
 
 	void setupMidi();
 	float bgmPos();
 	float bgsPos();
 
+	struct StreamStats
+	{
+		/* Times the stream ran dry and had to be restarted */
+		uint32_t underruns;
+
+		/* Buffers queued for playback / decoded ahead,
+		 * and the current targets for both */
+		uint32_t queued;
+		uint32_t queueTarget;
+		uint32_t decoded;
+		uint32_t decodeTarget;
+	};
+
+	void getStreamStats(StreamStats &bgm,
+	                    StreamStats &bgs,
+	                    StreamStats &me);
+
 	void reset();
 
+	/* Services all streams and sounds once. Called every frame
+	 * by a rendering headless device, in place of the scheduler
+	 * thread (see HeadlessAudio) */
+	void schedulerStep();
+
 private:
 	Audio(RGSSThreadData &rtData);
 	~Audio();
@@ -23,16 +23,17 @@
 
 #include "util.h"
 #include "exception.h"
+#include "headlessaudio.h"
 
 #include <SDL_mutex.h>
-#include <SDL_thread.h>
-#include <SDL_timer.h>
 
 AudioStream::AudioStream(ALStream::LoopMode loopMode,
-                         const std::string &threadId)
+                         SDL_sem *wakeSem,
+                         StreamHeadCache *headCache)
 	: extPaused(false),
 	  noResumeStop(false),
-	  stream(loopMode, threadId)
+	  stream(loopMode, headCache),
+	  wakeSem(wakeSem)
 {
 	current.volume = 1.0f;
 	current.pitch = 1.0f;
@@ -40,29 +41,14 @@ AudioStream::AudioStream(ALStream::LoopMode loopMode,
 	for (size_t i = 0; i < VolumeTypeCount; ++i)
 		volumes[i] = 1.0f;
 
-	fade.thread = 0;
-	fade.threadName = std::string("audio_fadeout (") + threadId + ")";
-
-	fadeIn.thread = 0;
-	fadeIn.threadName = std::string("audio_fadein (") + threadId + ")";
+	fade.active = false;
+	fadeIn.active = false;
 
 	streamMut = SDL_CreateMutex();
 }
 
 AudioStream::~AudioStream()
 {
-	if (fade.thread)
-	{
-		fade.reqTerm.set();
-		SDL_WaitThread(fade.thread, 0);
-	}
-
-	if (fadeIn.thread)
-	{
-		fadeIn.rqTerm.set();
-		SDL_WaitThread(fadeIn.thread, 0);
-	}
-
 	lockStream();
 
 	stream.stop();
@@ -78,10 +64,10 @@ void AudioStream::play(const std::string &filename,
                        int pitch,
                        float offset)
 {
-	finiFadeOutInt();
-
 	lockStream();
 
+	finiFadeOutInt();
+
 	float _volume = clamp<int>(volume, 0, 100) / 100.0f;
 	float _pitch  = clamp<int>(pitch, 50, 150) / 100.0f;
 
@@ -159,14 +145,16 @@ void AudioStream::play(const std::string &filename,
 		noResumeStop = false;
 
 	unlockStream();
+
+	SDL_SemPost(wakeSem);
 }
 
 void AudioStream::stop()
 {
-	finiFadeOutInt();
-
 	lockStream();
 
+	finiFadeOutInt();
+
 	noResumeStop = true;
 
 	stream.stop();
@@ -203,23 +191,13 @@ void AudioStream::fadeOut(int duration)
 		return;
 	}
 
-	if (fade.thread)
-	{
-		fade.reqFini.set();
-		SDL_WaitThread(fade.thread, 0);
-		fade.thread = 0;
-	}
-
-	fade.active.set();
+	fade.active = true;
 	fade.msStep = 1.0f / duration;
-	fade.reqFini.clear();
-	fade.reqTerm.clear();
-	fade.startTicks = SDL_GetTicks();
-
-	fade.thread = createSDLThread
-		<AudioStream, &AudioStream::fadeOutThread>(this, fade.threadName);
+	fade.startTicks = audioTicks();
 
 	unlockStream();
+
+	SDL_SemPost(wakeSem);
 }
 
 /* Any access to this classes 'stream' member,
@@ -261,105 +239,82 @@ void AudioStream::updateVolume()
 	stream.setVolume(vol);
 }
 
+bool AudioStream::update()
+{
+	if (fade.active)
+		updateFadeOut();
+
+	if (fadeIn.active)
+		updateFadeIn();
+
+	bool streaming = stream.update();
+
+	return streaming || fade.active || fadeIn.active;
+}
+
+/* Must be called with the stream lock held */
 void AudioStream::finiFadeOutInt()
 {
-	if (fade.thread)
+	if (fade.active)
 	{
-		fade.reqFini.set();
-		SDL_WaitThread(fade.thread, 0);
-		fade.thread = 0;
+		if (stream.queryState() != ALStream::Paused)
+			stream.stop();
+
+		setVolume(FadeOut, 1.0f);
+		fade.active = false;
 	}
 
-	if (fadeIn.thread)
+	if (fadeIn.active)
 	{
-		fadeIn.rqFini.set();
-		SDL_WaitThread(fadeIn.thread, 0);
-		fadeIn.thread = 0;
+		setVolume(FadeIn, 1.0f);
+		fadeIn.active = false;
 	}
 }
 
 void AudioStream::startFadeIn()
 {
-	/* Previous fadein should always be terminated in play() */
-	assert(!fadeIn.thread);
-
-	fadeIn.rqFini.clear();
-	fadeIn.rqTerm.clear();
-	fadeIn.startTicks = SDL_GetTicks();
-
-	fadeIn.thread = createSDLThread
-		<AudioStream, &AudioStream::fadeInThread>(this, fadeIn.threadName);
+	fadeIn.active = true;
+	fadeIn.startTicks = audioTicks();
 }
 
-void AudioStream::fadeOutThread()
+void AudioStream::updateFadeOut()
 {
-	while (true)
-	{
-		/* Just immediately terminate on request */
-		if (fade.reqTerm)
-			break;
-
-		lockStream();
-
-		uint32_t curDur = SDL_GetTicks() - fade.startTicks;
-		float resVol = 1.0f - (curDur*fade.msStep);
+	uint32_t curDur = audioTicks() - fade.startTicks;
+	float resVol = 1.0f - (curDur*fade.msStep);
 
-		ALStream::State state = stream.queryState();
+	ALStream::State state = stream.queryState();
 
-		if (state != ALStream::Playing
-		|| resVol < 0
-		|| fade.reqFini)
-		{
-			if (state != ALStream::Paused)
-				stream.stop();
-
-			setVolume(FadeOut, 1.0f);
-			unlockStream();
-
-			break;
-		}
-
-		setVolume(FadeOut, resVol);
+	if (state != ALStream::Playing || resVol < 0)
+	{
+		if (state != ALStream::Paused)
+			stream.stop();
 
-		unlockStream();
+		setVolume(FadeOut, 1.0f);
+		fade.active = false;
 
-		SDL_Delay(AUDIO_SLEEP);
+		return;
 	}
 
-	fade.active.clear();
+	setVolume(FadeOut, resVol);
 }
 
-void AudioStream::fadeInThread()
+void AudioStream::updateFadeIn()
 {
-	while (true)
-	{
-		if (fadeIn.rqTerm)
-			break;
-
-		lockStream();
-
-		/* Fade in duration is always 1 second */
-		uint32_t cur = SDL_GetTicks() - fadeIn.startTicks;
-		float prog = cur / 1000.0f;
+	/* Fade in duration is always 1 second */
+	uint32_t cur = audioTicks() - fadeIn.startTicks;
+	float prog = cur / 1000.0f;
 
-		ALStream::State state = stream.queryState();
+	ALStream::State state = stream.queryState();
 
-		if (state != ALStream::Playing
-		||  prog >= 1.0f
-		||  fadeIn.rqFini)
-		{
-			setVolume(FadeIn, 1.0f);
-			unlockStream();
-
-			break;
-		}
-
-		/* Quadratic increase (not really the same as
-		 * in RMVXA, but close enough) */
-		setVolume(FadeIn, prog*prog);
-
-		unlockStream();
+	if (state != ALStream::Playing || prog >= 1.0f)
+	{
+		setVolume(FadeIn, 1.0f);
+		fadeIn.active = false;
 
-		SDL_Delay(AUDIO_SLEEP);
+		return;
 	}
+
+	/* Quadratic increase (not really the same as
+	 * in RMVXA, but close enough) */
+	setVolume(FadeIn, prog*prog);
 }
@@ -27,6 +27,7 @@
 #include "sdl-util.h"
 
 #include <string>
+#include <SDL_mutex.h>
 
 struct AudioStream
 {
@@ -37,7 +38,7 @@ struct AudioStream
 		float pitch;
 	} current;
 
-	/* Volumes set by external threads,
+	/* Volumes set by the audio scheduler,
 	 * such as for fade-in/out.
 	 * Multiplied together for final
 	 * playback volume. Used with setVolume().
@@ -81,22 +82,15 @@ struct AudioStream
 	ALStream stream;
 	SDL_mutex *streamMut;
 
+	/* Posted to wake up the audio scheduler
+	 * when there is new work for it */
+	SDL_sem *wakeSem;
+
 	/* Fade out */
 	struct
 	{
 		/* Fade out is in progress */
-		AtomicFlag active;
-
-		/* Request fade thread to finish and
-		 * cleanup (like it normally would) */
-		AtomicFlag reqFini;
-
-		/* Request fade thread to terminate
-		 * immediately */
-		AtomicFlag reqTerm;
-
-		SDL_Thread *thread;
-		std::string threadName;
+		bool active;
 
 		/* Amount of reduced absolute volume
 		 * per ms of fade time */
@@ -109,17 +103,14 @@ struct AudioStream
 	/* Fade in */
 	struct
 	{
-		AtomicFlag rqFini;
-		AtomicFlag rqTerm;
-
-		SDL_Thread *thread;
-		std::string threadName;
+		bool active;
 
 		uint32_t startTicks;
 	} fadeIn;
 
 	AudioStream(ALStream::LoopMode loopMode,
-	            const std::string &threadId);
+	            SDL_sem *wakeSem,
+	            StreamHeadCache *headCache);
 	~AudioStream();
 
 	void play(const std::string &filename,
@@ -140,6 +131,11 @@ struct AudioStream
 
 	float playingOffset();
 
+	/* Called by the audio scheduler with the stream lock held.
+	 * Advances fades and keeps the stream fed. Returns true
+	 * while there is ongoing work */
+	bool update();
+
 private:
 	float volumes[VolumeTypeCount];
 	void updateVolume();
@@ -147,8 +143,8 @@ private:
 	void finiFadeOutInt();
 	void startFadeIn();
 
-	void fadeOutThread();
-	void fadeInThread();
+	void updateFadeOut();
+	void updateFadeIn();
 };
 
 #endif // AUDIOSTREAM_H
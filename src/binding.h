@@ -22,6 +22,8 @@
 #ifndef BINDING_H
 #define BINDING_H
 
+#include <stdint.h>
+
 struct ScriptBinding
 {
 	/* Starts the part where the binding takes over,
@@ -39,6 +41,11 @@ struct ScriptBinding
 	/* Instructs the binding to issue a game reset.
 	 * Same conditions as for terminate apply */
 	void (*reset) (void);
+
+	/* Called at the end of every frame, with the time (in
+	 * microseconds) left until the next one is due. The binding
+	 * may use it for housekeeping like garbage collection */
+	void (*frameIdle) (int64_t idleUs);
 };
 
 /* VTable defined in the binding source */
@@ -74,6 +74,11 @@ static IntRect normalizedRect(const IntRect &rect)
 	return norm;
 }
 
+/* Bitmaps with recorded operations that haven't been executed
+ * yet. These are flushed before the scene is rendered, so that
+ * the render pass only ever reads up to date textures */
+static IntruList<Bitmap> pendingBatches;
+
 struct BitmapPrivate
 {
 	Bitmap *self;
@@ -102,10 +107,43 @@ struct BitmapPrivate
 	 * ourselves the expensive blending calculation */
 	pixman_region16_t tainted;
 
+	/* Operations recorded while batching */
+	struct BatchOp
+	{
+		enum Type
+		{
+			Blt,
+			Fill,
+			Clear
+		};
+
+		Type type;
+
+		/* Source rect (blt) or destination rect (fill, clear) */
+		IntRect rect;
+
+		/* Blt only (the source is the bitmap itself) */
+		Vec2i pos;
+		int opacity;
+
+		/* Fill only */
+		Vec4 color;
+	};
+
+	std::vector<BatchOp> batchOps;
+	int batchDepth;
+	bool batchModified;
+
+	/* Linked into 'pendingBatches' while 'batchOps' isn't empty */
+	IntruListLink<Bitmap> batchLink;
+
 	BitmapPrivate(Bitmap *self)
 	    : self(self),
 	      megaSurface(0),
-	      surface(0)
+	      surface(0),
+	      batchDepth(0),
+	      batchModified(false),
+	      batchLink(self)
 	{
 		format = SDL_AllocFormat(SDL_PIXELFORMAT_ABGR8888);
 
@@ -229,8 +267,22 @@ struct BitmapPrivate
 			surface = 0;
 		}
 
+		if (batchDepth > 0)
+		{
+			batchModified = true;
+			return;
+		}
+
 		self->modified();
 	}
+
+	void recordOp(const BatchOp &op)
+	{
+		if (batchOps.empty())
+			pendingBatches.append(batchLink);
+
+		batchOps.push_back(op);
+	}
 };
 
 struct BitmapOpenHandler : FileSystem::OpenHandler
@@ -354,6 +406,24 @@ void Bitmap::blt(int x, int y,
                   const Bitmap &source, IntRect rect,
                   int opacity)
 {
+	/* Blits from other bitmaps run immediately (after the pending
+	 * operations), as the source might change before the batch ends */
+	if (p->batchDepth > 0 && &source == this)
+	{
+		guardDisposed();
+
+		GUARD_MEGA;
+
+		BitmapPrivate::BatchOp op;
+		op.type = BitmapPrivate::BatchOp::Blt;
+		op.rect = rect;
+		op.pos = Vec2i(x, y);
+		op.opacity = opacity;
+		p->recordOp(op);
+
+		return;
+	}
+
 	if (source.isDisposed())
 		return;
 
@@ -384,6 +454,11 @@ void Bitmap::stretchBlt(const IntRect &destRect,
 	if (source.isDisposed())
 		return;
 
+	flushBatch();
+
+	if (&source != this)
+		source.flushBatch();
+
 	opacity = clamp(opacity, 0, 255);
 
 	if (opacity == 0)
@@ -530,6 +605,17 @@ void Bitmap::fillRect(const IntRect &rect, const Vec4 &color)
 
 	GUARD_MEGA;
 
+	if (p->batchDepth > 0)
+	{
+		BitmapPrivate::BatchOp op;
+		op.type = BitmapPrivate::BatchOp::Fill;
+		op.rect = rect;
+		op.color = color;
+		p->recordOp(op);
+
+		return;
+	}
+
 	p->fillRect(rect, color);
 
 	if (color.w == 0)
@@ -558,6 +644,8 @@ void Bitmap::gradientFillRect(const IntRect &rect,
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	SimpleColorShader &shader = shState->shaders().simpleColor;
 	shader.bind();
 	shader.setTranslation(Vec2i());
@@ -604,6 +692,17 @@ void Bitmap::clearRect(const IntRect &rect)
 
 	GUARD_MEGA;
 
+	if (p->batchDepth > 0)
+	{
+		BitmapPrivate::BatchOp op;
+		op.type = BitmapPrivate::BatchOp::Clear;
+		op.rect = rect;
+		op.color = Vec4();
+		p->recordOp(op);
+
+		return;
+	}
+
 	p->fillRect(rect, Vec4());
 
 	p->onModified();
@@ -615,6 +714,8 @@ void Bitmap::blur()
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	Quad &quad = shState->gpQuad();
 	FloatRect rect(0, 0, width(), height());
 	quad.setTexPosRect(rect, rect);
@@ -660,6 +761,8 @@ void Bitmap::radialBlur(int angle, int divisions)
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	angle     = clamp<int>(angle, 0, 359);
 	divisions = clamp<int>(divisions, 2, 100);
 
@@ -755,6 +858,8 @@ void Bitmap::clear()
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	p->bindFBO();
 
 	glState.clearColor.pushSet(Vec4());
@@ -782,6 +887,8 @@ Color Bitmap::getPixel(int x, int y) const
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	if (x < 0 || y < 0 || x >= width() || y >= height())
 		return Vec4();
 
@@ -812,6 +919,8 @@ void Bitmap::setPixel(int x, int y, const Color &color)
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	uint8_t pixel[] =
 	{
 		(uint8_t) clamp<double>(color.red,   0, 255),
@@ -843,6 +952,8 @@ void Bitmap::hueChange(int hue)
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	if ((hue % 360) == 0)
 		return;
 
@@ -990,6 +1101,8 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
 
 	GUARD_MEGA;
 
+	flushBatch();
+
 	std::string fixed = fixupString(str);
 	str = fixed.c_str();
 
@@ -1311,8 +1424,152 @@ void Bitmap::taintArea(const IntRect &rect)
 	p->addTaintedArea(rect);
 }
 
+void Bitmap::beginBatch()
+{
+	guardDisposed();
+
+	++p->batchDepth;
+}
+
+void Bitmap::endBatch()
+{
+	/* The bitmap might have been disposed inside the batch */
+	if (isDisposed() || p->batchDepth == 0)
+		return;
+
+	if (--p->batchDepth > 0)
+		return;
+
+	flushBatch();
+
+	if (p->batchModified)
+	{
+		p->batchModified = false;
+		modified();
+	}
+}
+
+void Bitmap::flushBatch() const
+{
+	if (p->batchOps.empty())
+		return;
+
+	typedef BitmapPrivate::BatchOp BatchOp;
+
+	std::vector<BatchOp> ops;
+	ops.swap(p->batchOps);
+	pendingBatches.remove(p->batchLink);
+
+	/* Runs of consecutive fast blits / fills share their setup */
+	bool blitting = false;
+	bool filling = false;
+
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+		const BatchOp &op = ops[i];
+
+		if (op.type == BatchOp::Blt)
+		{
+			IntRect rect = op.rect;
+
+			if (rect.x + rect.w > width())
+				rect.w = width() - rect.x;
+
+			if (rect.y + rect.h > height())
+				rect.h = height() - rect.y;
+
+			IntRect destRect(op.pos.x, op.pos.y, rect.w, rect.h);
+
+			bool fast = clamp(op.opacity, 0, 255) == 255
+			         && !p->touchesTaintedArea(destRect);
+
+			if (filling)
+			{
+				glState.clearColor.pop();
+				glState.scissorBox.pop();
+				glState.scissorTest.pop();
+				filling = false;
+			}
+
+			if (!fast)
+			{
+				if (blitting)
+				{
+					GLMeta::blitEnd();
+					blitting = false;
+				}
+
+				p->self->stretchBlt(destRect, *this, rect, op.opacity);
+				continue;
+			}
+
+			if (!blitting)
+			{
+				GLMeta::blitBegin(p->gl);
+				GLMeta::blitSource(p->gl);
+				blitting = true;
+			}
+
+			GLMeta::blitRectangle(rect, destRect);
+
+			p->addTaintedArea(destRect);
+		}
+		else
+		{
+			if (blitting)
+			{
+				GLMeta::blitEnd();
+				blitting = false;
+			}
+
+			if (!filling)
+			{
+				p->bindFBO();
+
+				glState.scissorTest.pushSet(true);
+				glState.scissorBox.push();
+				glState.clearColor.push();
+				filling = true;
+			}
+
+			glState.scissorBox.set(normalizedRect(op.rect));
+			glState.clearColor.set(op.color);
+
+			FBO::clear();
+
+			if (op.type == BatchOp::Fill)
+			{
+				if (op.color.w == 0)
+					p->substractTaintedArea(op.rect);
+				else
+					p->addTaintedArea(op.rect);
+			}
+		}
+	}
+
+	if (blitting)
+		GLMeta::blitEnd();
+
+	if (filling)
+	{
+		glState.clearColor.pop();
+		glState.scissorBox.pop();
+		glState.scissorTest.pop();
+	}
+
+	p->onModified();
+}
+
+void Bitmap::flushPendingBatches()
+{
+	while (!pendingBatches.isEmpty())
+		pendingBatches.begin()->data->flushBatch();
+}
+
 void Bitmap::releaseResources()
 {
+	pendingBatches.remove(p->batchLink);
+
 	if (p->megaSurface)
 		SDL_FreeSurface(p->megaSurface);
 	else
@@ -99,6 +99,15 @@ public:
 
 	IntRect textSize(const char *str);
 
+	/* Between these, 'fillRect', 'clearRect' and 'blt' calls with
+	 * the bitmap itself as source are only recorded, and executed
+	 * in one pass (sharing GL state between consecutive operations
+	 * of the same kind) when the outermost batch ends, or earlier
+	 * whenever the contents are needed. 'modified' is emitted
+	 * once at the end. Nestable */
+	void beginBatch();
+	void endBatch();
+
 	DECL_ATTR(Font, Font&)
 
 	/* Sets initial reference without copying by value,
@@ -117,9 +126,15 @@ public:
 	/* Adds 'rect' to tainted area */
 	void taintArea(const IntRect &rect);
 
+	/* Executes the recorded operations of all batching
+	 * bitmaps; must be called before rendering the scene */
+	static void flushPendingBatches();
+
 	sigc::signal<void> modified;
 
 private:
+	void flushBatch() const;
+
 	void releaseResources();
 	const char *klassName() const { return "bitmap"; }
 
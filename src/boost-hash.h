@@ -83,6 +83,11 @@ public:
 		return p[key];
 	}
 
+	inline size_t size() const
+	{
+		return p.size();
+	}
+
 	inline const_iterator cbegin() const
 	{
 		return p.cbegin();
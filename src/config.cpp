@@ -178,13 +178,25 @@ void Config::read(int argc, char *argv[])
 	PO_DESC(iconPath, std::string, "") \
 	PO_DESC(execName, std::string, "Game") \
 	PO_DESC(titleLanguage, std::string, "") \
+	PO_DESC(headlessAudio, bool, false) \
+	PO_DESC(headlessAudioDump, std::string, "") \
 	PO_DESC(midi.soundFont, std::string, "") \
 	PO_DESC(midi.chorus, bool, false) \
 	PO_DESC(midi.reverb, bool, false) \
+	PO_DESC(midi.prerender, bool, false) \
+	PO_DESC(midi.prerenderCacheSize, int, 256) \
 	PO_DESC(SE.sourceCount, int, 6) \
+	PO_DESC(SE.maxLatency, int, 0) \
+	PO_DESC(SE.cacheSize, int, 10) \
 	PO_DESC(customScript, std::string, "") \
 	PO_DESC(pathCache, bool, true) \
-	PO_DESC(useScriptNames, bool, false)
+	PO_DESC(archiveCacheSize, int, 16) \
+	PO_DESC(loadDataCacheCopy, bool, false) \
+	PO_DESC(useScriptNames, bool, false) \
+	PO_DESC(scriptCache, bool, false) \
+	PO_DESC(frameGC, bool, false) \
+	PO_DESC(scriptProfile, std::string, "") \
+	PO_DESC(scriptProfileInterval, int, 1)
 
 // Not gonna take your shit boost
 #define GUARD_ALL( exp ) try { exp } catch(...) {}
@@ -216,6 +228,7 @@ void Config::read(int argc, char *argv[])
 	podesc.add_options()
 	        PO_DESC_ALL
 	        ("preloadScript", po::value<StringVec>()->composing())
+	        ("loadDataCache", po::value<StringVec>()->composing())
 	        ("RTP", po::value<StringVec>()->composing())
 	        ("fontSub", po::value<StringVec>()->composing())
 	        ("rubyLoadpath", po::value<StringVec>()->composing())
@@ -258,6 +271,8 @@ void Config::read(int argc, char *argv[])
 
 	GUARD_ALL( preloadScripts = setFromVec(vm["preloadScript"].as<StringVec>()); );
 
+	GUARD_ALL( loadDataCache = setFromVec(vm["loadDataCache"].as<StringVec>()); );
+
 	GUARD_ALL( rtps = vm["RTP"].as<StringVec>(); );
 
 	GUARD_ALL( fontSubs = vm["fontSub"].as<StringVec>(); );
@@ -270,6 +285,10 @@ void Config::read(int argc, char *argv[])
 	rgssVersion = clamp(rgssVersion, 0, 3);
 
 	SE.sourceCount = clamp(SE.sourceCount, 1, 64);
+	SE.maxLatency = clamp(SE.maxLatency, 0, 10000);
+	SE.cacheSize = clamp(SE.cacheSize, 0, 1024);
+
+	archiveCacheSize = clamp(archiveCacheSize, 0, 1024);
 
 	if (!dataPathOrg.empty() && !dataPathApp.empty())
 		customDataPath = prefPath(dataPathOrg.c_str(), dataPathApp.c_str());
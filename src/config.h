@@ -58,6 +58,7 @@ struct Config
 	bool enableReset;
 	bool allowSymlinks;
 	bool pathCache;
+	int archiveCacheSize;
 
 	std::string dataPathOrg;
 	std::string dataPathApp;
@@ -66,22 +67,44 @@ struct Config
 	std::string execName;
 	std::string titleLanguage;
 
+	/* Output to a headless device pumped once per frame */
+	bool headlessAudio;
+	std::string headlessAudioDump;
+
 	struct
 	{
 		std::string soundFont;
 		bool chorus;
 		bool reverb;
+		bool prerender;
+		int prerenderCacheSize;
 	} midi;
 
 	struct
 	{
 		int sourceCount;
+		int maxLatency;
+		int cacheSize;
 	} SE;
 
 	bool useScriptNames;
 
+	/* Keep compiled script sections on disk */
+	bool scriptCache;
+
+	/* Run Ruby's GC between frames only */
+	bool frameGC;
+
+	/* Sample the script stack, writing it to 'scriptProfile' on exit */
+	std::string scriptProfile;
+	int scriptProfileInterval;
+
 	std::string customScript;
 	std::set<std::string> preloadScripts;
+
+	/* Files whose 'load_data()' results are memoized */
+	std::set<std::string> loadDataCache;
+	bool loadDataCacheCopy;
 	std::vector<std::string> rtps;
 
 	std::vector<std::string> fontSubs;
@@ -23,10 +23,47 @@
 
 #include "serial-util.h"
 #include "exception.h"
+#include "slab-pool.h"
+#include "perfstats.h"
 
 #include <SDL_types.h>
 #include <SDL_pixels.h>
 
+/* Scripts create these by the thousands (every 'Rect.new',
+ * 'Bitmap#get_pixel', property wrapper...), and they're all
+ * the same size, so they bypass the general purpose heap.
+ * Only ever allocated / freed on the RGSS thread */
+static SlabPool<sizeof(Color)> colorPool;
+static SlabPool<sizeof(Tone)>  tonePool;
+static SlabPool<sizeof(Rect)>  rectPool;
+
+#define DEF_POOLED_ALLOC(Klass, pool) \
+	void *Klass::operator new(size_t size) \
+	{ \
+		PERF_COUNT(etcAllocs, 1); \
+		if (size != sizeof(Klass)) \
+			return ::operator new(size); \
+		return pool.alloc(); \
+	} \
+	void Klass::operator delete(void *p, size_t size) \
+	{ \
+		if (size != sizeof(Klass)) \
+			::operator delete(p); \
+		else \
+			pool.release(p); \
+	}
+
+DEF_POOLED_ALLOC(Color, colorPool)
+DEF_POOLED_ALLOC(Tone, tonePool)
+DEF_POOLED_ALLOC(Rect, rectPool)
+
+void etcPoolGetStats(EtcPoolStats &out)
+{
+	out.live = colorPool.live + tonePool.live + rectPool.live;
+	out.capacity = colorPool.capacity + tonePool.capacity + rectPool.capacity;
+	out.bytes = colorPool.bytes() + tonePool.bytes() + rectPool.bytes();
+}
+
 Color::Color(double red, double green, double blue, double alpha)
 	: red(red), green(green), blue(blue), alpha(alpha)
 {
@@ -24,6 +24,9 @@
 
 #include <sigc++/signal.h>
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "serializable.h"
 #include "etc-internal.h"
 
@@ -50,6 +53,10 @@ struct Color : public Serializable
 
 	virtual ~Color() {}
 
+	/* Allocated from a slab pool (see etc.cpp) */
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
 	const Color &operator=(const Color &o);
 	void set(double red, double green, double blue, double alpha);
 
@@ -102,6 +109,9 @@ struct Tone : public Serializable
 
 	virtual ~Tone() {}
 
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
 	bool operator==(const Tone &o) const;
 
 	void set(double red, double green, double blue, double gray);
@@ -154,6 +164,9 @@ struct Rect : public Serializable
 
 	virtual ~Rect() {}
 
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
 	Rect(int x, int y, int width, int height);
 	Rect(const Rect &o);
 	Rect(const IntRect &r);
@@ -200,6 +213,17 @@ struct Rect : public Serializable
 	sigc::signal<void> valueChanged;
 };
 
+struct EtcPoolStats
+{
+	/* Color, Tone and Rect objects allocated
+	 * from the pools / slots they have room for */
+	uint32_t live;
+	uint32_t capacity;
+	size_t bytes;
+};
+
+void etcPoolGetStats(EtcPoolStats &out);
+
 /* For internal use.
  * All drawable classes have properties of one or more of the above
  * types, which in an interpreted environment act as independent
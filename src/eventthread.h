@@ -38,6 +38,7 @@
 
 struct RGSSThreadData;
 typedef struct ALCdevice_struct ALCdevice;
+class HeadlessAudio;
 struct SDL_Window;
 union SDL_Event;
 
@@ -238,6 +239,9 @@ struct RGSSThreadData
 	SDL_Window *window;
 	ALCdevice *alcDev;
 
+	/* Set if 'alcDev' is a headless device */
+	HeadlessAudio *headlessAudio;
+
 	Vec2 sizeResoRatio;
 	Vec2i screenOffset;
 	const int refreshRate;
@@ -256,6 +260,7 @@ struct RGSSThreadData
 	      argv0(argv0),
 	      window(window),
 	      alcDev(alcDev),
+	      headlessAudio(0),
 	      sizeResoRatio(1, 1),
 	      refreshRate(refreshRate),
 	      config(newconf)
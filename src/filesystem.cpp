@@ -22,27 +22,45 @@
 #include "filesystem.h"
 
 #include "rgssad.h"
+#include "mkxppack.h"
 #include "font.h"
 #include "util.h"
 #include "exception.h"
 #include "sharedstate.h"
 #include "boost-hash.h"
 #include "debugwriter.h"
+#include "sdl-util.h"
 
 #include <physfs.h>
 
 #include <SDL_sound.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
 #include <vector>
 #include <stack>
+#include <deque>
 
 #ifdef __APPLE__
 #include <iconv.h>
 #endif
 
+#ifdef __WINDOWS__
+#include <windows.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#endif
+
+#include <errno.h>
+
 struct SDLRWIoContext
 {
 	SDL_RWops *ops;
@@ -297,6 +315,437 @@ static void strTolower(std::string &str)
 
 const Uint32 SDL_RWOPS_PHYSFS = SDL_RWOPS_UNKNOWN+10;
 
+struct FileSystemPrivate;
+
+static void openReadInt(FileSystemPrivate *p,
+                        FileSystem::OpenHandler &handler,
+                        const char *filename);
+
+/* Prefetch requests beyond this are dropped */
+#define PREFETCH_QUEUE_MAX 256
+
+/* Reads queued files in the background and throws the data away,
+ * so that the following real read is served from the OS page
+ * cache (or the archive entry cache) instead of the disk */
+struct PrefetchQueue
+{
+	FileSystemPrivate *p;
+
+	SDL_Thread *thread;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	bool termReq;
+
+	/* Paths as passed to 'prefetch()' */
+	std::deque<std::string> queue;
+
+	/* Lower case paths that are queued or being read */
+	BoostSet<std::string> pending;
+	/* Lower case paths that were read, but not opened yet */
+	BoostSet<std::string> done;
+
+	FileSystem::PrefetchStats stats;
+
+	struct Handler : FileSystem::OpenHandler
+	{
+		bool tryRead(SDL_RWops &ops, const char *)
+		{
+			readAll(ops);
+
+			return true;
+		}
+	};
+
+	PrefetchQueue(FileSystemPrivate *p)
+	    : p(p),
+	      mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      termReq(false)
+	{
+		memset(&stats, 0, sizeof(stats));
+
+		thread = createSDLThread
+			<PrefetchQueue, &PrefetchQueue::run>(this, "prefetch");
+	}
+
+	~PrefetchQueue()
+	{
+		SDL_LockMutex(mutex);
+		termReq = true;
+		SDL_CondSignal(cond);
+		SDL_UnlockMutex(mutex);
+
+		SDL_WaitThread(thread, 0);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	static std::string key(const char *filename)
+	{
+		std::string k(filename);
+
+		for (size_t i = 0; i < k.size(); ++i)
+			k[i] = tolower(k[i]);
+
+		return k;
+	}
+
+	static void readAll(SDL_RWops &ops)
+	{
+		char buffer[0x10000];
+
+		while (SDL_RWread(&ops, buffer, 1, sizeof(buffer)) > 0) {}
+
+		SDL_RWclose(&ops);
+	}
+
+	void enqueue(const char *filename)
+	{
+		std::string k = key(filename);
+
+		SDL_LockMutex(mutex);
+
+		if (pending.contains(k) || done.contains(k))
+		{
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		if (queue.size() >= PREFETCH_QUEUE_MAX)
+		{
+			++stats.dropped;
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		queue.push_back(filename);
+		pending.insert(k);
+		++stats.queued;
+
+		SDL_CondSignal(cond);
+		SDL_UnlockMutex(mutex);
+	}
+
+	/* Called on every real open */
+	void noteOpen(const char *filename)
+	{
+		SDL_LockMutex(mutex);
+
+		/* Nothing prefetched (the common case) */
+		if (pending.cbegin() == pending.cend()
+		&&  done.cbegin() == done.cend())
+		{
+			SDL_UnlockMutex(mutex);
+			return;
+		}
+
+		std::string k = key(filename);
+
+		if (done.contains(k))
+		{
+			done.remove(k);
+			++stats.hits;
+		}
+		else if (pending.contains(k))
+		{
+			/* Requested too late to be of any help */
+			++stats.late;
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	bool fetch(const std::string &filename)
+	{
+		/* Exact paths (eg. for 'load_data()') don't
+		 * go through extension supplementing */
+		PHYSFS_Stat stat;
+
+		if (PHYSFS_stat(filename.c_str(), &stat)
+		&&  stat.filetype == PHYSFS_FILETYPE_REGULAR)
+		{
+			PHYSFS_File *handle = PHYSFS_openRead(filename.c_str());
+
+			if (!handle)
+				return false;
+
+			SDL_RWops ops;
+			initReadOps(handle, ops, false);
+			readAll(ops);
+
+			return true;
+		}
+
+		Handler handler;
+
+		try
+		{
+			openReadInt(p, handler, filename.c_str());
+		}
+		catch (const Exception &)
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	void run()
+	{
+		SDL_LockMutex(mutex);
+
+		while (true)
+		{
+			while (queue.empty() && !termReq)
+				SDL_CondWait(cond, mutex);
+
+			if (termReq)
+				break;
+
+			std::string filename = queue.front();
+			queue.pop_front();
+
+			SDL_UnlockMutex(mutex);
+			bool ok = fetch(filename);
+			SDL_LockMutex(mutex);
+
+			std::string k = key(filename.c_str());
+			pending.remove(k);
+
+			if (ok)
+			{
+				done.insert(k);
+				++stats.completed;
+			}
+			else
+			{
+				++stats.failed;
+			}
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
+#ifdef __WINDOWS__
+static std::wstring
+toWide(const std::string &str)
+{
+	int len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, 0, 0);
+	std::wstring out(len, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &out[0], len);
+
+	return out;
+}
+#endif
+
+static FILE *
+fopenUTF8(const std::string &path, const char *mode)
+{
+#ifdef __WINDOWS__
+	std::string _mode(mode);
+	return _wfopen(toWide(path).c_str(), toWide(_mode).c_str());
+#else
+	return fopen(path.c_str(), mode);
+#endif
+}
+
+/* Flushes a file's contents all the way to the disk */
+static bool
+syncFile(FILE *f)
+{
+	if (fflush(f) != 0)
+		return false;
+
+#ifdef __WINDOWS__
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+/* Writes files on a background thread. Each file is written
+ * to a temporary path first and only renamed into place once
+ * all of it is on disk, so that a crash mid-write leaves the
+ * previous version of the file intact */
+struct WriteQueue
+{
+	struct Job
+	{
+		std::string path;
+		std::string data;
+	};
+
+	SDL_Thread *thread;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	bool termReq;
+
+	std::deque<Job> queue;
+
+	/* Queued jobs plus the one being written; lets readers
+	 * skip locking when there is nothing in flight */
+	SDL_atomic_t pending;
+
+	/* Error from a failed write, reported on the next call
+	 * into the queue (the caller is long gone by then) */
+	std::string error;
+
+	WriteQueue()
+	    : mutex(SDL_CreateMutex()),
+	      cond(SDL_CreateCond()),
+	      termReq(false)
+	{
+		SDL_AtomicSet(&pending, 0);
+
+		thread = createSDLThread
+			<WriteQueue, &WriteQueue::run>(this, "write");
+	}
+
+	~WriteQueue()
+	{
+		/* Pending writes are finished before exiting */
+		SDL_LockMutex(mutex);
+		termReq = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+
+		SDL_WaitThread(thread, 0);
+
+		SDL_DestroyCond(cond);
+		SDL_DestroyMutex(mutex);
+	}
+
+	/* Must be called with the mutex locked */
+	void throwError()
+	{
+		if (error.empty())
+			return;
+
+		std::string msg;
+		msg.swap(error);
+
+		SDL_UnlockMutex(mutex);
+
+		throw Exception(Exception::IOError, "%s", msg.c_str());
+	}
+
+	/* Errors of earlier writes are thrown only after
+	 * 'data' has been queued, so it is never lost */
+	void enqueue(const char *path, std::string &data)
+	{
+		SDL_LockMutex(mutex);
+
+		/* Only the most recent contents of a file matter, so
+		 * an older write that hasn't started yet is replaced */
+		size_t i;
+		for (i = 0; i < queue.size(); ++i)
+			if (queue[i].path == path)
+				break;
+
+		if (i < queue.size())
+		{
+			queue[i].data.swap(data);
+		}
+		else
+		{
+			queue.push_back(Job());
+			queue.back().path = path;
+			queue.back().data.swap(data);
+			SDL_AtomicIncRef(&pending);
+
+			SDL_CondBroadcast(cond);
+		}
+
+		throwError();
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	void wait()
+	{
+		SDL_LockMutex(mutex);
+
+		while (SDL_AtomicGet(&pending) > 0)
+			SDL_CondWait(cond, mutex);
+
+		SDL_UnlockMutex(mutex);
+	}
+
+	static bool write(const Job &job, std::string &error)
+	{
+		std::string tmpPath = job.path + ".mkxp-tmp";
+		FILE *f = fopenUTF8(tmpPath, "wb");
+
+		if (!f)
+		{
+			error = strerror(errno);
+			return false;
+		}
+
+		bool ok = fwrite(job.data.data(), 1, job.data.size(), f) == job.data.size()
+		       && syncFile(f);
+
+		if (!ok)
+			error = strerror(errno);
+
+		if (fclose(f) != 0 && ok)
+		{
+			error = strerror(errno);
+			ok = false;
+		}
+
+		if (ok && !FileSystem::replaceFile(tmpPath, job.path))
+		{
+			error = strerror(errno);
+			ok = false;
+		}
+
+		if (!ok)
+			remove(tmpPath.c_str());
+
+		return ok;
+	}
+
+	void run()
+	{
+		SDL_LockMutex(mutex);
+
+		while (true)
+		{
+			while (queue.empty() && !termReq)
+				SDL_CondWait(cond, mutex);
+
+			if (queue.empty())
+				break;
+
+			Job job;
+			job.path.swap(queue.front().path);
+			job.data.swap(queue.front().data);
+			queue.pop_front();
+
+			SDL_UnlockMutex(mutex);
+
+			std::string reason;
+			bool ok = write(job, reason);
+
+			if (!ok)
+				Debug() << "Failed to write" << job.path << ":" << reason;
+
+			SDL_LockMutex(mutex);
+
+			if (!ok && error.empty())
+				error = "Failed to write '" + job.path + "': " + reason;
+
+			SDL_AtomicDecRef(&pending);
+			SDL_CondBroadcast(cond);
+		}
+
+		SDL_UnlockMutex(mutex);
+	}
+};
+
 struct FileSystemPrivate
 {
 	/* Maps: lower case full filepath,
@@ -309,26 +758,49 @@ struct FileSystemPrivate
 	/* This is for compatibility with games that take Windows'
 	 * case insensitivity for granted */
 	bool havePathCache;
+
+	/* Created up front, as they are used
+	 * from the audio threads as well */
+	PrefetchQueue *prefetch;
+	WriteQueue *writes;
+
+	/* Reads must see the result of earlier writes */
+	void syncWrites()
+	{
+		if (SDL_AtomicGet(&writes->pending) > 0)
+			writes->wait();
+	}
 };
 
 FileSystem::FileSystem(const char *argv0,
-                       bool allowSymlinks)
+                       bool allowSymlinks,
+                       size_t archiveCacheBytes)
 {
 	p = new FileSystemPrivate;
 	p->havePathCache = false;
 
 	PHYSFS_init(argv0);
 
+	RGSS_setEntryCacheLimit(archiveCacheBytes);
+
 	PHYSFS_registerArchiver(&RGSS1_Archiver);
 	PHYSFS_registerArchiver(&RGSS2_Archiver);
 	PHYSFS_registerArchiver(&RGSS3_Archiver);
+	PHYSFS_registerArchiver(&MKXPPACK_Archiver);
 
 	if (allowSymlinks)
 		PHYSFS_permitSymbolicLinks(1);
+
+	p->prefetch = new PrefetchQueue(p);
+	p->writes = new WriteQueue;
 }
 
 FileSystem::~FileSystem()
 {
+	delete p->prefetch;
+
+	/* Blocks until all queued writes are on disk */
+	delete p->writes;
 	delete p;
 
 	if (PHYSFS_deinit() == 0)
@@ -617,7 +1089,9 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename)
 	return PHYSFS_ENUM_OK;
 }
 
-void FileSystem::openRead(OpenHandler &handler, const char *filename)
+static void openReadInt(FileSystemPrivate *p,
+                        FileSystem::OpenHandler &handler,
+                        const char *filename)
 {
 	char buffer[512];
 	size_t len = strcpySafe(buffer, filename, sizeof(buffer), -1);
@@ -652,11 +1126,16 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename)
 	if (p->havePathCache)
 	{
 		/* Get the list of files contained in this directory
-		 * and manually iterate over them */
-		const std::vector<std::string> &fileList = p->fileLists[dir];
-
-		for (size_t i = 0; i < fileList.size(); ++i)
-			openReadEnumCB(&data, dir, fileList[i].c_str());
+		 * and manually iterate over them. Don't insert missing
+		 * directories, the prefetch thread might be looking
+		 * things up concurrently */
+		if (p->fileLists.contains(dir))
+		{
+			const std::vector<std::string> &fileList = p->fileLists[dir];
+
+			for (size_t i = 0; i < fileList.size(); ++i)
+				openReadEnumCB(&data, dir, fileList[i].c_str());
+		}
 	}
 	else
 	{
@@ -670,10 +1149,23 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename)
 		throw Exception(Exception::NoFileError, "%s", filename);
 }
 
+void FileSystem::openRead(OpenHandler &handler, const char *filename)
+{
+	p->prefetch->noteOpen(filename);
+
+	p->syncWrites();
+
+	openReadInt(p, handler, filename);
+}
+
 void FileSystem::openReadRaw(SDL_RWops &ops,
                              const char *filename,
                              bool freeOnClose)
 {
+	p->prefetch->noteOpen(filename);
+
+	p->syncWrites();
+
 	PHYSFS_File *handle = PHYSFS_openRead(filename);
 	assert(handle);
 
@@ -682,5 +1174,157 @@ void FileSystem::openReadRaw(SDL_RWops &ops,
 
 bool FileSystem::exists(const char *filename)
 {
+	p->syncWrites();
+
 	return PHYSFS_exists(filename);
 }
+
+std::string FileSystem::entryIdentity(const char *filename)
+{
+	p->syncWrites();
+
+	PHYSFS_Stat stat;
+
+	if (!PHYSFS_stat(filename, &stat)
+	||  stat.filetype != PHYSFS_FILETYPE_REGULAR)
+		return std::string();
+
+	const char *realDir = PHYSFS_getRealDir(filename);
+
+	char buf[64];
+	snprintf(buf, sizeof(buf), "|%lld|%lld",
+	         (long long) stat.filesize, (long long) stat.modtime);
+
+	return std::string(realDir ? realDir : "") + buf;
+}
+
+void FileSystem::prefetch(const char *filename)
+{
+	p->prefetch->enqueue(filename);
+}
+
+void FileSystem::getPrefetchStats(PrefetchStats &out)
+{
+	SDL_LockMutex(p->prefetch->mutex);
+	out = p->prefetch->stats;
+	SDL_UnlockMutex(p->prefetch->mutex);
+}
+
+void FileSystem::writeAsync(const char *filename, std::string &data)
+{
+	p->writes->enqueue(filename, data);
+}
+
+void FileSystem::syncWrites()
+{
+	p->syncWrites();
+}
+
+bool FileSystem::replaceFile(const std::string &src, const std::string &dst)
+{
+#ifdef __WINDOWS__
+	/* Plain 'rename()' fails if 'dst' exists */
+	return MoveFileExW(toWide(src).c_str(), toWide(dst).c_str(),
+	                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	return rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+bool FileSystem::removeFile(const std::string &path)
+{
+#ifdef __WINDOWS__
+	return _wremove(toWide(path).c_str()) == 0;
+#else
+	return remove(path.c_str()) == 0;
+#endif
+}
+
+void FileSystem::touchFile(const std::string &path)
+{
+#ifdef __WINDOWS__
+	_wutime(toWide(path).c_str(), 0);
+#else
+	utime(path.c_str(), 0);
+#endif
+}
+
+static bool
+matchesName(const std::string &name, const char *prefix, const char *suffix)
+{
+	size_t prefixLen = strlen(prefix);
+	size_t suffixLen = strlen(suffix);
+
+	if (name.size() < prefixLen + suffixLen)
+		return false;
+
+	return name.compare(0, prefixLen, prefix) == 0
+	    && name.compare(name.size() - suffixLen, suffixLen, suffix) == 0;
+}
+
+void FileSystem::listFiles(const std::string &dir,
+                           const char *prefix, const char *suffix,
+                           std::vector<NativeFile> &out)
+{
+#ifdef __WINDOWS__
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileW(toWide(dir + "*").c_str(), &data);
+
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		int len = WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, 0, 0, 0, 0);
+		std::string name(len, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, &name[0], len, 0, 0);
+		name.resize(len - 1);
+
+		if (!matchesName(name, prefix, suffix))
+			continue;
+
+		ULARGE_INTEGER mtime;
+		mtime.LowPart = data.ftLastWriteTime.dwLowDateTime;
+		mtime.HighPart = data.ftLastWriteTime.dwHighDateTime;
+
+		NativeFile file;
+		file.path = dir + name;
+		file.size = ((int64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		file.mtime = mtime.QuadPart;
+		out.push_back(file);
+	}
+	while (FindNextFileW(find, &data));
+
+	FindClose(find);
+#else
+	DIR *d = opendir(dir.c_str());
+
+	if (!d)
+		return;
+
+	while (struct dirent *entry = readdir(d))
+	{
+		std::string name(entry->d_name);
+
+		if (!matchesName(name, prefix, suffix))
+			continue;
+
+		std::string path = dir + name;
+		struct stat st;
+
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		NativeFile file;
+		file.path = path;
+		file.size = st.st_size;
+		file.mtime = st.st_mtime;
+		out.push_back(file);
+	}
+
+	closedir(d);
+#endif
+}
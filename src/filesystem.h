@@ -24,6 +24,10 @@
 
 #include <SDL_rwops.h>
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 struct FileSystemPrivate;
 class SharedFontState;
 
@@ -31,7 +35,8 @@ class FileSystem
 {
 public:
 	FileSystem(const char *argv0,
-	           bool allowSymlinks);
+	           bool allowSymlinks,
+	           size_t archiveCacheBytes);
 	~FileSystem();
 
 	void addPath(const char *path);
@@ -67,6 +72,67 @@ public:
 	/* Does not perform extension supplementing */
 	bool exists(const char *filename);
 
+	/* Identifies the entry currently backing 'filename' (the
+	 * archive or directory it is read from, its size and last
+	 * modification time). Empty if there is no such file */
+	std::string entryIdentity(const char *filename);
+
+	/* Queues a file to be read ahead of time on a background
+	 * thread. 'filename' is resolved like in 'openRead()',
+	 * or taken as is if it names an existing file */
+	void prefetch(const char *filename);
+
+	struct PrefetchStats
+	{
+		/* Requests accepted / dropped due to a full queue */
+		uint32_t queued;
+		uint32_t dropped;
+
+		/* Requests processed, by outcome */
+		uint32_t completed;
+		uint32_t failed;
+
+		/* Opens of a file that had already been prefetched /
+		 * that was still waiting in the queue */
+		uint32_t hits;
+		uint32_t late;
+	};
+
+	void getPrefetchStats(PrefetchStats &out);
+
+	/* Writes 'data' (its contents are taken over) to a file on
+	 * a background thread, replacing the file atomically once
+	 * complete. Errors of earlier writes are thrown here
+	 * (after 'data' has been queued regardless) */
+	void writeAsync(const char *filename, std::string &data);
+
+	/* Waits until all files queued with 'writeAsync()' are on
+	 * disk; for file access that doesn't go through here */
+	void syncWrites();
+
+	/* Helpers for files outside of the search path, eg. in
+	 * the common data folder. Paths are native and UTF-8 */
+
+	/* Atomically replaces 'dst' (if it exists) with 'src' */
+	static bool replaceFile(const std::string &src, const std::string &dst);
+	static bool removeFile(const std::string &path);
+
+	/* Sets the modification time of 'path' to now */
+	static void touchFile(const std::string &path);
+
+	struct NativeFile
+	{
+		std::string path;
+		int64_t size;
+		int64_t mtime;
+	};
+
+	/* Lists the regular files directly inside of 'dir' (which
+	 * ends in a path separator) named 'prefix*suffix' */
+	static void listFiles(const std::string &dir,
+	                      const char *prefix, const char *suffix,
+	                      std::vector<NativeFile> &out);
+
 private:
 	FileSystemPrivate *p;
 };
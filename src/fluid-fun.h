@@ -4,9 +4,58 @@
 typedef struct _fluid_hashtable_t fluid_settings_t;
 typedef struct _fluid_synth_t fluid_synth_t;
 
+#ifdef SHARED_FLUID
+#include <fluidsynth.h>
+
+/* The SoundFont loader structs are only public up to 1.x */
+#if FLUIDSYNTH_VERSION_MAJOR == 1
+#define HAVE_FLUID_SFLOADER
+#endif
+#else
+#define HAVE_FLUID_SFLOADER
+
+typedef struct _fluid_sfloader_t fluid_sfloader_t;
+typedef struct _fluid_sfont_t fluid_sfont_t;
+typedef struct _fluid_preset_t fluid_preset_t;
+
+/* SoundFont loader interface, as laid out by fluidsynth 1.x */
+struct _fluid_sfloader_t
+{
+	void *data;
+	int (*free)(fluid_sfloader_t *loader);
+	fluid_sfont_t *(*load)(fluid_sfloader_t *loader, const char *filename);
+};
+
+struct _fluid_sfont_t
+{
+	void *data;
+	unsigned int id;
+	int (*free)(fluid_sfont_t *sfont);
+	char *(*get_name)(fluid_sfont_t *sfont);
+	fluid_preset_t *(*get_preset)(fluid_sfont_t *sfont, unsigned int bank, unsigned int prenum);
+	void (*iteration_start)(fluid_sfont_t *sfont);
+	int (*iteration_next)(fluid_sfont_t *sfont, fluid_preset_t *preset);
+};
+
+struct _fluid_preset_t
+{
+	void *data;
+	fluid_sfont_t *sfont;
+	int (*free)(fluid_preset_t *preset);
+	char *(*get_name)(fluid_preset_t *preset);
+	int (*get_banknum)(fluid_preset_t *preset);
+	int (*get_num)(fluid_preset_t *preset);
+	int (*noteon)(fluid_preset_t *preset, fluid_synth_t *synth, int chan, int key, int vel);
+	int (*notify)(fluid_preset_t *preset, int reason, int chan);
+};
+#endif
+
+typedef void (*FLUIDVERSIONPROC)(int *major, int *minor, int *micro);
 typedef int (*FLUIDSETTINGSSETNUMPROC)(fluid_settings_t* settings, const char *name, double val);
 typedef int (*FLUIDSETTINGSSETSTRPROC)(fluid_settings_t* settings, const char *name, const char *str);
 typedef int (*FLUIDSYNTHSFLOADPROC)(fluid_synth_t* synth, const char* filename, int reset_presets);
+typedef fluid_sfont_t* (*FLUIDSYNTHGETSFONTBYIDPROC)(fluid_synth_t* synth, unsigned int id);
+typedef void (*FLUIDSYNTHADDSFLOADERPROC)(fluid_synth_t* synth, fluid_sfloader_t* loader);
 typedef int (*FLUIDSYNTHSYSTEMRESETPROC)(fluid_synth_t* synth);
 typedef int (*FLUIDSYNTHWRITES16PROC)(fluid_synth_t* synth, int len, void* lout, int loff, int lincr, void* rout, int roff, int rincr);
 typedef int (*FLUIDSYNTHNOTEONPROC)(fluid_synth_t* synth, int chan, int key, int vel);
@@ -22,9 +71,12 @@ typedef void (*DELETEFLUIDSETTINGSPROC)(fluid_settings_t* settings);
 typedef int (*DELETEFLUIDSYNTHPROC)(fluid_synth_t* synth);
 
 #define FLUID_FUNCS \
+	FLUID_FUN(version, FLUIDVERSIONPROC) \
 	FLUID_FUN(settings_setnum, FLUIDSETTINGSSETNUMPROC) \
 	FLUID_FUN(settings_setstr, FLUIDSETTINGSSETSTRPROC) \
 	FLUID_FUN(synth_sfload, FLUIDSYNTHSFLOADPROC) \
+	FLUID_FUN(synth_get_sfont_by_id, FLUIDSYNTHGETSFONTBYIDPROC) \
+	FLUID_FUN(synth_add_sfloader, FLUIDSYNTHADDSFLOADERPROC) \
 	FLUID_FUN(synth_system_reset, FLUIDSYNTHSYSTEMRESETPROC) \
 	FLUID_FUN(synth_write_s16, FLUIDSYNTHWRITES16PROC) \
 	FLUID_FUN(synth_noteon, FLUIDSYNTHNOTEONPROC) \
@@ -187,6 +187,7 @@ void blitRectangle(const IntRect &src, const IntRect &dst, bool smooth)
 		gl.BlitFramebuffer(src.x, src.y, src.x+src.w, src.y+src.h,
 		                   dst.x, dst.y, dst.x+dst.w, dst.y+dst.h,
 		                   GL_COLOR_BUFFER_BIT, smooth ? GL_LINEAR : GL_NEAREST);
+		PERF_COUNT(drawCalls, 1);
 	}
 	else
 	{
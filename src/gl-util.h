@@ -24,6 +24,7 @@
 
 #include "gl-fun.h"
 #include "etc-internal.h"
+#include "perfstats.h"
 
 /* Struct wrapping GLuint for some light type safety */
 #define DEF_GL_ID \
@@ -69,6 +70,7 @@ namespace TEX
 	static inline void bind(ID id)
 	{
 		gl.BindTexture(GL_TEXTURE_2D, id.gl);
+		PERF_COUNT(texBinds, 1);
 	}
 
 	static inline void unbind()
@@ -79,11 +81,15 @@ namespace TEX
 	static inline void uploadImage(GLsizei width, GLsizei height, const void *data, GLenum format)
 	{
 		gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+
+		if (data)
+			PERF_COUNT(bytesUploaded, width*height*4);
 	}
 
 	static inline void uploadSubImage(GLint x, GLint y, GLsizei width, GLsizei height, const void *data, GLenum format)
 	{
 		gl.TexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+		PERF_COUNT(bytesUploaded, width*height*4);
 	}
 
 	static inline void allocEmpty(GLsizei width, GLsizei height)
@@ -174,11 +180,15 @@ struct GenericBO
 	static inline void uploadData(GLsizeiptr size, const GLvoid *data, GLenum usage = GL_STATIC_DRAW)
 	{
 		gl.BufferData(target, size, data, usage);
+
+		if (data)
+			PERF_COUNT(bytesUploaded, size);
 	}
 
 	static inline void uploadSubData(GLintptr offset, GLsizeiptr size, const GLvoid *data)
 	{
 		gl.BufferSubData(target, offset, size, data);
+		PERF_COUNT(bytesUploaded, size);
 	}
 
 	static inline void allocEmpty(GLsizeiptr size, GLenum usage = GL_STATIC_DRAW)
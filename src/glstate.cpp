@@ -24,6 +24,7 @@
 #include "etc.h"
 #include "gl-fun.h"
 #include "config.h"
+#include "perfstats.h"
 
 #include <SDL_rect.h>
 
@@ -105,6 +106,7 @@ void GLViewport::apply(const IntRect &value)
 void GLProgram::apply(const unsigned int &value)
 {
 	gl.UseProgram(value);
+	PERF_COUNT(shaderSwitches, 1);
 }
 
 GLState::Caps::Caps()
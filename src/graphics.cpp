@@ -37,6 +37,8 @@
 #include "intrulist.h"
 #include "binding.h"
 #include "debugwriter.h"
+#include "headlessaudio.h"
+#include "perfstats.h"
 
 #include <SDL_video.h>
 #include <SDL_timer.h>
@@ -146,6 +148,11 @@ public:
 		const int w = geometry.rect.w;
 		const int h = geometry.rect.h;
 
+		/* Elements bind bitmap textures mid render,
+		 * where executing their batches would clobber
+		 * the bound shader and framebuffer */
+		Bitmap::flushPendingBatches();
+
 		shState->prepareDraw();
 
 		pp.startRender();
@@ -366,10 +373,17 @@ struct FPSLimiter
 		tpf = tickFreq / value;
 	}
 
-	void delay()
+	/* At the end of a frame, the script binding
+	 * gets to use the idle time first */
+	void delay(bool frameEnd = true)
 	{
 		if (disabled)
+		{
+			if (frameEnd)
+				scriptBinding->frameIdle(0);
+
 			return;
+		}
 
 		int64_t tickDelta = SDL_GetPerformanceCounter() - lastTickCount;
 		int64_t toDelay = tpf - tickDelta;
@@ -381,6 +395,16 @@ struct FPSLimiter
 		if (toDelay < 0)
 			toDelay = 0;
 
+		if (frameEnd)
+		{
+			uint64_t idleStart = SDL_GetPerformanceCounter();
+			scriptBinding->frameIdle(toDelay * 1000000 / (int64_t) tickFreq);
+			toDelay -= SDL_GetPerformanceCounter() - idleStart;
+
+			if (toDelay < 0)
+				toDelay = 0;
+		}
+
 		delayTicks(toDelay);
 
 		uint64_t now = lastTickCount = SDL_GetPerformanceCounter();
@@ -472,6 +496,9 @@ struct GraphicsPrivate
 
 	FPSLimiter fpsLimiter;
 
+	/* Performance counter value at the end of the last frame */
+	uint64_t lastFrameEnd;
+
 	bool frozen;
 	TEXFBO frozenScene;
 	Quad screenQuad;
@@ -491,6 +518,7 @@ struct GraphicsPrivate
 	      frameCount(0),
 	      brightness(255),
 	      fpsLimiter(frameRate),
+	      lastFrameEnd(SDL_GetPerformanceCounter()),
 	      frozen(false)
 	{
 		recalculateScreenSize(rtData);
@@ -573,12 +601,37 @@ struct GraphicsPrivate
 
 	void swapGLBuffer()
 	{
+		uint64_t delayStart = SDL_GetPerformanceCounter();
+
 		fpsLimiter.delay();
 		SDL_GL_SwapWindow(threadData->window);
 
 		++frameCount;
 
+		endFrameStats(delayStart, false);
+		notifyFrame();
+	}
+
+	/* Time spent before 'delayStart' counts as busy */
+	void endFrameStats(uint64_t delayStart, bool skipped)
+	{
+		uint64_t now = SDL_GetPerformanceCounter();
+		const double usPerTick = 1000000.0 / fpsLimiter.tickFreq;
+
+		perfStats.endFrame((now - lastFrameEnd) * usPerTick,
+		                   (delayStart - lastFrameEnd) * usPerTick,
+		                   1000000 / frameRate, skipped);
+
+		lastFrameEnd = now;
+	}
+
+	void notifyFrame()
+	{
 		threadData->ethread->notifyFrame();
+
+		/* A headless audio device advances with the game */
+		if (threadData->headlessAudio)
+			threadData->headlessAudio->renderFrame(frameRate);
 	}
 
 	void compositeToBuffer(TEXFBO &buffer)
@@ -626,6 +679,9 @@ struct GraphicsPrivate
 		SDL_GL_MakeCurrent(threadData->window, glCtx);
 
 		fpsLimiter.resetFrameAdjust();
+
+		/* Don't count the sleep as frame time */
+		lastFrameEnd = SDL_GetPerformanceCounter();
 	}
 };
 
@@ -666,9 +722,11 @@ void Graphics::update()
 		if (p->threadData->config.frameSkip)
 		{
 			/* Skip frame */
+			uint64_t delayStart = SDL_GetPerformanceCounter();
 			p->fpsLimiter.delay();
 			++p->frameCount;
-			p->threadData->ethread->notifyFrame();
+			p->endFrameStats(delayStart, true);
+			p->notifyFrame();
 
 			return;
 		}
@@ -1032,12 +1090,27 @@ void Graphics::repaintWait(const AtomicFlag &exitCond, bool checkReset)
 		FBO::clear();
 		p->metaBlitBufferFlippedScaled();
 		SDL_GL_SwapWindow(p->threadData->window);
-		p->fpsLimiter.delay();
+		p->fpsLimiter.delay(false);
 
-		p->threadData->ethread->notifyFrame();
+		p->notifyFrame();
 	}
 
 	GLMeta::blitEnd();
+
+	p->lastFrameEnd = SDL_GetPerformanceCounter();
+}
+
+void Graphics::getDisposableCounts(std::map<std::string, int> &out) const
+{
+	IntruListLink<Disposable> *iter;
+
+	for (iter = p->dispList.begin();
+	     iter != p->dispList.end();
+	     iter = iter->next)
+	{
+		if (!iter->data->isDisposed())
+			++out[iter->data->klassName()];
+	}
 }
 
 void Graphics::addDisposable(Disposable *d)
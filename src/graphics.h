@@ -24,6 +24,9 @@
 
 #include "util.h"
 
+#include <map>
+#include <string>
+
 class Scene;
 class Bitmap;
 class Disposable;
@@ -62,6 +65,9 @@ public:
 	DECL_ATTR( Fullscreen, bool )
 	DECL_ATTR( ShowCursor, bool )
 
+	/* Counts undisposed objects by class name */
+	void getDisposableCounts(std::map<std::string, int> &out) const;
+
 	/* <internal> */
 	Scene *getScreen() const;
 	/* Repaint screen with static image until exitCond
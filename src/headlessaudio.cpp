@@ -0,0 +1,247 @@
+/*
+** headlessaudio.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headlessaudio.h"
+
+#include "sharedstate.h"
+#include "audio.h"
+#include "debugwriter.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <SDL_timer.h>
+
+/* ALC_SOFT_loopback, declared here as not every
+ * OpenAL implementation ships alext.h */
+#ifndef ALC_FORMAT_CHANNELS_SOFT
+#define ALC_FORMAT_CHANNELS_SOFT 0x1990
+#define ALC_FORMAT_TYPE_SOFT     0x1991
+#define ALC_SHORT_SOFT           0x1402
+#define ALC_STEREO_SOFT          0x1501
+#endif
+
+typedef ALCdevice* (*LOOPBACKOPENDEVICEPROC)(const ALCchar *deviceName);
+typedef ALCboolean (*ISRENDERFORMATSUPPORTEDPROC)(ALCdevice *device, ALCsizei freq,
+                                                  ALCenum channels, ALCenum type);
+typedef void (*RENDERSAMPLESPROC)(ALCdevice *device, ALCvoid *buffer, ALCsizei samples);
+
+#define HEADLESS_RATE 44100
+#define HEADLESS_CHANNELS 2
+
+/* Name of OpenAL Soft's null output device */
+#define NULL_DEVICE_NAME "No Output"
+
+struct HeadlessAudioPrivate
+{
+	ALCdevice *device;
+	ALCint attribs[7];
+
+	/* Null if the null output is used instead */
+	RENDERSAMPLESPROC renderSamples;
+
+	/* Remainder of frames per second not rendered yet */
+	int frameCarry;
+
+	/* Sample frames rendered in total */
+	uint64_t rendered;
+	std::vector<int16_t> buffer;
+
+	FILE *dump;
+	uint32_t dumpBytes;
+};
+
+/* Set while a rendering device is open */
+static HeadlessAudioPrivate *renderingDevice = 0;
+
+uint32_t audioTicks()
+{
+	if (!renderingDevice)
+		return SDL_GetTicks();
+
+	return renderingDevice->rendered * 1000 / HEADLESS_RATE;
+}
+
+static void
+writeLE32(uint8_t *dst, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		dst[i] = (value >> (i*8)) & 0xFF;
+}
+
+static void
+writeLE16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+static void
+writeWavHeader(FILE *f, uint32_t dataBytes)
+{
+	const uint16_t blockAlign = HEADLESS_CHANNELS * sizeof(int16_t);
+	uint8_t h[44];
+
+	memcpy(&h[0], "RIFF", 4);
+	writeLE32(&h[4], 36 + dataBytes);
+	memcpy(&h[8], "WAVEfmt ", 8);
+	writeLE32(&h[16], 16);
+	writeLE16(&h[20], 1); /* PCM */
+	writeLE16(&h[22], HEADLESS_CHANNELS);
+	writeLE32(&h[24], HEADLESS_RATE);
+	writeLE32(&h[28], HEADLESS_RATE * blockAlign);
+	writeLE16(&h[32], blockAlign);
+	writeLE16(&h[34], 16);
+	memcpy(&h[36], "data", 4);
+	writeLE32(&h[40], dataBytes);
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(h, sizeof(h), 1, f);
+}
+
+HeadlessAudio::HeadlessAudio(const std::string &dumpPath)
+{
+	p = new HeadlessAudioPrivate;
+	p->device = 0;
+	p->attribs[0] = 0;
+	p->renderSamples = 0;
+	p->frameCarry = 0;
+	p->rendered = 0;
+	p->dump = 0;
+	p->dumpBytes = 0;
+
+	if (alcIsExtensionPresent(0, "ALC_SOFT_loopback"))
+	{
+		LOOPBACKOPENDEVICEPROC openDevice = (LOOPBACKOPENDEVICEPROC)
+			alcGetProcAddress(0, "alcLoopbackOpenDeviceSOFT");
+		ISRENDERFORMATSUPPORTEDPROC formatSupported = (ISRENDERFORMATSUPPORTEDPROC)
+			alcGetProcAddress(0, "alcIsRenderFormatSupportedSOFT");
+		RENDERSAMPLESPROC renderSamples = (RENDERSAMPLESPROC)
+			alcGetProcAddress(0, "alcRenderSamplesSOFT");
+
+		ALCdevice *dev = openDevice ? openDevice(0) : 0;
+
+		if (dev && formatSupported && renderSamples
+		&&  formatSupported(dev, HEADLESS_RATE, ALC_STEREO_SOFT, ALC_SHORT_SOFT))
+		{
+			const ALCint attribs[] =
+			{
+				ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+				ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+				ALC_FREQUENCY, HEADLESS_RATE,
+				0
+			};
+
+			memcpy(p->attribs, attribs, sizeof(attribs));
+			p->device = dev;
+			p->renderSamples = renderSamples;
+		}
+		else if (dev)
+		{
+			alcCloseDevice(dev);
+		}
+	}
+
+	if (!p->device)
+	{
+		Debug() << "ALC_SOFT_loopback not available, using the null audio output";
+		p->device = alcOpenDevice(NULL_DEVICE_NAME);
+
+		return;
+	}
+
+	renderingDevice = p;
+
+	if (dumpPath.empty())
+		return;
+
+	p->dump = fopen(dumpPath.c_str(), "wb");
+
+	if (p->dump)
+		writeWavHeader(p->dump, 0);
+	else
+		Debug() << "Failed to open audio dump file" << dumpPath;
+}
+
+HeadlessAudio::~HeadlessAudio()
+{
+	if (renderingDevice == p)
+		renderingDevice = 0;
+
+	if (p->dump)
+	{
+		writeWavHeader(p->dump, p->dumpBytes);
+		fclose(p->dump);
+	}
+
+	if (p->device)
+		alcCloseDevice(p->device);
+
+	delete p;
+}
+
+ALCdevice *HeadlessAudio::device() const
+{
+	return p->device;
+}
+
+const ALCint *HeadlessAudio::contextAttribs() const
+{
+	return p->attribs;
+}
+
+bool HeadlessAudio::rendersFrames() const
+{
+	return p->renderSamples != 0;
+}
+
+void HeadlessAudio::renderFrame(int fps)
+{
+	if (!p->renderSamples || fps <= 0)
+		return;
+
+	/* Refill the streams, advance fades and start pending
+	 * sounds before mixing, so all of it happens at the
+	 * same point of audio time on every run */
+	shState->audio().schedulerStep();
+
+	/* Spread the sample rate evenly over the frames of a second */
+	p->frameCarry += HEADLESS_RATE;
+	int frames = p->frameCarry / fps;
+	p->frameCarry %= fps;
+
+	if (frames == 0)
+		return;
+
+	p->buffer.resize(frames * HEADLESS_CHANNELS);
+	p->renderSamples(p->device, &p->buffer[0], frames);
+	p->rendered += frames;
+
+	if (!p->dump)
+		return;
+
+	size_t bytes = p->buffer.size() * sizeof(int16_t);
+
+	if (fwrite(&p->buffer[0], bytes, 1, p->dump) == 1)
+		p->dumpBytes += bytes;
+}
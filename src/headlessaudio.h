@@ -0,0 +1,73 @@
+/*
+** headlessaudio.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEADLESSAUDIO_H
+#define HEADLESSAUDIO_H
+
+#include <alc.h>
+
+#include <string>
+#include <stdint.h>
+
+struct HeadlessAudioPrivate;
+
+/* An OpenAL device that doesn't output to any sound hardware.
+ * Where ALC_SOFT_loopback is available, nothing is mixed until
+ * 'renderFrame()' is called (once per game frame), so audio
+ * processing advances in step with the game instead of the wall
+ * clock, and the mixed output can be dumped to a WAV file.
+ * The audio scheduler doesn't run on its own thread then either;
+ * each frame first services the streams and sounds once.
+ * Otherwise, OpenAL Soft's null output is used, which keeps
+ * mixing in real time and discards the result */
+class HeadlessAudio
+{
+public:
+	/* Output is written to 'dumpPath' unless it's empty */
+	HeadlessAudio(const std::string &dumpPath);
+	~HeadlessAudio();
+
+	/* Null if no headless device could be opened at all */
+	ALCdevice *device() const;
+
+	/* To be passed to 'alcCreateContext()' */
+	const ALCint *contextAttribs() const;
+
+	/* True unless the null output is used, ie. audio
+	 * only advances through 'renderFrame()' */
+	bool rendersFrames() const;
+
+	/* Runs one audio scheduler step, then mixes the output of
+	 * one frame at 'fps' frames per second. Does nothing with
+	 * the null output */
+	void renderFrame(int fps);
+
+private:
+	HeadlessAudioPrivate *p;
+};
+
+/* Time base (in ms) of audio fades and sound latency. Counts
+ * the output mixed so far while a rendering headless device is
+ * open, so it only depends on the frame count; otherwise this
+ * is the same as SDL_GetTicks() */
+uint32_t audioTicks();
+
+#endif // HEADLESSAUDIO_H
@@ -37,6 +37,7 @@
 #include "debugwriter.h"
 #include "exception.h"
 #include "gl-fun.h"
+#include "headlessaudio.h"
 
 #include "binding.h"
 
@@ -117,7 +118,12 @@ int rgssThreadFun(void *userdata)
 	GLDebugLogger dLogger;
 
 	/* Setup AL context */
-	ALCcontext *alcCtx = alcCreateContext(threadData->alcDev, 0);
+	const ALCint *alcAttribs = 0;
+
+	if (threadData->headlessAudio)
+		alcAttribs = threadData->headlessAudio->contextAttribs();
+
+	ALCcontext *alcCtx = alcCreateContext(threadData->alcDev, alcAttribs);
 
 	if (!alcCtx)
 	{
@@ -293,10 +299,22 @@ int main(int argc, char *argv[])
 	(void) setupWindowIcon;
 #endif
 
-	ALCdevice *alcDev = alcOpenDevice(0);
+	HeadlessAudio *headlessAudio = 0;
+	ALCdevice *alcDev;
+
+	if (conf.headlessAudio)
+	{
+		headlessAudio = new HeadlessAudio(conf.headlessAudioDump);
+		alcDev = headlessAudio->device();
+	}
+	else
+	{
+		alcDev = alcOpenDevice(0);
+	}
 
 	if (!alcDev)
 	{
+		delete headlessAudio;
 		showInitError("Error opening OpenAL device");
 		SDL_DestroyWindow(win);
 		TTF_Quit();
@@ -316,6 +334,7 @@ int main(int argc, char *argv[])
 	EventThread eventThread;
 	RGSSThreadData rtData(&eventThread, argv[0], win,
 	                      alcDev, mode.refresh_rate, conf);
+	rtData.headlessAudio = headlessAudio;
 
 	int winW, winH;
 	SDL_GetWindowSize(win, &winW, &winH);
@@ -368,7 +387,11 @@ int main(int argc, char *argv[])
 
 	Debug() << "Shutting down.";
 
-	alcCloseDevice(alcDev);
+	if (headlessAudio)
+		delete headlessAudio;
+	else
+		alcCloseDevice(alcDev);
+
 	SDL_DestroyWindow(win);
 
 	Sound_Quit();
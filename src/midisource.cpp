@@ -28,10 +28,13 @@
 #include "util.h"
 #include "debugwriter.h"
 #include "fluid-fun.h"
+#include "sdl-util.h"
+#include "filesystem.h"
 
 #include <SDL_rwops.h>
 
 #include <assert.h>
+#include <stdio.h>
 #include <math.h>
 #include <vector>
 #include <algorithm>
@@ -63,6 +66,17 @@
 
 #define CC_VAL_DEFAULT 127
 
+/* Prerendered tracks keep playing this long past their loop
+ * end, so the loop start is heard with the decaying notes
+ * of the end mixed in, just like when synthesizing live */
+#define PRERENDER_TAIL_SECONDS 2
+
+/* Renderings taking longer than this are given up on */
+#define PRERENDER_MAX_SECONDS (15*60)
+
+#define PRERENDER_MAGIC 0x4d504b4d /* "MKPM" */
+#define PRERENDER_VERSION 1
+
 enum MidiEventType
 {
 	NoteOff,
@@ -595,11 +609,22 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	/* Index of longest track */
 	uint8_t longestI;
 
+	/* Length of the longest track */
+	uint64_t songLength;
+
 	bool looped;
 
 	/* Absolute delta at which we received the LOOP_MARKER CC event */
 	uint32_t loopDelta;
 
+	/* Deltas and frames rendered since the last reset, and the
+	 * frames at which the loop start / song end were first reached
+	 * (-1 if not yet). Used when prerendering */
+	uint64_t songDeltas;
+	uint64_t renderedFrames;
+	int64_t loopFrame;
+	int64_t endFrame;
+
 	/* Deltas per beat */
 	uint16_t dpb;
 
@@ -613,33 +638,21 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	/* MidiReadHandler (track that's currently being read) */
 	int16_t curTrack;
 
-	MidiSource(SDL_RWops &ops,
+	MidiSource(const std::vector<uint8_t> &data,
 	           bool looped)
 	    : freq(SYNTH_SAMPLERATE),
 	      looped(looped),
+	      loopDelta(0),
+	      songDeltas(0),
+	      renderedFrames(0),
+	      loopFrame(-1),
+	      endFrame(-1),
 	      dpb(480),
 	      pitchShift(0),
 	      genDeltasCarry(0),
 	      curTrack(-1)
 	{
-		size_t dataLen = SDL_RWsize(&ops);
-		std::vector<uint8_t> data(dataLen);
-
-		if (SDL_RWread(&ops, &data[0], 1, dataLen) < dataLen)
-		{
-			SDL_RWclose(&ops);
-			throw Exception(Exception::MKXPError, "Reading midi data failed");
-		}
-
-		try
-		{
-			readMidi(this, data);
-		}
-		catch (const Exception &)
-		{
-			SDL_RWclose(&ops);
-			throw;
-		}
+		readMidi(this, data);
 
 		synth = shState->midiState().allocateSynth();
 
@@ -655,6 +668,8 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		for (size_t i = 0; i < tracks.size(); ++i)
 			tracks[i].loopOffsetEnd = longest - tracks[i].length;
 
+		songLength = longest;
+
 		/* Enterbrain likes to be funny and put loop markers at
 		 * the very end of ME tracks */
 		if (loopDelta >= longest)
@@ -788,8 +803,8 @@ struct MidiSource : ALDataSource, MidiReadHandler
 			loopDelta = absDelta;
 	}
 
-	/* ALDataSource */
-	Status fillBuffer(AL::Buffer::ID buf)
+	/* Synthesizes the next buffer worth of audio into 'synthBuf' */
+	Status render()
 	{
 		/* In case there is no currently scheduled one */
 		for (size_t i = 0; i < tracks.size(); ++i)
@@ -801,6 +816,14 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		 * have been rendered */
 		while (remTicks > 0)
 		{
+			uint64_t frame = renderedFrames + (BUF_TICKS - remTicks) * TICK_FRAMES;
+
+			if (loopFrame < 0 && songDeltas >= loopDelta)
+				loopFrame = frame;
+
+			if (endFrame < 0 && songDeltas >= songLength)
+				endFrame = frame;
+
 			/* Check for events that have to be activated now, activate them,
 			 * and schedule new ones if the queue isn't empty */
 			for (size_t i = 0; i < tracks.size(); ++i)
@@ -874,10 +897,11 @@ struct MidiSource : ALDataSource, MidiReadHandler
 			for (size_t i = 0; i < tracks.size(); ++i)
 				if (tracks[i].valid)
 					tracks[i].remDeltas -= intDeltas;
+
+			songDeltas += intDeltas;
 		}
 
-		/* Fill AL buffer */
-		AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, synthBuf, sizeof(synthBuf), freq);
+		renderedFrames += BUF_TICKS * TICK_FRAMES;
 
 		if (tracks[longestI].atEnd)
 			return EndOfStream;
@@ -885,6 +909,17 @@ struct MidiSource : ALDataSource, MidiReadHandler
 		return NoError;
 	}
 
+	/* ALDataSource */
+	Status fillBuffer(AL::Buffer::ID buf)
+	{
+		Status status = render();
+
+		/* Fill AL buffer */
+		AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, synthBuf, sizeof(synthBuf), freq);
+
+		return status;
+	}
+
 	int sampleRate()
 	{
 		return freq;
@@ -898,6 +933,8 @@ struct MidiSource : ALDataSource, MidiReadHandler
 
 		/* Reset runtime variables */
 		genDeltasCarry = 0;
+		songDeltas = renderedFrames = 0;
+		loopFrame = endFrame = -1;
 		updatePlaybackSpeed(DEFAULT_BPM);
 
 		/* Reset tracks */
@@ -916,8 +953,281 @@ struct MidiSource : ALDataSource, MidiReadHandler
 	}
 };
 
+struct PrerenderHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rate;
+
+	/* Total frames, and the loop region
+	 * (both 0 if the track doesn't loop) */
+	uint32_t frames;
+	uint32_t loopStart;
+	uint32_t loopEnd;
+};
+
+/* Streams a prerendered track from its cache file. If a pitch
+ * other than the default is requested, it falls back to live
+ * synthesis, as the key shift can't be applied to PCM */
+struct PrerenderedMidiSource : ALDataSource
+{
+	SDL_RWops *file;
+	PrerenderHeader header;
+	bool looped;
+
+	uint32_t currentFrame;
+
+	std::vector<uint8_t> midiData;
+	MidiSource *live;
+
+	int16_t buffer[BUF_TICKS*TICK_FRAMES*2];
+
+	PrerenderedMidiSource(SDL_RWops *file,
+	                      const PrerenderHeader &header,
+	                      std::vector<uint8_t> &midiData,
+	                      bool looped)
+	    : file(file),
+	      header(header),
+	      looped(looped),
+	      currentFrame(0),
+	      live(0)
+	{
+		this->midiData.swap(midiData);
+	}
+
+	~PrerenderedMidiSource()
+	{
+		delete live;
+		SDL_RWclose(file);
+	}
+
+	uint32_t endFrame()
+	{
+		return (looped && header.loopEnd) ? header.loopEnd : header.frames;
+	}
+
+	void seekFrame(uint32_t frame)
+	{
+		currentFrame = frame;
+		SDL_RWseek(file, sizeof(header) + (Sint64) frame * sizeof(int16_t) * 2,
+		           RW_SEEK_SET);
+	}
+
+	Status fillBuffer(AL::Buffer::ID buf)
+	{
+		if (live)
+			return live->fillBuffer(buf);
+
+		uint32_t frames = std::min<uint32_t>(endFrame() - currentFrame,
+		                                     BUF_TICKS * TICK_FRAMES);
+
+		size_t read = SDL_RWread(file, buffer, sizeof(int16_t) * 2, frames);
+
+		if (read < frames)
+			return Error;
+
+		AL::Buffer::uploadData(buf, AL_FORMAT_STEREO16, buffer,
+		                       frames * sizeof(int16_t) * 2, header.rate);
+
+		currentFrame += frames;
+
+		if (currentFrame < endFrame())
+			return NoError;
+
+		if (!looped || !header.loopEnd)
+			return EndOfStream;
+
+		seekFrame(header.loopStart);
+
+		return WrapAround;
+	}
+
+	int sampleRate()
+	{
+		return header.rate;
+	}
+
+	void seekToOffset(float seconds)
+	{
+		if (live)
+			return live->seekToOffset(seconds);
+
+		uint32_t frame = std::max(seconds, 0.0f) * header.rate;
+
+		if (frame >= endFrame())
+			frame = 0;
+
+		seekFrame(frame);
+	}
+
+	uint32_t loopStartFrames()
+	{
+		if (live)
+			return live->loopStartFrames();
+
+		return header.loopStart;
+	}
+
+	bool setPitch(float value)
+	{
+		if (!live && value != 1.0f)
+		{
+			live = new MidiSource(midiData, looped);
+		}
+
+		if (live)
+			return live->setPitch(value);
+
+		return true;
+	}
+};
+
+static SDL_RWops *
+openPrerendered(const std::string &path, PrerenderHeader &header)
+{
+	/* Marks it as recently played for cache trimming (before
+	 * opening, as Windows doesn't allow it while open) */
+	FileSystem::touchFile(path);
+
+	SDL_RWops *file = RWFromFile(path.c_str(), "rb");
+
+	if (!file)
+		return 0;
+
+	if (SDL_RWread(file, &header, sizeof(header), 1) == 1
+	&&  header.magic == PRERENDER_MAGIC
+	&&  header.version == PRERENDER_VERSION
+	&&  header.rate == SYNTH_SAMPLERATE
+	&&  header.loopEnd <= header.frames
+	&&  (header.loopEnd == 0 || header.loopStart < header.loopEnd))
+		return file;
+
+	SDL_RWclose(file);
+
+	return 0;
+}
+
+bool prerenderMidi(const std::vector<uint8_t> &data, bool looped,
+                   const std::string &path, const AtomicFlag &abort)
+{
+	MidiSource *source;
+
+	try
+	{
+		source = new MidiSource(data, looped);
+	}
+	catch (const Exception &)
+	{
+		return false;
+	}
+
+	/* Written under a temporary name first, so the
+	 * track can't be opened while incomplete */
+	std::string tempPath = path + ".tmp";
+	SDL_RWops *out = RWFromFile(tempPath.c_str(), "wb");
+
+	if (!out)
+	{
+		delete source;
+		return false;
+	}
+
+	PrerenderHeader header;
+	header.magic = PRERENDER_MAGIC;
+	header.version = PRERENDER_VERSION;
+	header.rate = source->freq;
+	header.frames = header.loopStart = header.loopEnd = 0;
+
+	const uint32_t bufFrames = BUF_TICKS * TICK_FRAMES;
+	const uint32_t tailFrames = PRERENDER_TAIL_SECONDS * header.rate;
+	const uint32_t maxFrames = PRERENDER_MAX_SECONDS * header.rate;
+
+	bool ok = SDL_RWwrite(out, &header, sizeof(header), 1) == 1;
+	bool loopFound = false;
+
+	while (ok)
+	{
+		if (abort || header.frames >= maxFrames)
+		{
+			ok = false;
+			break;
+		}
+
+		ALDataSource::Status status = source->render();
+
+		uint32_t frames = bufFrames;
+		bool done = (status == ALDataSource::EndOfStream);
+
+		if (!done && looped && source->endFrame > source->loopFrame
+		&&  source->endFrame + tailFrames <= header.frames + bufFrames)
+		{
+			frames = source->endFrame + tailFrames - header.frames;
+			loopFound = done = true;
+		}
+
+		if (SDL_RWwrite(out, source->synthBuf, sizeof(int16_t) * 2, frames) < frames)
+			ok = false;
+
+		header.frames += frames;
+
+		if (done)
+			break;
+	}
+
+	if (loopFound)
+	{
+		/* Wrap from the end of the tail to the equally far
+		 * advanced point after the loop start */
+		header.loopStart = source->loopFrame + tailFrames;
+		header.loopEnd = source->endFrame + tailFrames;
+	}
+
+	delete source;
+
+	if (ok)
+	{
+		SDL_RWseek(out, 0, RW_SEEK_SET);
+		ok = SDL_RWwrite(out, &header, sizeof(header), 1) == 1;
+	}
+
+	ok = (SDL_RWclose(out) == 0) && ok;
+
+	/* Replaces outdated renderings of the same track */
+	if (ok && FileSystem::replaceFile(tempPath, path))
+		return true;
+
+	FileSystem::removeFile(tempPath);
+
+	return false;
+}
+
 ALDataSource *createMidiSource(SDL_RWops &ops,
                                bool looped)
 {
-	return new MidiSource(ops, looped);
+	size_t dataLen = SDL_RWsize(&ops);
+	std::vector<uint8_t> data(dataLen);
+
+	size_t read = SDL_RWread(&ops, &data[0], 1, dataLen);
+	SDL_RWclose(&ops);
+
+	if (read < dataLen)
+		throw Exception(Exception::MKXPError, "Reading midi data failed");
+
+	SharedMidiState &midiState = shState->midiState();
+	std::string path = midiState.prerenderPath(data, looped);
+
+	if (path.empty())
+		return new MidiSource(data, looped);
+
+	PrerenderHeader header;
+	SDL_RWops *file = openPrerendered(path, header);
+
+	if (file)
+		return new PrerenderedMidiSource(file, header, data, looped);
+
+	/* Synthesize live until the rendering is done */
+	MidiSource *source = new MidiSource(data, looped);
+	midiState.queuePrerender(data, looped, path);
+
+	return source;
 }
@@ -0,0 +1,631 @@
+/*
+** mkxppack.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mkxppack.h"
+#include "util.h"
+
+#include <zlib.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define PHYSFS_ALLOC(type) \
+	static_cast<type*>(PHYSFS_getAllocator()->Malloc(sizeof(type)))
+
+/* Fixed size part of an entry table record */
+#define ENTRY_RECORD_SIZE (8 + 4 + 2)
+#define BLOCK_RECORD_SIZE (8 + 4)
+
+struct PACK_entry
+{
+	uint64_t size;
+	uint32_t firstBlock;
+
+	/* Offset of the null terminated path in the name arena */
+	uint32_t nameOffset;
+};
+
+struct PACK_block
+{
+	uint64_t offset;
+	uint32_t packedSize;
+};
+
+struct PACK_archiveData
+{
+	PHYSFS_Io *archiveIo;
+	uint32_t blockSize;
+
+	/* Sorted by path */
+	std::vector<PACK_entry> entries;
+	std::vector<PACK_block> blocks;
+
+	std::vector<char> nameArena;
+
+	const char *name(const PACK_entry &entry) const
+	{
+		return &nameArena[entry.nameOffset];
+	}
+};
+
+struct PACK_entryHandle
+{
+	const PACK_archiveData *archive;
+	const PACK_entry *entry;
+	PHYSFS_Io *io;
+
+	uint64_t currentOffset;
+
+	/* Most recently decompressed block, so that small
+	 * sequential reads don't inflate the same block
+	 * over and over again */
+	std::vector<uint8_t> block;
+	int64_t blockIndex;
+
+	/* Scratch space for compressed block data */
+	std::vector<uint8_t> packed;
+
+	PACK_entryHandle(const PACK_archiveData *archive,
+	                 const PACK_entry *entry)
+	    : archive(archive),
+	      entry(entry),
+	      currentOffset(0),
+	      blockIndex(-1)
+	{
+		io = archive->archiveIo->duplicate(archive->archiveIo);
+	}
+
+	PACK_entryHandle(const PACK_entryHandle &other)
+	    : archive(other.archive),
+	      entry(other.entry),
+	      currentOffset(other.currentOffset),
+	      blockIndex(-1)
+	{
+		io = other.io->duplicate(other.io);
+	}
+
+	~PACK_entryHandle()
+	{
+		if (io)
+			io->destroy(io);
+	}
+};
+
+static inline uint16_t
+unpackUint16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+unpackUint32(const uint8_t *p)
+{
+	return (uint32_t) p[0]
+	     | ((uint32_t) p[1] << 8)
+	     | ((uint32_t) p[2] << 16)
+	     | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+unpackUint64(const uint8_t *p)
+{
+	return (uint64_t) unpackUint32(p)
+	     | ((uint64_t) unpackUint32(p+4) << 32);
+}
+
+static inline bool
+startsWith(const char *str, const char *prefix, size_t prefixLen)
+{
+	return strncmp(str, prefix, prefixLen) == 0;
+}
+
+/* Index of the first entry whose path doesn't compare
+ * less than 'path' */
+static size_t
+lowerBound(const PACK_archiveData *data, const char *path)
+{
+	size_t lo = 0, hi = data->entries.size();
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (strcmp(data->name(data->entries[mid]), path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static const PACK_entry *
+findEntry(const PACK_archiveData *data, const char *path)
+{
+	size_t i = lowerBound(data, path);
+
+	if (i == data->entries.size() || strcmp(data->name(data->entries[i]), path))
+		return 0;
+
+	return &data->entries[i];
+}
+
+/* Directories aren't stored explicitly; 'dir' exists if any
+ * entry path starts with "dir/". Returns the first such entry */
+static size_t
+findDirectory(const PACK_archiveData *data, const std::string &prefix)
+{
+	size_t i = lowerBound(data, prefix.c_str());
+
+	if (i < data->entries.size()
+	&&  startsWith(data->name(data->entries[i]), prefix.c_str(), prefix.size()))
+		return i;
+
+	return data->entries.size();
+}
+
+static std::string
+directoryPrefix(const char *dirname)
+{
+	std::string prefix(dirname);
+
+	if (!prefix.empty())
+		prefix += '/';
+
+	return prefix;
+}
+
+static bool
+readBlock(PACK_entryHandle *handle, uint32_t index, uint8_t *dst, uint32_t dstLen)
+{
+	const PACK_archiveData *data = handle->archive;
+	const PACK_block &block = data->blocks[handle->entry->firstBlock + index];
+
+	if (!handle->io->seek(handle->io, block.offset))
+		return false;
+
+	/* Stored uncompressed */
+	if (block.packedSize == dstLen)
+		return handle->io->read(handle->io, dst, dstLen) == (PHYSFS_sint64) dstLen;
+
+	handle->packed.resize(block.packedSize);
+
+	if (handle->io->read(handle->io, dataPtr(handle->packed), block.packedSize)
+	    != (PHYSFS_sint64) block.packedSize)
+		return false;
+
+	uLongf destLen = dstLen;
+
+	if (uncompress(dst, &destLen, dataPtr(handle->packed), block.packedSize) != Z_OK
+	||  destLen != dstLen)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+		return false;
+	}
+
+	return true;
+}
+
+static PHYSFS_sint64
+PACK_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+{
+	PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+
+	const uint64_t size = handle->entry->size;
+	const uint32_t blockSize = handle->archive->blockSize;
+
+	if (handle->currentOffset >= size || len == 0)
+		return 0;
+
+	len = std::min<uint64_t>(len, size - handle->currentOffset);
+
+	uint8_t *dst = static_cast<uint8_t*>(buffer);
+	uint64_t remaining = len;
+
+	while (remaining > 0)
+	{
+		uint32_t index = handle->currentOffset / blockSize;
+		uint32_t inBlock = handle->currentOffset % blockSize;
+		uint64_t blockStart = (uint64_t) index * blockSize;
+		uint32_t blockLen = std::min<uint64_t>(blockSize, size - blockStart);
+		uint32_t toCopy = std::min<uint64_t>(blockLen - inBlock, remaining);
+
+		if (index != handle->blockIndex && inBlock == 0 && toCopy == blockLen)
+		{
+			/* Whole block requested, skip the intermediate copy */
+			if (!readBlock(handle, index, dst, blockLen))
+				break;
+		}
+		else
+		{
+			if (index != handle->blockIndex)
+			{
+				handle->block.resize(blockSize);
+
+				if (!readBlock(handle, index, dataPtr(handle->block), blockLen))
+				{
+					handle->blockIndex = -1;
+					break;
+				}
+
+				handle->blockIndex = index;
+			}
+
+			memcpy(dst, &handle->block[inBlock], toCopy);
+		}
+
+		dst += toCopy;
+		remaining -= toCopy;
+		handle->currentOffset += toCopy;
+	}
+
+	if (remaining == len)
+		return -1;
+
+	return len - remaining;
+}
+
+static int
+PACK_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
+{
+	PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+
+	if (offset > handle->entry->size)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_PAST_EOF);
+		return 0;
+	}
+
+	/* Random access only costs at most one block inflate */
+	handle->currentOffset = offset;
+
+	return 1;
+}
+
+static PHYSFS_sint64
+PACK_ioTell(PHYSFS_Io *self)
+{
+	const PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+
+	return handle->currentOffset;
+}
+
+static PHYSFS_sint64
+PACK_ioLength(PHYSFS_Io *self)
+{
+	const PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+
+	return handle->entry->size;
+}
+
+static PHYSFS_Io*
+PACK_ioDuplicate(PHYSFS_Io *self)
+{
+	const PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+	PACK_entryHandle *handleDup = new PACK_entryHandle(*handle);
+
+	PHYSFS_Io *dup = PHYSFS_ALLOC(PHYSFS_Io);
+	*dup = *self;
+	dup->opaque = handleDup;
+
+	return dup;
+}
+
+static void
+PACK_ioDestroy(PHYSFS_Io *self)
+{
+	PACK_entryHandle *handle = static_cast<PACK_entryHandle*>(self->opaque);
+
+	delete handle;
+
+	PHYSFS_getAllocator()->Free(self);
+}
+
+static const PHYSFS_Io PACK_IoTemplate =
+{
+    0, /* version */
+    0, /* opaque */
+    PACK_ioRead,
+    0, /* write */
+    PACK_ioSeek,
+    PACK_ioTell,
+    PACK_ioLength,
+    PACK_ioDuplicate,
+    0, /* flush */
+    PACK_ioDestroy
+};
+
+static bool
+parseIndex(PACK_archiveData *data, const std::vector<uint8_t> &index,
+           uint32_t entryCount, uint32_t blockCount)
+{
+	const uint8_t *p = dataPtr(index);
+	const uint8_t *end = p + index.size();
+
+	data->entries.resize(entryCount);
+
+	for (uint32_t i = 0; i < entryCount; ++i)
+	{
+		if (end - p < ENTRY_RECORD_SIZE)
+			return false;
+
+		PACK_entry &entry = data->entries[i];
+		entry.size = unpackUint64(p);
+		entry.firstBlock = unpackUint32(p+8);
+
+		uint16_t nameLen = unpackUint16(p+12);
+		p += ENTRY_RECORD_SIZE;
+
+		if (nameLen == 0 || end - p < nameLen)
+			return false;
+
+		if (memchr(p, '\0', nameLen))
+			return false;
+
+		uint64_t blocks = (entry.size + data->blockSize - 1) / data->blockSize;
+
+		if (entry.firstBlock > blockCount || blocks > blockCount - entry.firstBlock)
+			return false;
+
+		entry.nameOffset = data->nameArena.size();
+		data->nameArena.insert(data->nameArena.end(), p, p + nameLen);
+		data->nameArena.push_back('\0');
+		p += nameLen;
+	}
+
+	if ((uint64_t) (end - p) < (uint64_t) blockCount * BLOCK_RECORD_SIZE)
+		return false;
+
+	data->blocks.resize(blockCount);
+
+	for (uint32_t i = 0; i < blockCount; ++i)
+	{
+		data->blocks[i].offset = unpackUint64(p);
+		data->blocks[i].packedSize = unpackUint32(p+8);
+		p += BLOCK_RECORD_SIZE;
+	}
+
+	/* Lookups binary search the entry table, so it
+	 * must be strictly ordered */
+	for (uint32_t i = 1; i < entryCount; ++i)
+		if (strcmp(data->name(data->entries[i-1]), data->name(data->entries[i])) >= 0)
+			return false;
+
+	return true;
+}
+
+static void*
+PACK_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
+{
+	if (forWrite)
+		return NULL;
+
+	uint8_t header[MKXPPACK_HEADER_SIZE];
+
+	if (!io->seek(io, 0))
+		return NULL;
+
+	if (io->read(io, header, sizeof(header)) != sizeof(header))
+		return NULL;
+
+	if (memcmp(header, MKXPPACK_MAGIC, 8))
+		return NULL;
+
+	*claimed = 1;
+
+	uint32_t version    = unpackUint32(&header[8]);
+	uint32_t blockSize  = unpackUint32(&header[12]);
+	uint32_t entryCount = unpackUint32(&header[16]);
+	uint32_t blockCount = unpackUint32(&header[20]);
+	uint64_t indexOffset = unpackUint64(&header[24]);
+
+	if (version != MKXPPACK_VERSION)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);
+		return NULL;
+	}
+
+	PHYSFS_sint64 length = io->length(io);
+
+	if (blockSize == 0 || length < 0 || indexOffset > (uint64_t) length
+	||  indexOffset < MKXPPACK_HEADER_SIZE)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+		return NULL;
+	}
+
+	/* The whole index is read in one go */
+	std::vector<uint8_t> index(length - indexOffset);
+
+	if (!io->seek(io, indexOffset))
+		return NULL;
+
+	if (!index.empty()
+	&&  io->read(io, dataPtr(index), index.size()) != (PHYSFS_sint64) index.size())
+		return NULL;
+
+	PACK_archiveData *data = new PACK_archiveData;
+	data->archiveIo = io;
+	data->blockSize = blockSize;
+
+	if (!parseIndex(data, index, entryCount, blockCount))
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+		delete data;
+		return NULL;
+	}
+
+	return data;
+}
+
+static PHYSFS_EnumerateCallbackResult
+PACK_enumerateFiles(void *opaque, const char *dirname,
+                    PHYSFS_EnumerateCallback cb,
+                    const char *origdir, void *callbackdata)
+{
+	PACK_archiveData *data = static_cast<PACK_archiveData*>(opaque);
+
+	std::string prefix = directoryPrefix(dirname);
+	size_t i = findDirectory(data, prefix);
+
+	if (i == data->entries.size())
+		return PHYSFS_ENUM_STOP;
+
+	/* All paths under 'dirname' are adjacent in the sorted table,
+	 * and so are all paths under each of its subdirectories */
+	std::string child, lastChild;
+
+	for (; i < data->entries.size(); ++i)
+	{
+		const char *path = data->name(data->entries[i]);
+
+		if (!startsWith(path, prefix.c_str(), prefix.size()))
+			break;
+
+		const char *base = path + prefix.size();
+		const char *slash = strchr(base, '/');
+
+		child.assign(base, slash ? slash - base : strlen(base));
+
+		if (child == lastChild)
+			continue;
+
+		PHYSFS_EnumerateCallbackResult result =
+			cb(callbackdata, origdir, child.c_str());
+
+		if (result != PHYSFS_ENUM_OK)
+			return result;
+
+		lastChild.swap(child);
+	}
+
+	return PHYSFS_ENUM_OK;
+}
+
+static PHYSFS_Io*
+PACK_openRead(void *opaque, const char *filename)
+{
+	PACK_archiveData *data = static_cast<PACK_archiveData*>(opaque);
+
+	const PACK_entry *entry = findEntry(data, filename);
+
+	if (!entry)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	PACK_entryHandle *handle = new PACK_entryHandle(data, entry);
+
+	PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
+
+	*io = PACK_IoTemplate;
+	io->opaque = handle;
+
+	return io;
+}
+
+static int
+PACK_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
+{
+	PACK_archiveData *data = static_cast<PACK_archiveData*>(opaque);
+
+	const PACK_entry *entry = findEntry(data, filename);
+	bool hasDir = false;
+
+	if (!entry)
+	{
+		std::string prefix = directoryPrefix(filename);
+		hasDir = prefix.empty()
+		      || findDirectory(data, prefix) != data->entries.size();
+	}
+
+	if (!entry && !hasDir)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	stat->modtime    =
+	stat->createtime =
+	stat->accesstime = 0;
+	stat->readonly   = 1;
+
+	if (entry)
+	{
+		stat->filesize = entry->size;
+		stat->filetype = PHYSFS_FILETYPE_REGULAR;
+	}
+	else
+	{
+		stat->filesize = 0;
+		stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+	}
+
+	return 1;
+}
+
+static void
+PACK_closeArchive(void *opaque)
+{
+	PACK_archiveData *data = static_cast<PACK_archiveData*>(opaque);
+
+	/* Once opened, the archive owns the io it was opened from */
+	data->archiveIo->destroy(data->archiveIo);
+
+	delete data;
+}
+
+static PHYSFS_Io*
+PACK_noop1(void*, const char*)
+{
+	return 0;
+}
+
+static int
+PACK_noop2(void*, const char*)
+{
+	return 0;
+}
+
+const PHYSFS_Archiver MKXPPACK_Archiver =
+{
+	0,
+	{
+		MKXPPACK_EXTENSION,
+		"mkxp compressed game pack",
+		"", /* Author */
+		"", /* Website */
+		0 /* symlinks not supported */
+	},
+	PACK_openArchive,
+	PACK_enumerateFiles,
+	PACK_openRead,
+	PACK_noop1, /* openWrite */
+	PACK_noop1, /* openAppend */
+	PACK_noop2, /* remove */
+	PACK_noop2, /* mkdir */
+	PACK_stat,
+	PACK_closeArchive
+};
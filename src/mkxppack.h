@@ -0,0 +1,60 @@
+/*
+** mkxppack.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MKXPPACK_H
+#define MKXPPACK_H
+
+#include <physfs.h>
+
+/* mkxp pack format (all integers little endian):
+ *
+ * Header:
+ *   char   magic[8]       "MKXPPACK"
+ *   uint32 version        MKXPPACK_VERSION
+ *   uint32 blockSize      Uncompressed size of every block
+ *                         (except the last one of each entry)
+ *   uint32 entryCount
+ *   uint32 blockCount
+ *   uint64 indexOffset    Start of the entry table
+ *
+ * Block data (zlib streams or stored bytes)
+ *
+ * Entry table, sorted by path (bytewise), one per file:
+ *   uint64 size           Uncompressed file size
+ *   uint32 firstBlock     Index into the block table; the file's
+ *                         blocks are stored consecutively. Identical
+ *                         files may share the same blocks
+ *   uint16 nameLen
+ *   char   name[nameLen]  '/' separated, no terminating null
+ *
+ * Block table, one per block:
+ *   uint64 offset
+ *   uint32 packedSize     If equal to the uncompressed block size,
+ *                         the block is stored uncompressed */
+
+#define MKXPPACK_MAGIC "MKXPPACK"
+#define MKXPPACK_VERSION 1
+#define MKXPPACK_HEADER_SIZE 32
+#define MKXPPACK_EXTENSION "mkxpack"
+
+extern const PHYSFS_Archiver MKXPPACK_Archiver;
+
+#endif // MKXPPACK_H
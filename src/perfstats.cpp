@@ -0,0 +1,79 @@
+/*
+** perfstats.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "perfstats.h"
+
+#include <string.h>
+
+PerfStats perfStats;
+
+void PerfCounters::add(const PerfCounters &o)
+{
+	drawCalls      += o.drawCalls;
+	texBinds       += o.texBinds;
+	shaderSwitches += o.shaderSwitches;
+	bytesUploaded  += o.bytesUploaded;
+	etcAllocs      += o.etcAllocs;
+}
+
+void PerfCounters::clear()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+PerfStats::PerfStats()
+{
+	current.clear();
+	reset();
+}
+
+void PerfStats::endFrame(uint32_t frameUs, uint32_t busyUs,
+                         uint32_t targetUs, bool skipped)
+{
+	lastFrame = current;
+	total.add(current);
+	current.clear();
+
+	++frames;
+
+	if (skipped)
+		++skippedFrames;
+
+	if (frameUs > targetUs + targetUs / 2)
+		++longFrames;
+
+	frameTime[histPos] = frameUs;
+	busyTime[histPos] = busyUs;
+
+	histPos = (histPos + 1) % PERF_FRAME_HISTORY;
+
+	if (histCount < PERF_FRAME_HISTORY)
+		++histCount;
+}
+
+void PerfStats::reset()
+{
+	lastFrame.clear();
+	total.clear();
+
+	frames = skippedFrames = longFrames = 0;
+	histPos = histCount = 0;
+}
@@ -0,0 +1,92 @@
+/*
+** perfstats.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+#include <stdint.h>
+
+/* Number of frames the timing averages are taken over */
+#define PERF_FRAME_HISTORY 60
+
+struct PerfCounters
+{
+	uint32_t drawCalls;
+	uint32_t texBinds;
+	uint32_t shaderSwitches;
+	uint64_t bytesUploaded;
+
+	/* Color, Tone and Rect objects created */
+	uint32_t etcAllocs;
+
+	void add(const PerfCounters &o);
+	void clear();
+};
+
+/* Engine internal metrics, read by scripts through 'MKXP::Stats'.
+ * Everything counted here happens on the RGSS thread, so
+ * the counters are plain integers */
+struct PerfStats
+{
+	/* Counts of the frame in progress */
+	PerfCounters current;
+
+	/* Counts of the last finished frame */
+	PerfCounters lastFrame;
+
+	/* Counts since startup (or the last 'reset()'),
+	 * not including the frame in progress */
+	PerfCounters total;
+
+	uint32_t frames;
+	uint32_t skippedFrames;
+
+	/* Frames taking more than 1.5 times as long as intended */
+	uint32_t longFrames;
+
+	/* Microseconds, per frame: from the end of the previous
+	 * frame to the end of this one ('frameTime'), and the part
+	 * of that not spent waiting on the frame limiter ('busyTime') */
+	uint32_t frameTime[PERF_FRAME_HISTORY];
+	uint32_t busyTime[PERF_FRAME_HISTORY];
+	int histPos;
+	int histCount;
+
+	PerfStats();
+
+	/* Rolls the current counters over to 'lastFrame' */
+	void endFrame(uint32_t frameUs, uint32_t busyUs,
+	              uint32_t targetUs, bool skipped);
+
+	void reset();
+};
+
+extern PerfStats perfStats;
+
+/* Counters can be compiled out with NO_PERF_STATS,
+ * frame timings are always taken */
+#ifdef NO_PERF_STATS
+#define PERF_COUNT(counter, n) ((void) 0)
+#else
+#define PERF_COUNT(counter, n) (perfStats.current.counter += (n))
+#endif
+
+#endif // PERFSTATS_H
@@ -106,6 +106,7 @@ struct QuadArray
 
 		const char *_offset = (const char*) 0 + offset * 6 * sizeof(index_t);
 		gl.DrawElements(GL_TRIANGLES, count * 6, _GL_INDEX_TYPE, _offset);
+		PERF_COUNT(drawCalls, 1);
 
 		GLMeta::vaoUnbind(vao);
 	}
@@ -21,9 +21,15 @@
 
 #include "rgssad.h"
 #include "boost-hash.h"
+#include "intrulist.h"
+#include "util.h"
+
+#include <SDL_atomic.h>
+#include <SDL_mutex.h>
 
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 
 struct RGSS_entryData
 {
@@ -32,24 +38,117 @@ struct RGSS_entryData
 	uint32_t startMagic;
 };
 
+/* The fully decrypted contents of an archive entry. Shared
+ * between the entry cache and any handles reading from it */
+struct RGSS_cachedEntry
+{
+	/* Entry path this was cached under */
+	std::string key;
+
+	std::vector<uint8_t> data;
+
+	/* Link into the cache's LRU list */
+	IntruListLink<RGSS_cachedEntry> link;
+
+	RGSS_cachedEntry()
+	    : link(this)
+	{
+		SDL_AtomicSet(&refCount, 1);
+	}
+
+	static RGSS_cachedEntry *ref(RGSS_cachedEntry *entry)
+	{
+		SDL_AtomicIncRef(&entry->refCount);
+
+		return entry;
+	}
+
+	/* Handles may be closed from any thread */
+	static void deref(RGSS_cachedEntry *entry)
+	{
+		if (SDL_AtomicDecRef(&entry->refCount))
+			delete entry;
+	}
+
+private:
+	SDL_atomic_t refCount;
+};
+
 struct RGSS_entryHandle
 {
 	const RGSS_entryData data;
 	uint32_t currentMagic;
 	uint64_t currentOffset;
+
+	/* Exactly one of these is set: either we decrypt
+	 * straight from the archive, or read from an already
+	 * decrypted copy held in the entry cache */
 	PHYSFS_Io *io;
+	RGSS_cachedEntry *cached;
 
 	RGSS_entryHandle(const RGSS_entryData &data, PHYSFS_Io *archIo)
 	    : data(data),
 	      currentMagic(data.startMagic),
-	      currentOffset(0)
+	      currentOffset(0),
+	      cached(0)
 	{
 		io = archIo->duplicate(archIo);
 	}
 
+	RGSS_entryHandle(const RGSS_entryData &data, RGSS_cachedEntry *cached)
+	    : data(data),
+	      currentMagic(data.startMagic),
+	      currentOffset(0),
+	      io(0),
+	      cached(RGSS_cachedEntry::ref(cached))
+	{}
+
+	RGSS_entryHandle(const RGSS_entryHandle &other)
+	    : data(other.data),
+	      currentMagic(other.currentMagic),
+	      currentOffset(other.currentOffset),
+	      io(0),
+	      cached(0)
+	{
+		if (other.cached)
+			cached = RGSS_cachedEntry::ref(other.cached);
+		else
+			io = other.io->duplicate(other.io);
+	}
+
 	~RGSS_entryHandle()
 	{
-		io->destroy(io);
+		if (cached)
+			RGSS_cachedEntry::deref(cached);
+		else
+			io->destroy(io);
+	}
+};
+
+/* LRU cache of decrypted entries, one per mounted archive */
+struct RGSS_entryCache
+{
+	/* Maps: file path
+	 * to:   decrypted entry */
+	BoostHash<std::string, RGSS_cachedEntry*> hash;
+
+	/* Most recently used entries first */
+	IntruList<RGSS_cachedEntry> lru;
+
+	/* Byte count sum of all cached entries */
+	size_t bytes;
+
+	/* Archives may be read from several threads at once */
+	SDL_mutex *mutex;
+
+	RGSS_entryCache()
+	    : bytes(0),
+	      mutex(SDL_CreateMutex())
+	{}
+
+	~RGSS_entryCache()
+	{
+		SDL_DestroyMutex(mutex);
 	}
 };
 
@@ -61,25 +160,144 @@ struct RGSS_archiveData
 	 * to:   entry data */
 	BoostHash<std::string, RGSS_entryData> entryHash;
 
+	/* Null terminated entry and directory paths,
+	 * packed back to back */
+	std::vector<char> nameArena;
+
 	/* Maps: directory path,
-	 * to:   list of contained entries */
-	BoostHash<std::string, BoostSet<std::string> > dirHash;
+	 * to:   list of contained entries (arena offsets
+	 *       of their base names) */
+	BoostHash<std::string, std::vector<uint32_t> > dirHash;
+
+	RGSS_entryCache cache;
 };
 
+/* Memory budget of each archive's entry cache (0 = disabled) */
+static size_t entryCacheLimit = 0;
+
+/* Aggregated over all mounted archives */
+static struct
+{
+	SDL_atomic_t hits;
+	SDL_atomic_t misses;
+	SDL_atomic_t evictions;
+	SDL_atomic_t entries;
+	SDL_atomic_t bytes;
+} entryCacheStats;
+
+static uint32_t
+unpackUint32(const uint8_t *buff)
+{
+	return (buff[0] << 0x00) |
+	       (buff[1] << 0x08) |
+	       (buff[2] << 0x10) |
+	       (buff[3] << 0x18) ;
+}
+
 static bool
 readUint32(PHYSFS_Io *io, uint32_t &result)
 {
-	char buff[4];
+	uint8_t buff[4];
 	PHYSFS_sint64 count = io->read(io, buff, 4);
 
-	result = ((buff[0] << 0x00) & 0x000000FF) |
-	         ((buff[1] << 0x08) & 0x0000FF00) |
-	         ((buff[2] << 0x10) & 0x00FF0000) |
-	         ((buff[3] << 0x18) & 0xFF000000) ;
+	result = unpackUint32(buff);
 
 	return (count == 4);
 }
 
+/* Reads the archive's entry table through an intermediate
+ * buffer, so we don't hit the io with a separate read for
+ * every single header field and name */
+struct RGSS_headerReader
+{
+	PHYSFS_Io *io;
+	std::vector<uint8_t> buf;
+
+	/* Archive offset of buf[0] */
+	uint64_t bufBase;
+	size_t bufLen;
+	size_t bufPos;
+
+	/* The io is always positioned at (bufBase + bufLen) */
+	RGSS_headerReader(PHYSFS_Io *io, size_t chunkSize)
+	    : io(io),
+	      buf(chunkSize),
+	      bufBase(io->tell(io)),
+	      bufLen(0),
+	      bufPos(0)
+	{}
+
+	bool read(void *dest, size_t size)
+	{
+		uint8_t *destP = static_cast<uint8_t*>(dest);
+
+		while (size > 0)
+		{
+			if (bufPos == bufLen && !refill())
+				return false;
+
+			size_t avail = std::min(bufLen - bufPos, size);
+			memcpy(destP, &buf[bufPos], avail);
+
+			destP += avail;
+			bufPos += avail;
+			size -= avail;
+		}
+
+		return true;
+	}
+
+	bool readUint32(uint32_t &result)
+	{
+		uint8_t buff[4];
+
+		if (!read(buff, 4))
+			return false;
+
+		result = unpackUint32(buff);
+
+		return true;
+	}
+
+	uint64_t tell() const
+	{
+		return bufBase + bufPos;
+	}
+
+	bool seek(uint64_t offset)
+	{
+		/* Stay inside the buffer if we can */
+		if (offset >= bufBase && offset <= bufBase + bufLen)
+		{
+			bufPos = offset - bufBase;
+			return true;
+		}
+
+		if (!io->seek(io, offset))
+			return false;
+
+		bufBase = offset;
+		bufLen = bufPos = 0;
+
+		return true;
+	}
+
+private:
+	bool refill()
+	{
+		PHYSFS_sint64 count = io->read(io, &buf[0], buf.size());
+
+		if (count <= 0)
+			return false;
+
+		bufBase += bufLen;
+		bufLen = count;
+		bufPos = 0;
+
+		return true;
+	}
+};
+
 #define RGSS_HEADER "RGSSAD"
 #define RGSS_MAGIC 0xDEADCAFE
 
@@ -98,6 +316,26 @@ advanceMagic(uint32_t &magic)
 	return old;
 }
 
+/* Advances the magic by 'count' steps at once. A step is the
+ * affine map m -> m*7 + 3, so 'count' steps can be composed
+ * by repeated squaring instead of being applied one by one */
+static inline void
+advanceMagic(uint32_t &magic, uint64_t count)
+{
+	uint32_t mul = 7;
+	uint32_t add = 3;
+
+	while (count > 0)
+	{
+		if (count & 1)
+			magic = magic * mul + add;
+
+		add = add * mul + add;
+		mul = mul * mul;
+		count >>= 1;
+	}
+}
+
 static PHYSFS_sint64
 RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 {
@@ -108,6 +346,15 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 	uint64_t toRead = std::min<uint64_t>(entry->data.size - entry->currentOffset, len);
 	uint64_t offs = entry->currentOffset;
 
+	if (entry->cached)
+	{
+		/* Already decrypted, nothing to do but copy */
+		memcpy(buffer, &entry->cached->data[offs], toRead);
+		entry->currentOffset += toRead;
+
+		return toRead;
+	}
+
 	io->seek(io, entry->data.offset + offs);
 
 	/* We divide up the bytes to be read in 3 categories:
@@ -205,6 +452,13 @@ RGSS_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
 	if (offset > entry->data.size-1)
 		return 0;
 
+	if (entry->cached)
+	{
+		entry->currentOffset = offset;
+
+		return 1;
+	}
+
 	/* If rewinding, we need to rewind to begining */
 	if (offset < entry->currentOffset)
 	{
@@ -215,10 +469,8 @@ RGSS_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
 	/* For each overstepped alignment, advance magic */
 	uint64_t currentDword = entry->currentOffset / 4;
 	uint64_t targetDword  = offset / 4;
-	uint64_t dwordsSought = targetDword - currentDword;
 
-	for (uint64_t i = 0; i < dwordsSought; ++i)
-		advanceMagic(entry->currentMagic);
+	advanceMagic(entry->currentMagic, targetDword - currentDword);
 
 	entry->currentOffset = offset;
 	entry->io->seek(entry->io, entry->data.offset + entry->currentOffset);
@@ -279,40 +531,206 @@ static const PHYSFS_Io RGSS_IoTemplate =
     RGSS_ioDestroy
 };
 
+/* Returns a new reference to the cached entry, or null */
+static RGSS_cachedEntry *
+cacheLookup(RGSS_entryCache &cache, const std::string &filename)
+{
+	SDL_LockMutex(cache.mutex);
+
+	RGSS_cachedEntry *cached = cache.hash.value(filename, 0);
+
+	if (cached)
+	{
+		/* Move to front of LRU list */
+		cache.lru.remove(cached->link);
+		cache.lru.prepend(cached->link);
+
+		RGSS_cachedEntry::ref(cached);
+		SDL_AtomicIncRef(&entryCacheStats.hits);
+	}
+	else
+	{
+		SDL_AtomicIncRef(&entryCacheStats.misses);
+	}
+
+	SDL_UnlockMutex(cache.mutex);
+
+	return cached;
+}
+
 static void
-processDirectories(RGSS_archiveData *data, BoostSet<std::string> &topLevel,
-                   char *nameBuf, uint32_t nameLen)
+cacheEvict(RGSS_entryCache &cache, RGSS_cachedEntry *cached)
+{
+	cache.hash.remove(cached->key);
+	cache.lru.remove(cached->link);
+	cache.bytes -= cached->data.size();
+
+	SDL_AtomicAdd(&entryCacheStats.bytes, -(int) cached->data.size());
+	SDL_AtomicAdd(&entryCacheStats.entries, -1);
+
+	/* Handles still reading from it keep it alive */
+	RGSS_cachedEntry::deref(cached);
+}
+
+/* Decrypts the complete entry behind 'handle' and inserts it
+ * into the cache, evicting least recently used entries until
+ * it fits. Returns a new reference to the cached entry */
+static RGSS_cachedEntry *
+cacheInsert(RGSS_entryCache &cache, const std::string &filename,
+            RGSS_entryHandle *handle)
 {
-	/* Check for top level entries */
-	for (uint32_t i = 0; i < nameLen; ++i)
+	RGSS_cachedEntry *fresh = new RGSS_cachedEntry;
+	fresh->key = filename;
+	fresh->data.resize(handle->data.size);
+
+	if (!fresh->data.empty())
 	{
-		bool slash = nameBuf[i] == '/';
-		if (!slash && i+1 < nameLen)
-			continue;
+		PHYSFS_Io io = RGSS_IoTemplate;
+		io.opaque = handle;
+
+		if (RGSS_ioRead(&io, &fresh->data[0], fresh->data.size())
+		    != (PHYSFS_sint64) fresh->data.size())
+		{
+			/* Leave the handle rewound for uncached reading */
+			handle->currentOffset = 0;
+			handle->currentMagic = handle->data.startMagic;
+
+			RGSS_cachedEntry::deref(fresh);
+			return 0;
+		}
+	}
 
-		if (slash)
-			nameBuf[i] = '\0';
+	SDL_LockMutex(cache.mutex);
 
-		topLevel.insert(nameBuf);
+	RGSS_cachedEntry *cached = cache.hash.value(filename, 0);
 
-		if (slash)
-			nameBuf[i] = '/';
+	/* Another thread might have beaten us to it */
+	if (cached)
+	{
+		RGSS_cachedEntry::ref(cached);
+		SDL_UnlockMutex(cache.mutex);
+		RGSS_cachedEntry::deref(fresh);
 
-		break;
+		return cached;
 	}
 
-	/* Check for more entries */
-	for (uint32_t i = nameLen; i > 0; i--)
-		if (nameBuf[i] == '/')
-		{
-			nameBuf[i] = '\0';
+	while (cache.bytes + fresh->data.size() > entryCacheLimit
+	       && !cache.lru.isEmpty())
+	{
+		cacheEvict(cache, cache.lru.tail());
+		SDL_AtomicIncRef(&entryCacheStats.evictions);
+	}
 
-			const char *dir = nameBuf;
-			const char *entry = &nameBuf[i+1];
+	cache.hash.insert(filename, fresh);
+	cache.lru.prepend(fresh->link);
+	cache.bytes += fresh->data.size();
 
-			BoostSet<std::string> &entryList = data->dirHash[dir];
-			entryList.insert(entry);
-		}
+	SDL_AtomicAdd(&entryCacheStats.bytes, fresh->data.size());
+	SDL_AtomicIncRef(&entryCacheStats.entries);
+
+	SDL_UnlockMutex(cache.mutex);
+
+	/* One reference for the cache, one for the caller */
+	return RGSS_cachedEntry::ref(fresh);
+}
+
+static void
+cacheClear(RGSS_entryCache &cache)
+{
+	SDL_LockMutex(cache.mutex);
+
+	while (!cache.lru.isEmpty())
+		cacheEvict(cache, cache.lru.tail());
+
+	SDL_UnlockMutex(cache.mutex);
+}
+
+/* Appends a null terminated string to the name arena
+ * and returns its offset */
+static uint32_t
+arenaAppend(RGSS_archiveData *data, const char *str, size_t len)
+{
+	std::vector<char> &arena = data->nameArena;
+	uint32_t offset = arena.size();
+
+	arena.insert(arena.end(), str, str + len);
+	arena.push_back('\0');
+
+	return offset;
+}
+
+/* Offset of the path component following the last slash */
+static uint32_t
+baseNameOffset(const char *path, size_t len)
+{
+	for (size_t i = len; i > 0; --i)
+		if (path[i-1] == '/')
+			return i;
+
+	return 0;
+}
+
+/* Returns the entry list of directory 'dir' (of length 'len'),
+ * creating it and registering it with its parent directories
+ * if it didn't exist yet */
+static std::vector<uint32_t> &
+ensureDirectory(RGSS_archiveData *data, const char *dir, size_t len)
+{
+	std::string key(dir, len);
+
+	if (data->dirHash.contains(key))
+		return data->dirHash[key];
+
+	/* Register with parent first, this might
+	 * insert into dirHash */
+	if (len > 0)
+	{
+		uint32_t base = baseNameOffset(dir, len);
+		size_t parentLen = (base > 0) ? base - 1 : 0;
+
+		uint32_t offset = arenaAppend(data, dir, len);
+		ensureDirectory(data, dir, parentLen).push_back(offset + base);
+	}
+
+	return data->dirHash[key];
+}
+
+/* Registers the entry at 'name' (stored in the arena
+ * at 'nameOffset') with its containing directory */
+static void
+processDirectories(RGSS_archiveData *data, uint32_t nameOffset,
+                   const char *name, uint32_t nameLen)
+{
+	uint32_t base = baseNameOffset(name, nameLen);
+	size_t dirLen = (base > 0) ? base - 1 : 0;
+
+	ensureDirectory(data, name, dirLen).push_back(nameOffset + base);
+}
+
+/* Adds a complete entry to the archive indices */
+static void
+addEntry(RGSS_archiveData *data, const char *name, uint32_t nameLen,
+         const RGSS_entryData &entry)
+{
+	std::string key(name, nameLen);
+
+	/* Of duplicate entries, the first one wins */
+	if (data->entryHash.contains(key))
+		return;
+
+	uint32_t nameOffset = arenaAppend(data, name, nameLen);
+
+	data->entryHash.insert(key, entry);
+	processDirectories(data, nameOffset, name, nameLen);
+}
+
+/* Most archives contain several hundred to a few thousand
+ * entries, spread over a handful of directories */
+static void
+reserveIndices(RGSS_archiveData *data)
+{
+	data->nameArena.reserve(64 * 1024);
+	ensureDirectory(data, "", 0);
 }
 
 static bool
@@ -347,10 +765,13 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 	RGSS_archiveData *data = new RGSS_archiveData;
 	data->archiveIo = io;
 
+	reserveIndices(data);
+
 	uint32_t magic = RGSS_MAGIC;
 
-	/* Top level entry list */
-	BoostSet<std::string> &topLevel = data->dirHash[""];
+	/* Entry headers are interleaved with the entry data,
+	 * so we only buffer enough to hold one header at a time */
+	RGSS_headerReader reader(io, 4 + 512 + 4);
 
 	while (true)
 	{
@@ -358,36 +779,41 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
          * if nothing was read, no files remain */
 		uint32_t nameLen;
 
-		if (!readUint32(io, nameLen))
+		if (!reader.readUint32(nameLen))
 			break;
 
 		nameLen ^= advanceMagic(magic);
 
-		static char nameBuf[512];
+		/* Name and entry size in one go */
+		uint8_t nameBuf[512 + 4];
+
+		if (nameLen >= 512 || !reader.read(nameBuf, nameLen + 4))
+		{
+			delete data;
+			return NULL;
+		}
+
+		/* Decrypt in place */
 		for (uint32_t i = 0; i < nameLen; ++i)
 		{
-			char c;
-			io->read(io, &c, 1);
-			nameBuf[i] = c ^ (advanceMagic(magic) & 0xFF);
+			nameBuf[i] ^= (advanceMagic(magic) & 0xFF);
+
 			if (nameBuf[i] == '\\')
 				nameBuf[i] = '/';
 		}
 
-		nameBuf[nameLen] = '\0';
-
-		uint32_t entrySize;
-		readUint32(io, entrySize);
+		uint32_t entrySize = unpackUint32(&nameBuf[nameLen]);
 		entrySize ^= advanceMagic(magic);
 
 		RGSS_entryData entry;
-		entry.offset = io->tell(io);
+		entry.offset = reader.tell();
 		entry.size = entrySize;
 		entry.startMagic = magic;
 
-		data->entryHash.insert(nameBuf, entry);
-		processDirectories(data, topLevel, nameBuf, nameLen);
+		addEntry(data, reinterpret_cast<const char*>(nameBuf), nameLen, entry);
 
-		io->seek(io, entry.offset + entry.size);
+		if (!reader.seek(entry.offset + entry.size))
+			break;
 	}
 
 	return data;
@@ -405,11 +831,11 @@ RGSS_enumerateFiles(void *opaque, const char *dirname,
 	if (!data->dirHash.contains(_dirname))
 		return PHYSFS_ENUM_STOP;
 
-	const BoostSet<std::string> &entries = data->dirHash[_dirname];
+	const std::vector<uint32_t> &entries = data->dirHash[_dirname];
+	const char *arena = dataPtr(data->nameArena);
 
-	BoostSet<std::string>::const_iterator iter;
-	for (iter = entries.cbegin(); iter != entries.cend(); ++iter)
-		cb(callbackdata, origdir, iter->c_str());
+	for (size_t i = 0; i < entries.size(); ++i)
+		cb(callbackdata, origdir, &arena[entries[i]]);
 
 	return PHYSFS_ENUM_OK;
 }
@@ -422,8 +848,34 @@ RGSS_openRead(void *opaque, const char *filename)
 	if (!data->entryHash.contains(filename))
 		return 0;
 
-	RGSS_entryHandle *entry =
-	        new RGSS_entryHandle(data->entryHash[filename], data->archiveIo);
+	const RGSS_entryData &entryData = data->entryHash[filename];
+	RGSS_entryHandle *entry = 0;
+
+	/* Entries that would take up a large part of the budget
+	 * (eg. streamed BGM) aren't worth keeping around */
+	bool cacheable = entryCacheLimit > 0
+	              && entryData.size <= entryCacheLimit / 4;
+	RGSS_cachedEntry *cached = 0;
+
+	if (cacheable)
+		cached = cacheLookup(data->cache, filename);
+
+	if (!cached)
+	{
+		entry = new RGSS_entryHandle(entryData, data->archiveIo);
+
+		if (cacheable)
+			cached = cacheInsert(data->cache, filename, entry);
+	}
+
+	if (cached)
+	{
+		/* Serve this and all subsequent opens from memory */
+		delete entry;
+
+		entry = new RGSS_entryHandle(entryData, cached);
+		RGSS_cachedEntry::deref(cached);
+	}
 
 	PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
 
@@ -473,9 +925,29 @@ RGSS_closeArchive(void *opaque)
 {
 	RGSS_archiveData *data = static_cast<RGSS_archiveData*>(opaque);
 
+	cacheClear(data->cache);
+
+	/* Once opened, the archive owns the io it was opened from */
+	data->archiveIo->destroy(data->archiveIo);
+
 	delete data;
 }
 
+void RGSS_setEntryCacheLimit(size_t bytes)
+{
+	entryCacheLimit = bytes;
+}
+
+void RGSS_getEntryCacheStats(RGSS_EntryCacheStats &out)
+{
+	out.hits      = SDL_AtomicGet(&entryCacheStats.hits);
+	out.misses    = SDL_AtomicGet(&entryCacheStats.misses);
+	out.evictions = SDL_AtomicGet(&entryCacheStats.evictions);
+	out.entries   = SDL_AtomicGet(&entryCacheStats.entries);
+	out.bytes     = SDL_AtomicGet(&entryCacheStats.bytes);
+	out.limit     = entryCacheLimit;
+}
+
 static PHYSFS_Io*
 RGSS_noop1(void*, const char*)
 {
@@ -531,9 +1003,9 @@ const PHYSFS_Archiver RGSS2_Archiver =
 };
 
 static bool
-readUint32AndXor(PHYSFS_Io *io, uint32_t &result, uint32_t key)
+readUint32AndXor(RGSS_headerReader &reader, uint32_t &result, uint32_t key)
 {
-	if (!readUint32(io, result))
+	if (!reader.readUint32(result))
 		return false;
 
 	result ^= key;
@@ -563,34 +1035,38 @@ RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 	RGSS_archiveData *data = new RGSS_archiveData;
 	data->archiveIo = io;
 
-	/* Top level entry list */
-	BoostSet<std::string> &topLevel = data->dirHash[""];
+	reserveIndices(data);
+
+	/* The entry table is stored contiguously in front of
+	 * all entry data, so we can pull it in in large chunks */
+	RGSS_headerReader reader(io, 64 * 1024);
 
 	while (true)
 	{
 		uint32_t offset, size, magic, nameLen;
 
-		if (!readUint32AndXor(io, offset, baseMagic))
+		if (!readUint32AndXor(reader, offset, baseMagic))
 			goto error;
 
 		/* Zero offset means entry list has ended */
 		if (offset == 0)
 			break;
 
-		if (!readUint32AndXor(io, size, baseMagic))
+		if (!readUint32AndXor(reader, size, baseMagic))
 			goto error;
 
-		if (!readUint32AndXor(io, magic, baseMagic))
+		if (!readUint32AndXor(reader, magic, baseMagic))
 			goto error;
 
-		if (!readUint32AndXor(io, nameLen, baseMagic))
+		if (!readUint32AndXor(reader, nameLen, baseMagic))
 			goto error;
 
 		char nameBuf[512];
 
-		if (!IO_READ(io, nameBuf, nameLen))
+		if (nameLen >= sizeof(nameBuf) || !reader.read(nameBuf, nameLen))
 			goto error;
 
+		/* Decrypt in place */
 		for (uint32_t i = 0; i < nameLen; ++i)
 		{
 			nameBuf[i] ^= ((baseMagic >> 8*(i%4)) & 0xFF);
@@ -599,15 +1075,12 @@ RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 				nameBuf[i] = '/';
 		}
 
-		nameBuf[nameLen] = '\0';
-
 		RGSS_entryData entry;
 		entry.offset = offset;
 		entry.size = size;
 		entry.startMagic = magic;
 
-		data->entryHash.insert(nameBuf, entry);
-		processDirectories(data, topLevel, nameBuf, nameLen);
+		addEntry(data, nameBuf, nameLen, entry);
 
 		continue;
 
@@ -24,8 +24,32 @@
 
 #include <physfs.h>
 
+#include <stddef.h>
+#include <stdint.h>
+
 extern const PHYSFS_Archiver RGSS1_Archiver;
 extern const PHYSFS_Archiver RGSS2_Archiver;
 extern const PHYSFS_Archiver RGSS3_Archiver;
 
+struct RGSS_EntryCacheStats
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+
+	/* Current contents */
+	uint32_t entries;
+	size_t bytes;
+
+	size_t limit;
+};
+
+/* Sets the memory budget for decrypted archive entries
+ * kept in memory (per archive). 0 disables the cache.
+ * Should be called before mounting any archives */
+void RGSS_setEntryCacheLimit(size_t bytes);
+
+/* Statistics are aggregated over all mounted archives */
+void RGSS_getEntryCacheStats(RGSS_EntryCacheStats &out);
+
 #endif // RGSSAD_H
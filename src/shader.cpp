@@ -225,6 +225,7 @@ void Shader::setTexUniform(GLint location, unsigned unitIndex, TEX::ID texture)
 
 	gl.ActiveTexture(texUnit);
 	gl.BindTexture(GL_TEXTURE_2D, texture.gl);
+	PERF_COUNT(texBinds, 1);
 	gl.Uniform1i(location, unitIndex);
 	gl.ActiveTexture(GL_TEXTURE0);
 }
@@ -25,10 +25,21 @@
 #include "config.h"
 #include "debugwriter.h"
 #include "fluid-fun.h"
+#include "sharedsoundfont.h"
+#include "sdl-util.h"
+#include "filesystem.h"
+#include "util.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <vector>
 #include <string>
+#include <deque>
+#include <set>
+#include <algorithm>
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
 
 #define SYNTH_INIT_COUNT 2
 #define SYNTH_SAMPLERATE 44100
@@ -39,32 +50,103 @@ struct Synth
 	bool inUse;
 };
 
+/* Renders a whole midi track to a PCM cache file at 'path',
+ * giving up once 'abort' is set (defined in midisource.cpp) */
+bool prerenderMidi(const std::vector<uint8_t> &data, bool looped,
+                   const std::string &path, const AtomicFlag &abort);
+
+struct MidiPrerenderJob
+{
+	std::vector<uint8_t> data;
+	bool looped;
+	std::string path;
+};
+
 struct SharedMidiState
 {
 	bool inited;
 	std::vector<Synth> synths;
 	const std::string &soundFont;
+	SharedSoundFont sharedFont;
 	fluid_settings_t *flSettings;
 
+	/* Synths are allocated from both the RGSS
+	 * and the prerender thread */
+	SDL_mutex *mut;
+
+	/* Renders midi tracks to PCM in the background, so they
+	 * can be streamed from disk the next time they're played */
+	struct
+	{
+		bool enabled;
+		std::string cacheDir;
+
+		/* Disk space the renderings may take up, in bytes */
+		int64_t cacheBudget;
+
+		/* Identifies everything that affects the rendered sound
+		 * besides the track itself, part of the cache key */
+		std::string settingsKey;
+
+		std::deque<MidiPrerenderJob> jobs;
+
+		/* Paths of queued jobs and the one being rendered */
+		std::set<std::string> pending;
+
+		SDL_cond *jobCond;
+		SDL_Thread *thread;
+		AtomicFlag termReq;
+	} prerender;
+
 	SharedMidiState(const Config &conf)
 	    : inited(false),
 	      soundFont(conf.midi.soundFont)
-	{}
+	{
+		mut = SDL_CreateMutex();
+
+		prerender.enabled = conf.midi.prerender && !conf.commonDataPath.empty();
+		prerender.cacheDir = conf.commonDataPath;
+		prerender.cacheBudget = (int64_t) std::max(conf.midi.prerenderCacheSize, 0) * 1024 * 1024;
+		prerender.jobCond = SDL_CreateCond();
+		prerender.thread = 0;
+
+		char buf[64];
+		snprintf(buf, sizeof(buf), ":%d:%d:%d:", SYNTH_SAMPLERATE,
+		         conf.midi.chorus, conf.midi.reverb);
+
+		prerender.settingsKey = soundFont + buf;
+	}
 
 	~SharedMidiState()
 	{
 		/* We might have initialized, but if the consecutive libfluidsynth
 		 * load failed, no resources will have been allocated */
+		if (prerender.thread)
+		{
+			SDL_LockMutex(mut);
+			prerender.termReq.set();
+			SDL_CondSignal(prerender.jobCond);
+			SDL_UnlockMutex(mut);
+
+			SDL_WaitThread(prerender.thread, 0);
+		}
+
+		SDL_DestroyCond(prerender.jobCond);
+		SDL_DestroyMutex(mut);
+
 		if (!inited || !HAVE_FLUID)
 			return;
 
-		fluid.delete_settings(flSettings);
-
 		for (size_t i = 0; i < synths.size(); ++i)
 		{
 			assert(!synths[i].inUse);
 			fluid.delete_synth(synths[i].synth);
 		}
+
+		/* Only once no synth uses its data anymore */
+		sharedFont.close();
+
+		fluid.delete_settings(flSettings);
 	}
 
 	void initIfNeeded(const Config &conf)
@@ -85,8 +167,12 @@ struct SharedMidiState
 		fluid.settings_setstr(flSettings, "synth.chorus.active", conf.midi.chorus ? "yes" : "no");
 		fluid.settings_setstr(flSettings, "synth.reverb.active", conf.midi.reverb ? "yes" : "no");
 
+		SDL_LockMutex(mut);
+
 		for (size_t i = 0; i < SYNTH_INIT_COUNT; ++i)
 			addSynth(false);
+
+		SDL_UnlockMutex(mut);
 	}
 
 	fluid_synth_t *allocateSynth()
@@ -94,28 +180,36 @@ struct SharedMidiState
 		assert(HAVE_FLUID);
 		assert(inited);
 
+		SDL_LockMutex(mut);
+
 		size_t i;
 
 		for (i = 0; i < synths.size(); ++i)
 			if (!synths[i].inUse)
 				break;
 
+		fluid_synth_t *syn;
+
 		if (i < synths.size())
 		{
-			fluid_synth_t *syn = synths[i].synth;
+			syn = synths[i].synth;
 			fluid.synth_system_reset(syn);
 			synths[i].inUse = true;
-
-			return syn;
 		}
 		else
 		{
-			return addSynth(true);
+			syn = addSynth(true);
 		}
+
+		SDL_UnlockMutex(mut);
+
+		return syn;
 	}
 
 	void releaseSynth(fluid_synth_t *synth)
 	{
+		SDL_LockMutex(mut);
+
 		size_t i;
 
 		for (i = 0; i < synths.size(); ++i)
@@ -125,15 +219,129 @@ struct SharedMidiState
 		assert(i < synths.size());
 
 		synths[i].inUse = false;
+
+		SDL_UnlockMutex(mut);
+	}
+
+	/* Returns the cache file a rendering of 'data' is stored
+	 * at, or an empty string if prerendering is disabled */
+	std::string prerenderPath(const std::vector<uint8_t> &data, bool looped)
+	{
+		if (!prerender.enabled)
+			return std::string();
+
+		/* Hash over the track and the synth settings */
+		uint8_t loopByte = looped;
+
+		uint64_t hash = hashBytes(dataPtr(data), data.size());
+		hash = hashBytes(prerender.settingsKey.c_str(), prerender.settingsKey.size(), hash);
+		hash = hashBytes(&loopByte, 1, hash);
+
+		char buf[32];
+		snprintf(buf, sizeof(buf), "midi-%08x%08x.pcm",
+		         (uint32_t) (hash >> 32), (uint32_t) hash);
+
+		return prerender.cacheDir + buf;
+	}
+
+	/* Queues 'data' to be rendered to 'path', unless it already is */
+	void queuePrerender(const std::vector<uint8_t> &data, bool looped,
+	                    const std::string &path)
+	{
+		SDL_LockMutex(mut);
+
+		if (prerender.pending.insert(path).second)
+		{
+			MidiPrerenderJob job = { data, looped, path };
+			prerender.jobs.push_back(job);
+
+			if (!prerender.thread)
+				prerender.thread = createSDLThread
+					<SharedMidiState, &SharedMidiState::prerenderFun>(this, "midi_prerender");
+
+			SDL_CondSignal(prerender.jobCond);
+		}
+
+		SDL_UnlockMutex(mut);
 	}
 
 private:
+	void prerenderFun()
+	{
+		/* Only uses otherwise idle CPU time */
+		SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+		while (true)
+		{
+			SDL_LockMutex(mut);
+
+			while (prerender.jobs.empty() && !prerender.termReq)
+				SDL_CondWait(prerender.jobCond, mut);
+
+			if (prerender.termReq)
+			{
+				SDL_UnlockMutex(mut);
+				return;
+			}
+
+			MidiPrerenderJob job = prerender.jobs.front();
+			prerender.jobs.pop_front();
+
+			SDL_UnlockMutex(mut);
+
+			if (prerenderMidi(job.data, job.looped, job.path, prerender.termReq))
+				trimCache(job.path);
+			else if (!prerender.termReq)
+				Debug() << "Failed to prerender midi track to" << job.path;
+
+			SDL_LockMutex(mut);
+			prerender.pending.erase(job.path);
+			SDL_UnlockMutex(mut);
+		}
+	}
+
+	static bool olderThan(const FileSystem::NativeFile &a,
+	                      const FileSystem::NativeFile &b)
+	{
+		return a.mtime < b.mtime;
+	}
+
+	/* Deletes the least recently played renderings (their
+	 * modification time is updated on every playback) until
+	 * the rest fits into the budget. 'keep' is never deleted */
+	void trimCache(const std::string &keep)
+	{
+		std::vector<FileSystem::NativeFile> files;
+		FileSystem::listFiles(prerender.cacheDir, "midi-", ".pcm", files);
+
+		int64_t total = 0;
+
+		for (size_t i = 0; i < files.size(); ++i)
+			total += files[i].size;
+
+		std::sort(files.begin(), files.end(), olderThan);
+
+		for (size_t i = 0; i < files.size() && total > prerender.cacheBudget; ++i)
+		{
+			if (files[i].path == keep)
+				continue;
+
+			/* Might be playing (and locked by the OS) */
+			if (FileSystem::removeFile(files[i].path))
+				total -= files[i].size;
+		}
+	}
+
+	/* Must be called with 'mut' held */
 	fluid_synth_t *addSynth(bool usedNow)
 	{
 		fluid_synth_t *syn = fluid.new_synth(flSettings);
 
 		if (!soundFont.empty())
-			fluid.synth_sfload(syn, soundFont.c_str(), 1);
+		{
+			if (!sharedFont.load(syn, flSettings, soundFont.c_str()))
+				Debug() << "Warning: Failed to load soundfont" << soundFont;
+		}
 		else
 			Debug() << "Warning: No soundfont specified, sound might be mute";
 
@@ -0,0 +1,287 @@
+/*
+** sharedsoundfont.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sharedsoundfont.h"
+
+#include "debugwriter.h"
+
+#include <string>
+#include <assert.h>
+
+#include <SDL_mutex.h>
+#include <SDL_rwops.h>
+#include <SDL_timer.h>
+
+struct SharedSoundFontPrivate
+{
+	std::string filename;
+
+	/* Whether the loaded fluidsynth supports sharing */
+	bool checked;
+	bool shareable;
+
+	/* Private synth holding 'font', as loaded by fluidsynth's
+	 * own loader. Every other synth gets a copy of it,
+	 * pointing to the same parsed data */
+	fluid_synth_t *owner;
+	fluid_sfont_t *font;
+
+	/* Roughly the memory every copy saves */
+	int64_t fileSize;
+
+#ifdef HAVE_FLUID_SFLOADER
+	fluid_preset_t *(*getPreset)(fluid_sfont_t*, unsigned int, unsigned int);
+	int (*presetFree)(fluid_preset_t*);
+
+	fluid_sfloader_t loader;
+#endif
+
+	/* Copies of 'font' currently handed out */
+	int refCount;
+
+	/* Presets are handed out from and returned to the shared
+	 * data, possibly by synths on different threads */
+	SDL_mutex *mut;
+};
+
+#ifdef HAVE_FLUID_SFLOADER
+
+/* The callbacks only get to see the SoundFont (or its
+ * presets, which point back to it), so each copy
+ * carries a pointer to its origin */
+struct SharedSoundFontCopy
+{
+	fluid_sfont_t sfont;
+	SharedSoundFontPrivate *p;
+};
+
+static SharedSoundFontPrivate *
+originOf(fluid_sfont_t *sfont)
+{
+	return reinterpret_cast<SharedSoundFontCopy*>(sfont)->p;
+}
+
+static int
+presetFree(fluid_preset_t *preset)
+{
+	SharedSoundFontPrivate *p = originOf(preset->sfont);
+
+	SDL_LockMutex(p->mut);
+
+	preset->free = p->presetFree;
+	int result = p->presetFree(preset);
+
+	SDL_UnlockMutex(p->mut);
+
+	return result;
+}
+
+static fluid_preset_t *
+getPreset(fluid_sfont_t *sfont, unsigned int bank, unsigned int prenum)
+{
+	SharedSoundFontPrivate *p = originOf(sfont);
+
+	SDL_LockMutex(p->mut);
+
+	fluid_preset_t *preset = p->getPreset(sfont, bank, prenum);
+
+	if (preset)
+	{
+		p->presetFree = preset->free;
+		preset->free = presetFree;
+	}
+
+	SDL_UnlockMutex(p->mut);
+
+	return preset;
+}
+
+static int
+fontFree(fluid_sfont_t *sfont)
+{
+	SharedSoundFontPrivate *p = originOf(sfont);
+
+	SDL_LockMutex(p->mut);
+	--p->refCount;
+	SDL_UnlockMutex(p->mut);
+
+	delete reinterpret_cast<SharedSoundFontCopy*>(sfont);
+
+	return 0;
+}
+
+static fluid_sfont_t *
+loaderLoad(fluid_sfloader_t *loader, const char *filename)
+{
+	SharedSoundFontPrivate *p = static_cast<SharedSoundFontPrivate*>(loader->data);
+
+	/* Anything else is left to the default loader */
+	if (!p->font || p->filename != filename)
+		return 0;
+
+	SharedSoundFontCopy *copy = new SharedSoundFontCopy;
+	copy->sfont = *p->font;
+	copy->sfont.free = fontFree;
+	copy->sfont.get_preset = getPreset;
+	copy->p = p;
+
+	SDL_LockMutex(p->mut);
+	++p->refCount;
+	SDL_UnlockMutex(p->mut);
+
+	return &copy->sfont;
+}
+
+#endif
+
+static bool
+checkShareable()
+{
+#ifdef HAVE_FLUID_SFLOADER
+	int major, minor, micro;
+	fluid.version(&major, &minor, &micro);
+
+	if (major == 1)
+		return true;
+
+	Debug() << "fluidsynth" << major << "." << minor << "." << micro
+	        << "doesn't support sharing SoundFonts between synths";
+#endif
+
+	return false;
+}
+
+static int64_t
+fileSize(const char *filename)
+{
+	SDL_RWops *ops = SDL_RWFromFile(filename, "rb");
+
+	if (!ops)
+		return 0;
+
+	int64_t size = SDL_RWsize(ops);
+	SDL_RWclose(ops);
+
+	return size > 0 ? size : 0;
+}
+
+SharedSoundFont::SharedSoundFont()
+{
+	p = new SharedSoundFontPrivate;
+	p->checked = false;
+	p->shareable = false;
+	p->owner = 0;
+	p->font = 0;
+	p->fileSize = 0;
+	p->refCount = 0;
+	p->mut = SDL_CreateMutex();
+
+#ifdef HAVE_FLUID_SFLOADER
+	p->getPreset = 0;
+	p->presetFree = 0;
+
+	/* Owned by us, so no 'free' */
+	p->loader.data = p;
+	p->loader.free = 0;
+	p->loader.load = loaderLoad;
+#endif
+}
+
+SharedSoundFont::~SharedSoundFont()
+{
+	close();
+
+	SDL_DestroyMutex(p->mut);
+	delete p;
+}
+
+void SharedSoundFont::close()
+{
+	assert(p->refCount == 0);
+
+	if (p->owner)
+		fluid.delete_synth(p->owner);
+
+	p->owner = 0;
+	p->font = 0;
+}
+
+bool SharedSoundFont::load(fluid_synth_t *synth, fluid_settings_t *settings,
+                           const char *filename)
+{
+	if (!p->checked)
+	{
+		p->shareable = checkShareable();
+		p->checked = true;
+	}
+
+	if (!p->shareable)
+		return fluid.synth_sfload(synth, filename, 1) >= 0;
+
+#ifdef HAVE_FLUID_SFLOADER
+	uint64_t start = SDL_GetPerformanceCounter();
+	bool parsed = false;
+
+	if (!p->font)
+	{
+		p->owner = fluid.new_synth(settings);
+
+		int id = fluid.synth_sfload(p->owner, filename, 0);
+
+		if (id >= 0)
+			p->font = fluid.synth_get_sfont_by_id(p->owner, id);
+
+		if (!p->font)
+		{
+			close();
+			return false;
+		}
+
+		p->filename = filename;
+		p->fileSize = fileSize(filename);
+		p->getPreset = p->font->get_preset;
+
+		parsed = true;
+	}
+
+	/* Added loaders are tried before the default one */
+	fluid.synth_add_sfloader(synth, &p->loader);
+
+	if (fluid.synth_sfload(synth, filename, 1) < 0)
+		return false;
+
+	double ms = (SDL_GetPerformanceCounter() - start) * 1000.0
+	          / SDL_GetPerformanceFrequency();
+
+	SDL_LockMutex(p->mut);
+	int users = p->refCount;
+	SDL_UnlockMutex(p->mut);
+
+	/* Sample data makes up most of a SoundFont, and is
+	 * kept in memory in full by fluidsynth 1.x */
+	double savedMB = (users - 1) * (p->fileSize / (1024.0 * 1024.0));
+
+	Debug() << "SoundFont" << (parsed ? "loaded" : "shared") << "in" << ms << "ms,"
+	        << "now used by" << users << "synth(s), saving about" << savedMB << "MB";
+#endif
+
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+** sharedsoundfont.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDSOUNDFONT_H
+#define SHAREDSOUNDFONT_H
+
+#include "fluid-fun.h"
+
+struct SharedSoundFontPrivate;
+
+/* Parses the SoundFont once, and hands the same preset and
+ * sample data to every synth that loads it afterwards (via
+ * a custom sfloader). The parsed data is held by a private
+ * synth that never plays, so the synths loading it can be
+ * deleted in any order. Only done with fluidsynth 1.x, whose
+ * loader interface this relies on; otherwise every synth
+ * simply loads the SoundFont by itself */
+class SharedSoundFont
+{
+public:
+	SharedSoundFont();
+	~SharedSoundFont();
+
+	/* Returns false if the SoundFont could not be loaded */
+	bool load(fluid_synth_t *synth, fluid_settings_t *settings,
+	          const char *filename);
+
+	/* Frees the parsed data. All synths it was loaded
+	 * into must have been deleted before */
+	void close();
+
+private:
+	SharedSoundFontPrivate *p;
+};
+
+#endif // SHAREDSOUNDFONT_H
@@ -37,6 +37,7 @@
 #include "binding.h"
 #include "exception.h"
 #include "sharedmidistate.h"
+#include "mkxppack.h"
 
 #include <unistd.h>
 #include <stdio.h>
@@ -101,7 +102,8 @@ struct SharedStatePrivate
 	SharedStatePrivate(RGSSThreadData *threadData)
 	    : bindingData(0),
 	      sdlWindow(threadData->window),
-	      fileSystem(threadData->argv0, threadData->config.allowSymlinks),
+	      fileSystem(threadData->argv0, threadData->config.allowSymlinks,
+	                 threadData->config.archiveCacheSize * 1024 * 1024),
 	      eThread(*threadData->ethread),
 	      rtData(*threadData),
 	      config(threadData->config),
@@ -117,14 +119,23 @@ struct SharedStatePrivate
 		if (gl.ReleaseShaderCompiler)
 			gl.ReleaseShaderCompiler();
 
-		std::string archPath = config.execName + gameArchExt();
+		/* A converted pack takes precedence over the
+		 * original game archive */
+		const std::string archPaths[] =
+		{
+			config.execName + "." MKXPPACK_EXTENSION,
+			config.execName + gameArchExt()
+		};
 
-		/* Check if a game archive exists */
-		FILE *tmp = fopen(archPath.c_str(), "rb");
-		if (tmp)
+		for (size_t i = 0; i < ARRAY_SIZE(archPaths); ++i)
 		{
-			fileSystem.addPath(archPath.c_str());
-			fclose(tmp);
+			/* Check if a game archive exists */
+			FILE *tmp = fopen(archPaths[i].c_str(), "rb");
+			if (tmp)
+			{
+				fileSystem.addPath(archPaths[i].c_str());
+				fclose(tmp);
+			}
 		}
 
 		fileSystem.addPath(".");
@@ -0,0 +1,101 @@
+/*
+** slab-pool.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLABPOOL_H
+#define SLABPOOL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+
+/* Fixed size allocator for small objects that are created
+ * and destroyed in large numbers. Memory is taken from the
+ * heap in slabs of 'SlabSlots' objects, and freed slots
+ * are kept on a list for reuse instead of being returned
+ * (so the pool stays at its high water mark).
+ * Not thread safe. Only has POD members, so pools with
+ * static storage are usable during static initialization */
+template<size_t Size, int SlabSlots = 128>
+struct SlabPool
+{
+	union Slot
+	{
+		Slot *next;
+		char data[Size];
+
+		/* Alignment */
+		double d;
+		int64_t i;
+		void *p;
+	};
+
+	Slot *freeList;
+
+	/* Allocated objects / available slots */
+	uint32_t live;
+	uint32_t capacity;
+
+	void *alloc()
+	{
+		if (!freeList)
+			grow();
+
+		Slot *slot = freeList;
+		freeList = slot->next;
+		++live;
+
+		return slot;
+	}
+
+	void release(void *p)
+	{
+		if (!p)
+			return;
+
+		Slot *slot = static_cast<Slot*>(p);
+		slot->next = freeList;
+		freeList = slot;
+		--live;
+	}
+
+	size_t bytes() const
+	{
+		return capacity * sizeof(Slot);
+	}
+
+private:
+	void grow()
+	{
+		Slot *slab = static_cast<Slot*>(malloc(sizeof(Slot) * SlabSlots));
+
+		if (!slab)
+			throw std::bad_alloc();
+
+		for (int i = 0; i < SlabSlots-1; ++i)
+			slab[i].next = &slab[i+1];
+
+		slab[SlabSlots-1].next = freeList;
+		freeList = slab;
+		capacity += SlabSlots;
+	}
+};
+
+#endif // SLABPOOL_H
@@ -26,11 +26,13 @@
 #include "exception.h"
 #include "config.h"
 #include "util.h"
+#include "sdl-util.h"
 #include "debugwriter.h"
+#include "headlessaudio.h"
 
 #include <SDL_sound.h>
 
-#define SE_CACHE_MEM (10*1024*1024) // 10 MB
+#define SE_DECODE_THREADS 2
 
 struct SoundBuffer
 {
@@ -45,11 +47,20 @@ struct SoundBuffer
 	/* Buffer byte count */
 	uint32_t bytes;
 
+	/* Set once a worker has uploaded the decoded data */
+	bool ready;
+
+	/* Excluded from eviction (and the priority list) */
+	bool pinned;
+
 	/* Reference count */
 	uint8_t refCount;
 
 	SoundBuffer()
 	    : link(this),
+	      bytes(0),
+	      ready(false),
+	      pinned(false),
 	      refCount(1)
 
 	{
@@ -76,47 +87,88 @@ private:
 	}
 };
 
-/* Before: [a][b][c][d], After (index=1): [a][c][d][b] */
-static void
-arrayPushBack(std::vector<size_t> &array, size_t size, size_t index)
+/* The same sound might be requested with different slash
+ * styles or capitalization, which would otherwise end
+ * up being decoded and cached more than once */
+static std::string
+cacheKey(const std::string &filename)
 {
-	size_t v = array[index];
+	std::string key(filename);
 
-	for (size_t t = index; t < size-1; ++t)
-		array[t] = array[t+1];
+	for (size_t i = 0; i < key.size(); ++i)
+	{
+		if (key[i] == '\\')
+			key[i] = '/';
+		else if (key[i] >= 'A' && key[i] <= 'Z')
+			key[i] += 'a' - 'A';
+	}
 
-	array[size-1] = v;
+	return key;
 }
 
-SoundEmitter::SoundEmitter(const Config &conf)
+SoundEmitter::SoundEmitter(const Config &conf, SDL_sem *wakeSem,
+                           bool decodeThreads)
     : bufferBytes(0),
+      cacheBudget(conf.SE.cacheSize * 1024 * 1024),
+      pinnedCount(0),
+      pendingCount(0),
+      cacheHits(0),
+      cacheMisses(0),
+      evictions(0),
       srcCount(conf.SE.sourceCount),
-      alSrcs(srcCount),
-      atchBufs(srcCount),
-      srcPrio(srcCount)
+      sources(srcCount),
+      wakeSem(wakeSem),
+      maxLatency(conf.SE.maxLatency),
+      termReq(false)
 {
 	for (size_t i = 0; i < srcCount; ++i)
 	{
-		alSrcs[i] = AL::Source::gen();
-		atchBufs[i] = 0;
-		srcPrio[i] = i;
+		sources[i] = new Source;
+		sources[i]->alSrc = AL::Source::gen();
+		freeSrcs.append(sources[i]->link);
 	}
+
+	mut = SDL_CreateMutex();
+	jobCond = SDL_CreateCond();
+
+	for (size_t i = 0; decodeThreads && i < SE_DECODE_THREADS; ++i)
+		workers.push_back(createSDLThread
+			<SoundEmitter, &SoundEmitter::workerFun>(this, "se_decoder"));
 }
 
 SoundEmitter::~SoundEmitter()
 {
+	SDL_LockMutex(mut);
+	termReq = true;
+	SDL_CondBroadcast(jobCond);
+	SDL_UnlockMutex(mut);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		SDL_WaitThread(workers[i], 0);
+
+	/* Drop the references held by unfinished jobs */
+	for (size_t i = 0; i < decodeJobs.size(); ++i)
+		SoundBuffer::deref(decodeJobs[i].buffer);
+
 	for (size_t i = 0; i < srcCount; ++i)
 	{
-		AL::Source::stop(alSrcs[i]);
-		AL::Source::del(alSrcs[i]);
+		Source *src = sources[i];
+
+		AL::Source::stop(src->alSrc);
+		AL::Source::del(src->alSrc);
 
-		if (atchBufs[i])
-			SoundBuffer::deref(atchBufs[i]);
+		if (src->buffer)
+			SoundBuffer::deref(src->buffer);
+
+		delete src;
 	}
 
 	BufferHash::const_iterator iter;
 	for (iter = bufferHash.cbegin(); iter != bufferHash.cend(); ++iter)
 		SoundBuffer::deref(iter->second);
+
+	SDL_DestroyCond(jobCond);
+	SDL_DestroyMutex(mut);
 }
 
 void SoundEmitter::play(const std::string &filename,
@@ -126,70 +178,242 @@ void SoundEmitter::play(const std::string &filename,
 	float _volume = clamp<int>(volume, 0, 100) / 100.0f;
 	float _pitch  = clamp<int>(pitch, 50, 150) / 100.0f;
 
-	SoundBuffer *buffer = allocateBuffer(filename);
+	SDL_LockMutex(mut);
 
-	if (!buffer)
-		return;
+	SoundBuffer *buffer = requestBuffer(filename);
 
-	/* Try to find first free source */
-	size_t i;
-	for (i = 0; i < srcCount; ++i)
-		if (AL::Source::getState(alSrcs[srcPrio[i]]) != AL_PLAYING)
-			break;
+	if (buffer->ready)
+	{
+		playBuffer(buffer, _volume, _pitch);
+	}
+	else
+	{
+		/* Will be started once decoding completes */
+		PendingPlay pp = { SoundBuffer::ref(buffer), _volume, _pitch, audioTicks() };
+		pendingPlays.push_back(pp);
+	}
+
+	SDL_UnlockMutex(mut);
+
+	SDL_SemPost(wakeSem);
+}
+
+void SoundEmitter::preload(const std::string &filename)
+{
+	SDL_LockMutex(mut);
+	requestBuffer(filename);
+	SDL_UnlockMutex(mut);
+}
+
+void SoundEmitter::stop()
+{
+	SDL_LockMutex(mut);
+
+	for (size_t i = 0; i < srcCount; i++)
+	{
+		AL::Source::stop(sources[i]->alSrc);
+		setBusy(sources[i], false);
+	}
+
+	/* Sounds still being decoded shouldn't start after this */
+	for (size_t i = 0; i < pendingPlays.size(); ++i)
+		SoundBuffer::deref(pendingPlays[i].buffer);
+
+	pendingPlays.clear();
+
+	SDL_UnlockMutex(mut);
+}
+
+void SoundEmitter::pin(const std::string &filename)
+{
+	SDL_LockMutex(mut);
+
+	SoundBuffer *buffer = requestBuffer(filename);
+
+	if (!buffer->pinned)
+	{
+		buffer->pinned = true;
+		++pinnedCount;
+
+		/* Not decoded buffers aren't in the list yet */
+		buffers.remove(buffer->link);
+	}
+
+	SDL_UnlockMutex(mut);
+}
+
+void SoundEmitter::unpin(const std::string &filename)
+{
+	SDL_LockMutex(mut);
+
+	SoundBuffer *buffer = bufferHash.value(cacheKey(filename), 0);
+
+	if (buffer && buffer->pinned)
+	{
+		buffer->pinned = false;
+		--pinnedCount;
+
+		if (buffer->ready)
+		{
+			buffers.prepend(buffer->link);
 
-	/* If we didn't find any, try to find the lowest priority source
-	 * with the same buffer to overtake */
-	if (i == srcCount)
-		for (size_t j = 0; j < srcCount; ++j)
-			if (atchBufs[srcPrio[j]] == buffer)
-				i = j;
+			/* The cache might have been over budget
+			 * due to pinned buffers */
+			evict(0);
+		}
+	}
 
-	/* If we didn't find any, overtake the one with lowest priority */
-	if (i == srcCount)
-		i = 0;
+	SDL_UnlockMutex(mut);
+}
 
-	size_t srcIndex = srcPrio[i];
+void SoundEmitter::getCacheStats(Audio::SECacheStats &out)
+{
+	SDL_LockMutex(mut);
+
+	out.bytes = bufferBytes;
+	out.budget = cacheBudget;
+	out.buffers = bufferHash.size() - pendingCount;
+	out.pinned = pinnedCount;
+	out.pending = pendingCount;
+	out.hits = cacheHits;
+	out.misses = cacheMisses;
+	out.evictions = evictions;
+
+	SDL_UnlockMutex(mut);
+}
+
+/* Must be called with 'mut' held. Deletes the lowest priority
+ * buffers until 'extraBytes' more fit into the budget, or no
+ * evictable buffers are left */
+void SoundEmitter::evict(uint32_t extraBytes)
+{
+	while (bufferBytes + extraBytes > cacheBudget && !buffers.isEmpty())
+	{
+		SoundBuffer *last = buffers.tail();
+		bufferHash.remove(last->key);
+		buffers.remove(last->link);
+
+		bufferBytes -= last->bytes;
+		++evictions;
+
+		SoundBuffer::deref(last);
+	}
+}
+
+bool SoundEmitter::update()
+{
+	SDL_LockMutex(mut);
+
+	refreshSources();
+	bool busy = !busySrcs.isEmpty() || !pendingPlays.empty();
+
+	SDL_UnlockMutex(mut);
+
+	return busy;
+}
+
+/* Must be called with 'mut' held. Moves all
+ * sources that stopped playing to the free list */
+void SoundEmitter::refreshSources()
+{
+	IntruListLink<Source> *iter = busySrcs.begin();
+
+	while (iter != busySrcs.end())
+	{
+		Source *src = iter->data;
+		iter = iter->next;
+
+		if (AL::Source::getState(src->alSrc) != AL_PLAYING)
+			setBusy(src, false);
+	}
+}
+
+/* Must be called with 'mut' held. Moves the source to
+ * the back of the free or busy list */
+void SoundEmitter::setBusy(Source *src, bool busy)
+{
+	if (src->busy)
+		busySrcs.remove(src->link);
+	else
+		freeSrcs.remove(src->link);
+
+	if (busy)
+		busySrcs.append(src->link);
+	else
+		freeSrcs.append(src->link);
+
+	src->busy = busy;
+}
+
+/* Must be called with 'mut' held */
+void SoundEmitter::playBuffer(SoundBuffer *buffer,
+                              float volume,
+                              float pitch)
+{
+	/* The free list might be behind if
+	 * 'update()' hasn't run in a while */
+	if (freeSrcs.isEmpty())
+		refreshSources();
+
+	Source *src = 0;
+
+	if (!freeSrcs.isEmpty())
+	{
+		src = freeSrcs.begin()->data;
+	}
+	else
+	{
+		/* If we didn't find any, try to find the lowest priority
+		 * source with the same buffer to overtake */
+		IntruListLink<Source> *iter;
+		for (iter = busySrcs.begin(); iter != busySrcs.end(); iter = iter->next)
+			if (iter->data->buffer == buffer)
+			{
+				src = iter->data;
+				break;
+			}
+
+		/* If we didn't find any, overtake the one with lowest priority */
+		if (!src)
+			src = busySrcs.begin()->data;
+	}
 
 	/* Only detach/reattach if it's actually a different buffer */
-	bool switchBuffer = (atchBufs[srcIndex] != buffer);
+	bool switchBuffer = (src->buffer != buffer);
 
 	/* Push the used source to the back of the priority list */
-	arrayPushBack(srcPrio, srcCount, i);
+	setBusy(src, true);
 
-	AL::Source::ID src = alSrcs[srcIndex];
-	AL::Source::stop(src);
+	AL::Source::stop(src->alSrc);
 
 	if (switchBuffer)
-		AL::Source::detachBuffer(src);
+		AL::Source::detachBuffer(src->alSrc);
 
-	SoundBuffer *old = atchBufs[srcIndex];
+	SoundBuffer *old = src->buffer;
 
 	if (old)
 		SoundBuffer::deref(old);
 
-	atchBufs[srcIndex] = SoundBuffer::ref(buffer);
+	src->buffer = SoundBuffer::ref(buffer);
 
 	if (switchBuffer)
-		AL::Source::attachBuffer(src, buffer->alBuffer);
+		AL::Source::attachBuffer(src->alSrc, buffer->alBuffer);
 
-	AL::Source::setVolume(src, _volume * GLOBAL_VOLUME);
-	AL::Source::setPitch(src, _pitch);
+	AL::Source::setVolume(src->alSrc, volume * GLOBAL_VOLUME);
+	AL::Source::setPitch(src->alSrc, pitch);
 
-	AL::Source::play(src);
-}
-
-void SoundEmitter::stop()
-{
-	for (size_t i = 0; i < srcCount; i++)
-		AL::Source::stop(alSrcs[i]);
+	AL::Source::play(src->alSrc);
 }
 
 struct SoundOpenHandler : FileSystem::OpenHandler
 {
 	SoundBuffer *buffer;
+	bool success;
+	std::string errorMsg;
 
-	SoundOpenHandler()
-	    : buffer(0)
+	SoundOpenHandler(SoundBuffer *buffer)
+	    : buffer(buffer),
+	      success(false)
 	{}
 
 	bool tryRead(SDL_RWops &ops, const char *ext)
@@ -198,6 +422,7 @@ struct SoundOpenHandler : FileSystem::OpenHandler
 
 		if (!sample)
 		{
+			errorMsg = Sound_GetError();
 			SDL_RWclose(&ops);
 			return false;
 		}
@@ -208,7 +433,6 @@ struct SoundOpenHandler : FileSystem::OpenHandler
 		uint8_t sampleSize = formatSampleSize(sample->actual.format);
 		uint32_t sampleCount = decBytes / sampleSize;
 
-		buffer = new SoundBuffer;
 		buffer->bytes = sampleSize * sampleCount;
 
 		ALenum alFormat = chooseALFormat(sampleSize, sample->actual.channels);
@@ -218,61 +442,174 @@ struct SoundOpenHandler : FileSystem::OpenHandler
 
 		Sound_FreeSample(sample);
 
+		success = true;
+
 		return true;
 	}
 };
 
-SoundBuffer *SoundEmitter::allocateBuffer(const std::string &filename)
+/* Must be called with 'mut' held. Returns the buffer for
+ * 'filename', queueing it for decoding if it isn't cached */
+SoundBuffer *SoundEmitter::requestBuffer(const std::string &filename)
 {
-	SoundBuffer *buffer = bufferHash.value(filename, 0);
+	std::string key = cacheKey(filename);
+	SoundBuffer *buffer = bufferHash.value(key, 0);
 
 	if (buffer)
 	{
-		/* Buffer still in cashe.
+		++cacheHits;
+
+		/* Buffer still in cache.
 		 * Move to front of priority list */
-		buffers.remove(buffer->link);
-		buffers.append(buffer->link);
+		if (buffer->ready && !buffer->pinned)
+		{
+			buffers.remove(buffer->link);
+			buffers.prepend(buffer->link);
+		}
 
 		return buffer;
 	}
-	else
+
+	++cacheMisses;
+
+	/* Buffer not in cache, needs to be decoded */
+	buffer = new SoundBuffer;
+	buffer->key = key;
+
+	bufferHash.insert(key, buffer);
+	++pendingCount;
+
+	DecodeJob job = { SoundBuffer::ref(buffer), filename };
+	decodeJobs.push_back(job);
+	SDL_CondSignal(jobCond);
+
+	return buffer;
+}
+
+/* Must be called with 'mut' held */
+void SoundEmitter::finishDecode(const DecodeJob &job,
+                                bool success,
+                                const std::string &errorMsg)
+{
+	SoundBuffer *buffer = job.buffer;
+
+	/* Only account for the buffer if it is still the one cached
+	 * under its key */
+	bool cached = (bufferHash.value(buffer->key, 0) == buffer);
+
+	if (cached)
+		--pendingCount;
+
+	if (success)
 	{
-		/* Buffer not in cache, needs to be loaded */
-		SoundOpenHandler handler;
-		shState->fileSystem().openRead(handler, filename.c_str());
-		buffer = handler.buffer;
+		buffer->ready = true;
 
-		if (!buffer)
+		if (cached)
 		{
-			char buf[512];
-			snprintf(buf, sizeof(buf), "Unable to decode sound: %s: %s",
-			         filename.c_str(), Sound_GetError());
-			Debug() << buf;
+			evict(buffer->bytes);
+			bufferBytes += buffer->bytes;
 
-			return 0;
+			if (!buffer->pinned)
+				buffers.prepend(buffer->link);
 		}
+	}
+	else
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "Unable to decode sound: %s: %s",
+		         job.filename.c_str(), errorMsg.c_str());
+		Debug() << buf;
+
+		/* Don't keep the broken buffer around, so
+		 * the next request tries again */
+		if (cached)
+		{
+			if (buffer->pinned)
+				--pinnedCount;
 
-		buffer->key = filename;
-		uint32_t wouldBeBytes = bufferBytes + buffer->bytes;
+			bufferHash.remove(buffer->key);
+			SoundBuffer::deref(buffer);
+		}
+	}
 
-		/* If memory limit is reached, delete lowest priority buffer
-		 * until there is room or no buffers left */
-		while (wouldBeBytes > SE_CACHE_MEM && !buffers.isEmpty())
-		{
-			SoundBuffer *last = buffers.tail();
-			bufferHash.remove(last->key);
-			buffers.remove(last->link);
+	uint32_t now = audioTicks();
 
-			wouldBeBytes -= last->bytes;
+	for (size_t i = 0; i < pendingPlays.size();)
+	{
+		PendingPlay &pp = pendingPlays[i];
 
-			SoundBuffer::deref(last);
+		if (pp.buffer != buffer)
+		{
+			++i;
+			continue;
 		}
 
-		bufferHash.insert(filename, buffer);
-		buffers.prepend(buffer->link);
+		if (success && (maxLatency == 0 || now - pp.reqTicks <= maxLatency))
+			playBuffer(buffer, pp.volume, pp.pitch);
 
-		bufferBytes = wouldBeBytes;
+		SoundBuffer::deref(pp.buffer);
+		pendingPlays.erase(pendingPlays.begin() + i);
+	}
+}
 
-		return buffer;
+/* Must be called with 'mut' held, which is
+ * released while the sound is decoded */
+void SoundEmitter::runJob(const DecodeJob &job)
+{
+	SDL_UnlockMutex(mut);
+
+	/* Only this thread touches the buffer until it is ready */
+	SoundOpenHandler handler(job.buffer);
+
+	try
+	{
+		shState->fileSystem().openRead(handler, job.filename.c_str());
+	}
+	catch (const Exception &e)
+	{
+		handler.errorMsg = e.msg;
+	}
+
+	SDL_LockMutex(mut);
+
+	finishDecode(job, handler.success, handler.errorMsg);
+
+	/* Drop the job's reference */
+	SoundBuffer::deref(job.buffer);
+}
+
+void SoundEmitter::decodeQueued()
+{
+	SDL_LockMutex(mut);
+
+	while (!decodeJobs.empty())
+	{
+		DecodeJob job = decodeJobs.front();
+		decodeJobs.pop_front();
+
+		runJob(job);
 	}
+
+	SDL_UnlockMutex(mut);
+}
+
+void SoundEmitter::workerFun()
+{
+	SDL_LockMutex(mut);
+
+	while (true)
+	{
+		while (decodeJobs.empty() && !termReq)
+			SDL_CondWait(jobCond, mut);
+
+		if (termReq)
+			break;
+
+		DecodeJob job = decodeJobs.front();
+		decodeJobs.pop_front();
+
+		runJob(job);
+	}
+
+	SDL_UnlockMutex(mut);
 }
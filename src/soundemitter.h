@@ -25,9 +25,14 @@
 #include "intrulist.h"
 #include "al-util.h"
 #include "boost-hash.h"
+#include "audio.h"
 
 #include <string>
 #include <vector>
+#include <deque>
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
 
 struct SoundBuffer;
 struct Config;
@@ -36,30 +41,131 @@ struct SoundEmitter
 {
 	typedef BoostHash<std::string, SoundBuffer*> BufferHash;
 
+	/* Decoded, unpinned buffers, most recently used first */
 	IntruList<SoundBuffer> buffers;
+
+	/* All buffers, including ones still being decoded */
 	BufferHash bufferHash;
 
-	/* Byte count sum of all cached / playing buffers */
+	/* Byte count sum of all cached buffers, and its limit */
 	uint32_t bufferBytes;
+	const uint32_t cacheBudget;
+
+	uint32_t pinnedCount;
+
+	/* Buffers in 'bufferHash' still being decoded */
+	uint32_t pendingCount;
+
+	uint32_t cacheHits;
+	uint32_t cacheMisses;
+	uint32_t evictions;
+
+	struct Source
+	{
+		AL::Source::ID alSrc;
+
+		/* Currently attached buffer */
+		SoundBuffer *buffer;
+
+		/* Link into either the free or busy list */
+		IntruListLink<Source> link;
+		bool busy;
+
+		Source()
+		    : buffer(0),
+		      link(this),
+		      busy(false)
+		{}
+	};
 
 	const size_t srcCount;
-	std::vector<AL::Source::ID> alSrcs;
-	std::vector<SoundBuffer*> atchBufs;
+	std::vector<Source*> sources;
+
+	/* Sources known to have finished playing, and sources
+	 * that were started, oldest (lowest priority) first.
+	 * Finished sources are moved over by 'update()', so
+	 * picking one doesn't query the AL state of each */
+	IntruList<Source> freeSrcs;
+	IntruList<Source> busySrcs;
+
+	/* Posted when a sound is requested, so the audio
+	 * thread keeps calling 'update()' while it plays */
+	SDL_sem *wakeSem;
 
-	/* Indices of sources, sorted by priority (lowest first) */
-	std::vector<size_t> srcPrio;
+	/* Sounds that were requested while their
+	 * buffer was still being decoded */
+	struct PendingPlay
+	{
+		SoundBuffer *buffer;
+		float volume;
+		float pitch;
+		uint32_t reqTicks;
+	};
 
-	SoundEmitter(const Config &conf);
+	std::vector<PendingPlay> pendingPlays;
+
+	/* Pending sounds that would start playing later
+	 * than this (in ms) are dropped. 0 = never drop */
+	const uint32_t maxLatency;
+
+	/* Buffers waiting to be decoded by a worker, or
+	 * by 'decodeQueued()' if there are no workers */
+	struct DecodeJob
+	{
+		SoundBuffer *buffer;
+		std::string filename;
+	};
+
+	std::deque<DecodeJob> decodeJobs;
+	std::vector<SDL_Thread*> workers;
+	bool termReq;
+
+	/* Guards all of the above, as workers
+	 * finish decoding asynchronously */
+	SDL_mutex *mut;
+	SDL_cond *jobCond;
+
+	/* Without 'decodeThreads', nothing is decoded
+	 * until 'decodeQueued()' is called */
+	SoundEmitter(const Config &conf, SDL_sem *wakeSem,
+	             bool decodeThreads = true);
 	~SoundEmitter();
 
 	void play(const std::string &filename,
 	          int volume,
 	          int pitch);
 
+	/* Decodes the sound in the background so that
+	 * a later 'play()' can start it right away */
+	void preload(const std::string &filename);
+
 	void stop();
 
+	/* Pinned buffers are decoded if necessary,
+	 * and never evicted until unpinned */
+	void pin(const std::string &filename);
+	void unpin(const std::string &filename);
+
+	void getCacheStats(Audio::SECacheStats &out);
+
+	/* Decodes all requested sounds on the calling thread */
+	void decodeQueued();
+
+	/* Called periodically from the audio thread. Returns
+	 * true while any sound might still be playing */
+	bool update();
+
 private:
-	SoundBuffer *allocateBuffer(const std::string &filename);
+	SoundBuffer *requestBuffer(const std::string &filename);
+	void evict(uint32_t extraBytes);
+	void refreshSources();
+	void setBusy(Source *src, bool busy);
+	void playBuffer(SoundBuffer *buffer, float volume, float pitch);
+	void finishDecode(const DecodeJob &job, bool success,
+	                  const std::string &errorMsg);
+	void runJob(const DecodeJob &job);
+
+	void workerFun();
 };
 
 #endif // SOUNDEMITTER_H
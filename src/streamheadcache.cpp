@@ -0,0 +1,107 @@
+/*
+** streamheadcache.cpp
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "streamheadcache.h"
+
+StreamHeadCache::StreamHeadCache()
+{
+	mut = SDL_CreateMutex();
+}
+
+StreamHeadCache::~StreamHeadCache()
+{
+	BoostHash<std::string, StreamHead*>::const_iterator iter;
+	for (iter = heads.cbegin(); iter != heads.cend(); ++iter)
+		delete iter->second;
+
+	SDL_DestroyMutex(mut);
+}
+
+StreamHead *StreamHeadCache::acquire(const std::string &filename)
+{
+	SDL_LockMutex(mut);
+
+	StreamHead *head = heads.value(filename, 0);
+
+	if (head)
+	{
+		++head->refCount;
+
+		lru.remove(head->link);
+		lru.prepend(head->link);
+	}
+
+	SDL_UnlockMutex(mut);
+
+	return head;
+}
+
+void StreamHeadCache::release(StreamHead *head)
+{
+	SDL_LockMutex(mut);
+	deref(head);
+	SDL_UnlockMutex(mut);
+}
+
+bool StreamHeadCache::contains(const std::string &filename)
+{
+	SDL_LockMutex(mut);
+	bool result = heads.contains(filename);
+	SDL_UnlockMutex(mut);
+
+	return result;
+}
+
+void StreamHeadCache::insert(const std::string &filename, StreamHead *head)
+{
+	SDL_LockMutex(mut);
+
+	/* Recorded twice at the same time */
+	if (heads.contains(filename))
+	{
+		deref(head);
+		SDL_UnlockMutex(mut);
+
+		return;
+	}
+
+	head->key = filename;
+	heads.insert(filename, head);
+	lru.prepend(head->link);
+
+	while (lru.getSize() > STREAM_HEAD_COUNT)
+	{
+		StreamHead *last = lru.tail();
+		lru.remove(last->link);
+		heads.remove(last->key);
+
+		deref(last);
+	}
+
+	SDL_UnlockMutex(mut);
+}
+
+/* Must be called with 'mut' held */
+void StreamHeadCache::deref(StreamHead *head)
+{
+	if (--head->refCount == 0)
+		delete head;
+}
@@ -0,0 +1,107 @@
+/*
+** streamheadcache.h
+**
+** This file is part of mkxp.
+**
+** Copyright (C) 2014 Jonas Kulla <Nyocurio@gmail.com>
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAMHEADCACHE_H
+#define STREAMHEADCACHE_H
+
+#include "al-util.h"
+#include "intrulist.h"
+#include "boost-hash.h"
+
+#include <string>
+#include <vector>
+
+#include <SDL_mutex.h>
+
+/* Seconds of audio kept decoded per track */
+#define STREAM_HEAD_SECONDS 2
+
+/* Number of tracks kept */
+#define STREAM_HEAD_COUNT 8
+
+/* The decoded beginning of an audio track */
+struct StreamHead
+{
+	std::string key;
+
+	ALenum format;
+	ALsizei freq;
+	uint32_t frameSize;
+
+	std::vector<uint8_t> pcm;
+
+	StreamHead()
+	    : format(0),
+	      freq(0),
+	      frameSize(0),
+	      refCount(1),
+	      link(this)
+	{}
+
+	uint32_t frames() const
+	{
+		return frameSize ? pcm.size() / frameSize : 0;
+	}
+
+	/* Seconds of audio contained */
+	float duration() const
+	{
+		return freq ? (float) frames() / freq : 0;
+	}
+
+private:
+	friend class StreamHeadCache;
+
+	/* Guarded by the cache's mutex */
+	int refCount;
+	IntruListLink<StreamHead> link;
+};
+
+/* Keeps the heads of recently played tracks around, so
+ * their playback can start from memory while the actual
+ * decoder is still being set up. Thread safe */
+class StreamHeadCache
+{
+public:
+	StreamHeadCache();
+	~StreamHeadCache();
+
+	/* Returns a head that must be released again, or null */
+	StreamHead *acquire(const std::string &filename);
+	void release(StreamHead *head);
+
+	bool contains(const std::string &filename);
+
+	/* Takes ownership of 'head' */
+	void insert(const std::string &filename, StreamHead *head);
+
+private:
+	void deref(StreamHead *head);
+
+	BoostHash<std::string, StreamHead*> heads;
+
+	/* Most recently used first */
+	IntruList<StreamHead> lru;
+
+	SDL_mutex *mut;
+};
+
+#endif // STREAMHEADCACHE_H
@@ -31,12 +31,16 @@
 /* Init normally */
 Table::Table(int x, int y /*= 1*/, int z /*= 1*/)
     : xs(x), ys(y), zs(z),
-      data(x*y*z)
+      data(x*y*z),
+      isDirty(false),
+      updateDepth(0)
 {}
 
 Table::Table(const Table &other)
     : xs(other.xs), ys(other.ys), zs(other.zs),
-      data(other.data)
+      data(other.data),
+      isDirty(false),
+      updateDepth(0)
 {}
 
 int16_t Table::get(int x, int y, int z) const
@@ -55,7 +59,7 @@ void Table::set(int16_t value, int x, int y, int z)
 
 	data[xs*ys*z + xs*y + x] = value;
 
-	modified();
+	markDirty(x, y, z, 1, 1, 1);
 }
 
 void Table::resize(int x, int y, int z)
@@ -76,7 +80,10 @@ void Table::resize(int x, int y, int z)
 	ys = y;
 	zs = z;
 
-	return;
+	/* Every cell may have moved; this also drops a dirty
+	 * box that extended past the new bounds */
+	isDirty = false;
+	markDirty(0, 0, 0, xs, ys, zs);
 }
 
 void Table::resize(int x, int y)
@@ -89,6 +96,150 @@ void Table::resize(int x)
 	resize(x, ys, zs);
 }
 
+/* Clips the box to [0, size) on one axis, shifting
+ * 'other' (a second box origin) along with it */
+static bool
+clipSpan(int &pos, int &len, int size, int *other = 0)
+{
+	if (pos < 0)
+	{
+		len += pos;
+
+		if (other)
+			*other -= pos;
+
+		pos = 0;
+	}
+
+	len = std::min(len, size - pos);
+
+	return len > 0;
+}
+
+void Table::fill(int16_t value, int x, int y, int z,
+                 int width, int height, int depth)
+{
+	if (!clipSpan(x, width, xs)
+	||  !clipSpan(y, height, ys)
+	||  !clipSpan(z, depth, zs))
+		return;
+
+	for (int k = z; k < z + depth; ++k)
+		for (int j = y; j < y + height; ++j)
+		{
+			int16_t *row = &at(x, j, k);
+			std::fill(row, row + width, value);
+		}
+
+	markDirty(x, y, z, width, height, depth);
+}
+
+void Table::copy(const Table &src, int srcX, int srcY, int srcZ,
+                 int width, int height, int depth,
+                 int dstX, int dstY, int dstZ)
+{
+	if (!clipSpan(srcX, width, src.xs, &dstX)
+	||  !clipSpan(srcY, height, src.ys, &dstY)
+	||  !clipSpan(srcZ, depth, src.zs, &dstZ)
+	||  !clipSpan(dstX, width, xs, &srcX)
+	||  !clipSpan(dstY, height, ys, &srcY)
+	||  !clipSpan(dstZ, depth, zs, &srcZ))
+		return;
+
+	/* Copying within one table may overlap, so walk
+	 * rows and layers in the direction that is safe */
+	bool backwards = (&src == this) &&
+		(dstZ > srcZ || (dstZ == srcZ && dstY > srcY));
+
+	for (int kk = 0; kk < depth; ++kk)
+		for (int jj = 0; jj < height; ++jj)
+		{
+			int k = backwards ? depth - 1 - kk : kk;
+			int j = backwards ? height - 1 - jj : jj;
+
+			memmove(&at(dstX, dstY + j, dstZ + k),
+			        &src.at(srcX, srcY + j, srcZ + k),
+			        sizeof(int16_t) * width);
+		}
+
+	markDirty(dstX, dstY, dstZ, width, height, depth);
+}
+
+int Table::getRow(int16_t *out, int y, int z) const
+{
+	if (y < 0 || y >= ys || z < 0 || z >= zs)
+		return 0;
+
+	memcpy(out, &at(0, y, z), sizeof(int16_t) * xs);
+
+	return xs;
+}
+
+int Table::setRow(const int16_t *values, int count, int y, int z)
+{
+	if (y < 0 || y >= ys || z < 0 || z >= zs)
+		return 0;
+
+	count = std::min(count, xs);
+
+	if (count <= 0)
+		return 0;
+
+	memcpy(&at(0, y, z), values, sizeof(int16_t) * count);
+
+	markDirty(0, y, z, count, 1, 1);
+
+	return count;
+}
+
+void Table::beginUpdate()
+{
+	++updateDepth;
+}
+
+void Table::endUpdate()
+{
+	if (updateDepth == 0 || --updateDepth > 0)
+		return;
+
+	if (!isDirty)
+		return;
+
+	modified();
+	isDirty = false;
+}
+
+void Table::markDirty(int x, int y, int z,
+                      int width, int height, int depth)
+{
+	if (!isDirty)
+	{
+		dirty.x1 = x;
+		dirty.y1 = y;
+		dirty.z1 = z;
+		dirty.x2 = x + width;
+		dirty.y2 = y + height;
+		dirty.z2 = z + depth;
+
+		isDirty = true;
+	}
+	else
+	{
+		dirty.x1 = std::min(dirty.x1, x);
+		dirty.y1 = std::min(dirty.y1, y);
+		dirty.z1 = std::min(dirty.z1, z);
+		dirty.x2 = std::max(dirty.x2, x + width);
+		dirty.y2 = std::max(dirty.y2, y + height);
+		dirty.z2 = std::max(dirty.z2, z + depth);
+	}
+
+	if (updateDepth > 0)
+		return;
+
+	modified();
+	isDirty = false;
+}
+
 /* Serializable */
 int Table::serialSize() const
 {
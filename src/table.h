@@ -47,6 +47,35 @@ public:
 	void resize(int x, int y);
 	void resize(int x);
 
+	/* Bulk operations; boxes are clipped to the table bounds
+	 * (and, for copies, to those of the source) */
+	void fill(int16_t value, int x, int y, int z,
+	          int width, int height, int depth);
+	void copy(const Table &src, int srcX, int srcY, int srcZ,
+	          int width, int height, int depth,
+	          int dstX, int dstY, int dstZ);
+
+	/* Rows of cells along x; return the number of cells transferred */
+	int getRow(int16_t *out, int y, int z = 0) const;
+	int setRow(const int16_t *values, int count, int y, int z = 0);
+
+	/* Between these, modifications only extend the dirty box,
+	 * and 'modified' is emitted once when the outermost update
+	 * ends (if anything was modified at all). Nestable */
+	void beginUpdate();
+	void endUpdate();
+
+	/* Cells changed since the last 'modified' emission
+	 * (inclusive begin, exclusive end); valid while it
+	 * is being emitted */
+	struct Box
+	{
+		int x1, y1, z1;
+		int x2, y2, z2;
+	};
+
+	const Box &dirtyBox() const { return dirty; }
+
 	int serialSize() const;
 	void serialize(char *buffer) const;
 	static Table *deserialize(const char *data, int len);
@@ -65,8 +94,14 @@ public:
 	sigc::signal<void> modified;
 
 private:
+	void markDirty(int x, int y, int z, int width, int height, int depth);
+
 	int xs, ys, zs;
 	std::vector<int16_t> data;
+
+	Box dirty;
+	bool isDirty;
+	int updateDepth;
 };
 
 #endif // TABLE_H
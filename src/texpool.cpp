@@ -71,11 +71,16 @@ struct TexPoolPrivate
 	/* Has this pool been disabled? */
 	bool disabled;
 
+	uint32_t hits;
+	uint32_t misses;
+
 	TexPoolPrivate(uint32_t maxMemSize)
 	    : maxMemSize(maxMemSize),
 	      memSize(0),
 	      objCount(0),
-	      disabled(false)
+	      disabled(false),
+	      hits(0),
+	      misses(0)
 	{}
 };
 
@@ -120,6 +125,7 @@ TEXFBO TexPool::request(int width, int height)
 
 		p->memSize -= byteCount(size);
 		--p->objCount;
+		++p->hits;
 
 //		Debug() << "TexPool: <?+> (" << width << height << ")";
 
@@ -133,6 +139,8 @@ TEXFBO TexPool::request(int width, int height)
 		                width, height);
 
 	/* Nope, create it instead */
+	++p->misses;
+
 	TEXFBO::init(cnode.obj);
 	TEXFBO::allocEmpty(cnode.obj, width, height);
 	TEXFBO::linkFBO(cnode.obj);
@@ -213,4 +221,11 @@ void TexPool::disable()
 	p->disabled = true;
 }
 
-
+void TexPool::getStats(Stats &out) const
+{
+	out.bytes = p->memSize;
+	out.budget = p->maxMemSize;
+	out.textures = p->objCount;
+	out.hits = p->hits;
+	out.misses = p->misses;
+}
@@ -37,6 +37,22 @@ public:
 
 	void disable();
 
+	struct Stats
+	{
+		/* Memory used by cached textures, and the limit */
+		uint32_t bytes;
+		uint32_t budget;
+
+		/* Number of cached textures */
+		uint32_t textures;
+
+		/* Requests served from the cache / by allocating */
+		uint32_t hits;
+		uint32_t misses;
+	};
+
+	void getStats(Stats &out) const;
+
 private:
 	TexPoolPrivate *p;
 };
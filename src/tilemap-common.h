@@ -184,6 +184,7 @@ struct FlashMap
 		shader.setTranslation(trans);
 
 		gl.DrawElements(GL_TRIANGLES, count * 6, _GL_INDEX_TYPE, 0);
+		PERF_COUNT(drawCalls, 1);
 
 		glState.blendMode.pop();
 
@@ -992,6 +992,7 @@ void GroundLayer::draw()
 void GroundLayer::drawInt()
 {
 	gl.DrawElements(GL_TRIANGLES, vboCount, _GL_INDEX_TYPE, (GLvoid*) 0);
+	PERF_COUNT(drawCalls, 1);
 }
 
 void GroundLayer::onGeometryChange(const Scene::Geometry &geo)
@@ -1040,6 +1041,7 @@ void ZLayer::draw()
 void ZLayer::drawInt()
 {
 	gl.DrawElements(GL_TRIANGLES, vboBatchCount, _GL_INDEX_TYPE, (GLvoid*) vboOffset);
+	PERF_COUNT(drawCalls, 1);
 }
 
 int ZLayer::calculateZ(TilemapPrivate *p, int index)
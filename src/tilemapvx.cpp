@@ -314,6 +314,7 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 		GLMeta::vaoBind(vao);
 
 		gl.DrawElements(GL_TRIANGLES, groundQuads*6, _GL_INDEX_TYPE, 0);
+		PERF_COUNT(drawCalls, 1);
 
 		GLMeta::vaoUnbind(vao);
 	}
@@ -334,6 +335,7 @@ struct TilemapVXPrivate : public ViewportElement, TileAtlasVX::Reader
 
 		gl.DrawElements(GL_TRIANGLES, aboveQuads*6, _GL_INDEX_TYPE,
 		                (GLvoid*) (groundQuads*6*sizeof(index_t)));
+		PERF_COUNT(drawCalls, 1);
 
 		GLMeta::vaoUnbind(vao);
 	}
@@ -23,6 +23,7 @@
 #define UTIL_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
 #include <algorithm>
 #include <vector>
@@ -87,6 +88,22 @@ inline bool readFile(const char *path,
 	return true;
 }
 
+#define FNV1A_64_INIT 14695981039346656037ULL
+
+/* 64 bit FNV-1a over 'len' bytes at 'data'. To hash
+ * multiple buffers as one, pass the previous result
+ * as 'hash' */
+inline uint64_t hashBytes(const void *data, size_t len,
+                          uint64_t hash = FNV1A_64_INIT)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+
+	return hash;
+}
+
 inline void strReplace(std::string &str,
                        char before, char after)
 {
@@ -26,6 +26,15 @@
 #include <vorbis/vorbisfile.h>
 #include <vector>
 #include <algorithm>
+#include <string.h>
+
+/* How much audio right after the loop start is kept
+ * decoded, to be spliced in on every wrap around */
+#define LOOP_CACHE_SECONDS 1
+
+/* Minimum distance between two recorded page offsets,
+ * in fractions of a second */
+#define PAGE_MARK_SPACING 4
 
 static size_t vfRead(void *ptr, size_t size, size_t nmemb, void *ops)
 {
@@ -50,6 +59,20 @@ static ov_callbacks OvCallbacks =
     vfTell
 };
 
+/* A page offset recorded while decoding. Raw seeking to
+ * 'offset' resumes decoding at or after 'frame' */
+struct PageMark
+{
+	uint32_t frame;
+	ogg_int64_t offset;
+};
+
+static bool
+frameBeforeMark(uint32_t frame, const PageMark &mark)
+{
+	return frame < mark.frame;
+}
+
 
 struct VorbisSource : ALDataSource
 {
@@ -78,11 +101,31 @@ struct VorbisSource : ALDataSource
 
 	std::vector<int16_t> sampleBuf;
 
+	/* Page offsets of decoded data, sorted by frame. These let
+	 * us seek back into already played audio with a single raw
+	 * seek instead of bisecting the whole file */
+	std::vector<PageMark> pages;
+
+	/* Audio right after the loop start, captured while it is
+	 * decoded. On wrap around, the decoder is moved to a page
+	 * inside this range and the data up to it is served from
+	 * here, so no sample exact seek is needed */
+	struct
+	{
+		std::vector<int16_t> pcm;
+
+		/* Range of 'pcm' (in samples) still to be served */
+		size_t splicePos;
+		size_t spliceEnd;
+	} loopCache;
+
 	VorbisSource(SDL_RWops &ops,
 	             bool looped)
 	    : src(ops),
 	      currentFrame(0)
 	{
+		loopCache.splicePos = loopCache.spliceEnd = 0;
+
 		int error = ov_open_callbacks(&src, &vf, 0, 0, OvCallbacks);
 
 		if (error)
@@ -156,22 +199,168 @@ struct VorbisSource : ALDataSource
 		return info.rate;
 	}
 
+	/* Remembers the page the decoder is about to read,
+	 * if there's no recorded one close by yet */
+	void markPage()
+	{
+		const uint32_t spacing = info.rate / PAGE_MARK_SPACING;
+
+		std::vector<PageMark>::iterator it =
+			std::upper_bound(pages.begin(), pages.end(),
+			                 currentFrame, frameBeforeMark);
+
+		if (it != pages.begin() && currentFrame - (it-1)->frame < spacing)
+			return;
+
+		if (it != pages.end() && it->frame - currentFrame < spacing)
+			return;
+
+		PageMark mark = { currentFrame, ov_raw_tell(&vf) };
+
+		if (mark.offset >= 0)
+			pages.insert(it, mark);
+	}
+
+	/* Raw seeks to the closest recorded page at or before 'frame'.
+	 * Returns the frame decoding resumes at, or -1 if there
+	 * is no suitable page */
+	ogg_int64_t seekPage(uint32_t frame)
+	{
+		std::vector<PageMark>::iterator it =
+			std::upper_bound(pages.begin(), pages.end(),
+			                 frame, frameBeforeMark);
+
+		/* The page after a mark can start a bit past the mark's
+		 * frame, in which case the one before it will do */
+		for (int i = 0; i < 2 && it != pages.begin(); ++i)
+		{
+			--it;
+
+			if (ov_raw_seek(&vf, it->offset) != 0)
+				break;
+
+			ogg_int64_t at = ov_pcm_tell(&vf);
+
+			if (at >= 0 && at <= frame)
+				return at;
+		}
+
+		return -1;
+	}
+
+	/* Decodes and drops 'frames' frames */
+	bool skipFrames(uint32_t frames)
+	{
+		char scratch[4096];
+
+		while (frames > 0)
+		{
+			int len = std::min<uint32_t>(frames * info.frameSize, sizeof(scratch));
+			long res = ov_read(&vf, scratch, len, 0, sizeof(int16_t), 1, 0);
+
+			if (res <= 0)
+				return false;
+
+			frames -= res / info.frameSize;
+			currentFrame += res / info.frameSize;
+		}
+
+		return true;
+	}
+
+	/* Sample exact seek, cheap if 'frame' was decoded before */
+	bool seekFrame(uint32_t frame)
+	{
+		ogg_int64_t at = seekPage(frame);
+
+		if (at >= 0)
+		{
+			currentFrame = at;
+
+			return skipFrames(frame - at);
+		}
+
+		if (ov_pcm_seek(&vf, frame) != 0)
+			return false;
+
+		currentFrame = frame;
+
+		return true;
+	}
+
+	bool seekLoopStart()
+	{
+		uint32_t cacheEnd = loop.start + loopCache.pcm.size() / info.channels;
+		ogg_int64_t at = seekPage(cacheEnd);
+
+		if (at >= loop.start)
+		{
+			/* Serve everything up to the page we landed on
+			 * from the cache, and decode from there on */
+			loopCache.splicePos = 0;
+			loopCache.spliceEnd = (at - loop.start) * info.channels;
+			currentFrame = at;
+
+			return true;
+		}
+
+		if (at >= 0)
+		{
+			currentFrame = at;
+
+			return skipFrames(loop.start - at);
+		}
+
+		if (ov_pcm_seek(&vf, loop.start) != 0)
+			return false;
+
+		currentFrame = loop.start;
+
+		return true;
+	}
+
+	/* Captures the part of freshly decoded data that
+	 * continues the cached loop start audio */
+	void cacheLoopStart(const int16_t *data, uint32_t frame, uint32_t frames)
+	{
+		uint32_t cacheEnd = loop.start + loopCache.pcm.size() / info.channels;
+		uint32_t limit = std::min<uint32_t>(loop.start + LOOP_CACHE_SECONDS * info.rate,
+		                                    loop.end);
+
+		if (cacheEnd >= limit || frame > cacheEnd || frame + frames <= cacheEnd)
+			return;
+
+		uint32_t from = cacheEnd - frame;
+		uint32_t to = std::min(frame + frames, limit) - frame;
+
+		loopCache.pcm.insert(loopCache.pcm.end(),
+		                     data + from * info.channels,
+		                     data + to * info.channels);
+	}
+
 	void seekToOffset(float seconds)
 	{
+		loopCache.splicePos = loopCache.spliceEnd = 0;
+
 		if (seconds <= 0)
 		{
 			ov_raw_seek(&vf, 0);
 			currentFrame = 0;
+
+			return;
 		}
 
-		currentFrame = seconds * info.rate;
+		uint32_t frame = seconds * info.rate;
 
-		if (loop.valid && currentFrame > loop.end)
-			currentFrame = loop.start;
+		if (loop.valid && frame > loop.end)
+			frame = loop.start;
 
 		/* If seeking fails, just seek back to start */
-		if (ov_pcm_seek(&vf, currentFrame) != 0)
+		if (!seekFrame(frame))
+		{
 			ov_raw_seek(&vf, 0);
+			currentFrame = 0;
+		}
 	}
 
 	Status fillBuffer(AL::Buffer::ID alBuffer)
@@ -193,8 +382,24 @@ struct VorbisSource : ALDataSource
 			canRead = std::min(availBuf, tilLoopEnd);
 		}
 
+		if (loopCache.splicePos < loopCache.spliceEnd)
+		{
+			size_t count = std::min<size_t>(loopCache.spliceEnd - loopCache.splicePos,
+			                                canRead / sizeof(int16_t));
+
+			memcpy(bufPtr, &loopCache.pcm[loopCache.splicePos],
+			       count * sizeof(int16_t));
+
+			loopCache.splicePos += count;
+			bufUsed += count;
+			bufPtr = &sampleBuf[bufUsed];
+			canRead -= count * sizeof(int16_t);
+		}
+
 		while (canRead > 16)
 		{
+			markPage();
+
 			long res = ov_read(&vf, static_cast<char*>(bufPtr),
 			                   canRead, 0, sizeof(int16_t), 1, 0);
 
@@ -237,6 +442,10 @@ struct VorbisSource : ALDataSource
 				readAgain = true;
 			}
 
+			if (loop.valid)
+				cacheLoopStart(&sampleBuf[bufUsed], currentFrame,
+				               res / info.frameSize);
+
 			bufUsed += (res / sizeof(int16_t));
 			bufPtr = &sampleBuf[bufUsed];
 			currentFrame += (res / info.frameSize);
@@ -251,8 +460,7 @@ struct VorbisSource : ALDataSource
 				retStatus = ALDataSource::WrapAround;
 
 				/* Seek to loop start */
-				currentFrame = loop.start;
-				if (ov_pcm_seek(&vf, currentFrame) != 0)
+				if (!seekLoopStart())
 					retStatus = ALDataSource::Error;
 
 				break;
@@ -262,9 +470,17 @@ struct VorbisSource : ALDataSource
 		}
 
 		if (retStatus != ALDataSource::Error)
+		{
 			AL::Buffer::uploadData(alBuffer, info.alFormat, sampleBuf.data(),
 			                       bufUsed*sizeof(int16_t), info.rate);
 
+			if (capture)
+			{
+				const uint8_t *data = reinterpret_cast<uint8_t*>(sampleBuf.data());
+				capture->insert(capture->end(), data, data + bufUsed*sizeof(int16_t));
+			}
+		}
+
 		return retStatus;
 	}
 